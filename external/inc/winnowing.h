@@ -3,7 +3,12 @@
 
 #include <stdint.h>    
 
+/* Scratch buffers needed by winnowing_buffers() for a given limit */
+#define WINNOWING_GRAMS_SIZE(limit) ((size_t) (limit))
+#define WINNOWING_WINDOWS_SIZE(limit) ((size_t) (limit) * 4)
+
 uint32_t winnowing (char *src, uint32_t *hashes, uint32_t *lines, uint32_t limit);
+uint32_t winnowing_buffers (char *src, uint32_t *hashes, uint32_t *lines, uint32_t limit, uint8_t *grams, uint32_t *windows);
 extern uint8_t GRAM;   // Winnowing gram size in bytes
 extern uint8_t WINDOW;  // Winnowing window size in bytes
 extern uint32_t MAX_UINT32;
@@ -83,19 +83,26 @@ static uint32_t add_hash(uint32_t hash, uint32_t line, uint32_t *hashes, uint32_
 
 uint32_t winnowing(char *src, uint32_t *hashes, uint32_t *lines, uint32_t limit)
 {
-	uint32_t hash = MAX_UINT32;
-	uint32_t last = 0;
-
 	uint8_t *grams =  calloc(limit, 1);
 	uint32_t *windows = calloc (limit * 4,1);
 
-	if (!grams || !windows)
-	{
-		free(grams);
-		free(windows);
-		return 0;
-	}
-	
+	uint32_t counter = 0;
+	if (grams && windows)
+		counter = winnowing_buffers(src, hashes, lines, limit, grams, windows);
+
+	free (windows);
+	free (grams);
+	return counter;
+}
+
+/* Same as winnowing(), with the gram and window buffers provided by the caller
+   (WINNOWING_GRAMS_SIZE and WINNOWING_WINDOWS_SIZE bytes, not necessarily zeroed) */
+
+uint32_t winnowing_buffers(char *src, uint32_t *hashes, uint32_t *lines, uint32_t limit, uint8_t *grams, uint32_t *windows)
+{
+	uint32_t hash = MAX_UINT32;
+	uint32_t last = 0;
+
 	uint8_t *gram = grams;
 	uint32_t *window = windows;
 	
@@ -158,7 +165,5 @@ uint32_t winnowing(char *src, uint32_t *hashes, uint32_t *lines, uint32_t limit)
 		}
 	}
 
-	free (windows);
-	free (grams);
 	return counter;
 }
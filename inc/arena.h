@@ -0,0 +1,17 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024) // first block of each thread, later blocks double in size
+#define ARENA_ALIGN 16
+
+/* Scratch memory of the calling thread, valid until the next arena_reset().
+   Every per-file entry point (mine_entry, mine_local_file, the mz handlers) resets it */
+void *arena_alloc(size_t size);
+void *arena_calloc(size_t size);
+void *arena_grow(void *ptr, size_t old_size, size_t size);
+void arena_reset(void);
+void arena_thread_free(void);
+
+#endif
@@ -1,7 +1,8 @@
 #ifndef __ATTRIB_H
     #define __ATTRIB_H
 
-void mine_attribution_notice(struct minr_job *job, char *path);
+void mine_attribution_notice(struct minr_job *job, char *path, char *data, uint64_t ln);
+bool license_file_name(char *path);
 bool is_attribution_notice(char *path);
 
 #endif
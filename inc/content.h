@@ -0,0 +1,31 @@
+#ifndef __CONTENT_H
+#define __CONTENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "crypto.h"
+
+/* What the detectors need from a file, collected in a single pass by content_scan */
+struct content_stats
+{
+	uint64_t nul;               // offset of the first NUL byte (the size when there is none)
+
+	/* Quality statistics, up to the first NUL */
+	int lines;
+	int comments;               // lines starting with //, /* or #
+	int relevant_bytes;         // bytes in lines longer than two
+	bool tab_start;             // some line is indented with tabs
+	bool space_start;           // some line is indented with spaces
+	bool spdx_tag;              // SPDX-License-Identifier found in the header
+
+	/* Crypto keywords found, in order of appearance (arena memory) */
+	struct T_TrieNode **keywords;
+	int keyword_count;
+	int keyword_size;
+};
+
+void content_scan(struct content_stats *stats, char *src, uint64_t src_ln, bool tokens);
+void content_scan_tail(struct content_stats *stats, char *src, uint64_t src_ln);
+void content_header_cut(struct content_stats *stats, char *src, uint64_t src_ln);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef __COPYRIGHT_H
     #define __COPYRIGHT_H
 
-void mine_copyright(char *mined_path, char *md5, char *src, uint64_t src_ln, bool license_file);
+struct sink;
+
+void mine_copyright(struct sink *out, char *md5, char *src, uint64_t src_ln, bool license_file);
 void char_replace(char *string, char replace, char with);
 
 #endif
@@ -3,8 +3,29 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-void mine_crypto(char *mined_path, char *md5, char *src, uint64_t src_ln);
+
+#define LEAF_COUNT 40
+
+struct T_TrieNode;
+struct T_TrieNode{
+	int type;
+	int ocurrences;
+	unsigned short coding;
+	struct T_TrieNode * nodos[LEAF_COUNT];
+	//char algorithmName[20];
+	char *algorithmName;
+};
+
+/* Keyword trie and the trie index of each character (-1 for characters ending a token) */
+extern struct T_TrieNode *root;
+extern int8_t crypto_index[256];
+
+struct content_stats;
+struct sink;
+
+void mine_crypto(struct sink *out, char *md5, char *src, uint64_t src_ln);
+void mine_crypto_scanned(struct sink *out, char *md5, struct content_stats *stats, char *src, uint64_t src_ln);
 void load_crypto_definitions(void);
 void create_crypto_definitions(char * path);
 void clean_crypto_definitions(void);
-#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef __EXTRACT_H
+#define __EXTRACT_H
+
+#include <zlib.h>
+#include "minr.h"
+
+#define EXTRACT_TAR_BLOCK 512
+#define EXTRACT_MAX_HEADER (1024 * 1024) // Largest GNU long name or pax header accepted
+
+typedef enum
+{
+	EXTRACT_ZIP = 0,
+	EXTRACT_TAR,
+	EXTRACT_TAR_GZ
+} extract_format_t;
+
+/* A zip file entry, from the central directory */
+struct extract_zip_entry
+{
+	char *name;
+	uint64_t offset;            // compressed data offset in the archive
+	uint32_t zsize;
+	uint32_t size;
+	uint16_t method;
+};
+
+/* A tar hard link, materialised by tar as a copy of an earlier entry */
+struct extract_tar_link
+{
+	char *name;
+	char *target;
+};
+
+/* A downloaded archive, mapped in memory to be mined without expanding it to disk */
+struct extract_archive
+{
+	extract_format_t format;
+	char *path;                 // archive path, for the external tools (see extract_mine)
+	uint8_t *data;
+	uint64_t ln;
+	uint8_t md5[MD5_LEN];       // MD5 of the archive (urlid)
+	char root[MAX_PATH_LEN];    // directory the archive would be expanded into
+	char stem[MAX_PATH_LEN];    // archive name without its last extension
+	char prefix[MAX_PATH_LEN];  // top directory to be mined (named after the archive), or empty
+	struct extract_zip_entry *entries;
+	uint32_t entry_count;
+	struct extract_tar_link *links;
+	uint32_t link_count;
+	uint32_t delivered;         // entries mined so far
+	z_stream zs;                // raw inflate state for zip entries
+	bool zs_ready;
+};
+
+bool extract_supported(char *path);
+char *extract_normalize(char *name);
+struct extract_archive *extract_open(char *path);
+bool extract_mine(struct minr_job *job, struct extract_archive *archive);
+void extract_close(struct extract_archive *archive);
+
+#endif
@@ -4,18 +4,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/types.h>
+
+struct sink;
 
 uint64_t get_file_size(char *path);
 void read_file(char *out, char *path, uint64_t maxlen);
 bool is_file(char *path);
+bool is_file_mode(char *path, mode_t mode);
 bool is_dir(char *path);
 uint64_t file_size(char *path);
 int *open_snippet (char *base_path);
 bool not_a_dot (char *path);
 bool create_dir(char *path);
 bool valid_path(char *dir, char *file);
+void walk_tree(char *root, void (*found)(void *ptr, char *path), void *ptr);
 bool check_disk_free(char *file, uint64_t needed);
-FILE **open_file (char *mined_path, char * set_name);
+struct sink **open_file (char *mined_path, char * set_name);
 int append_to_csv_file(char *mined_path, char * set_name, int sector, char * line);
  void rm_dir(char *path);
+bool sync_dir(char *path);
+bool file_write_synced(char *path, uint8_t *data, uint64_t ln);
+void sync_parent(char *path);
+bool file_replace(char *path, uint8_t *data, uint64_t ln);
 #endif
\ No newline at end of file
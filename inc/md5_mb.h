@@ -0,0 +1,27 @@
+#ifndef __MD5_MB_H
+#define __MD5_MB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MD5_MB_LANES 8       // buffers hashed at once by the AVX2 engine
+#define MD5_MB_DIGEST 16
+
+/* Buffers waiting to be hashed together, copied into slots reused across batches */
+struct md5_batch
+{
+	int count;
+	char *data[MD5_MB_LANES];
+	uint64_t ln[MD5_MB_LANES];
+	uint8_t md5[MD5_MB_LANES][MD5_MB_DIGEST];
+	char *slot[MD5_MB_LANES];
+	uint64_t slot_size[MD5_MB_LANES];
+};
+
+bool md5_mb_available(void);
+void md5_mb(uint8_t **data, uint64_t *ln, uint8_t (*md5)[MD5_MB_DIGEST], int count);
+char *md5_batch_add(struct md5_batch *batch, char *data, uint64_t ln);
+void md5_batch_run(struct md5_batch *batch);
+void md5_batch_free(struct md5_batch *batch);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __MINE_POOL_H
+#define __MINE_POOL_H
+
+#include <pthread.h>
+#include "minr.h"
+
+#define MINE_QUEUE_SIZE 4096
+#define MINE_QUEUE_BYTES (256 * 1048576) // Limit of file contents waiting in the queue
+
+/* A file waiting to be mined, with its contents when extracted in memory */
+struct mine_item
+{
+	char *path;
+	char *data;
+	uint64_t ln;
+};
+
+/* Files found by recurse() or extracted from an archive, waiting to be mined by a worker */
+struct mine_queue
+{
+	struct mine_item items[MINE_QUEUE_SIZE];
+	int head;
+	int count;
+	uint64_t bytes;             // size of the queued file contents
+	bool done;                  // traversal finished
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct mine_worker *workers;
+	pthread_t *tids;
+	int threads;
+};
+
+/* Serialize appends to the shared notices/ archives */
+extern pthread_mutex_t mine_csv_lock;
+
+void mine_sector_lock(uint8_t sector);
+void mine_sector_unlock(uint8_t sector);
+void mine_submit(struct minr_job *job, char *path, char *data, uint64_t ln);
+void mine_pool_start(struct minr_job *job);
+void mine_pool_stop(struct minr_job *job);
+void mine_tree(struct minr_job *job, char *path);
+
+#endif
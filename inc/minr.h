@@ -34,7 +34,9 @@
 #define MAX_ARG_LEN 1024
 #define MIN_FILE_REC_LEN 70
 #define MAX_PATH_LEN 4096
+#define DOWNLOAD_MAX_EXCLUDE 65536 // Limit of the file names excluded in an unzip command line
 #define MAX_FILE_SIZE (8 * 1048576)
+#define LOAD_MMAP_SIZE 1048576 // files from this size on are mapped rather than read (see load_file)
 #define MAX_FILE_HEADER 4096
 #define MAX_HEADER_LINES 30
 #define MAX_CSV_LINE_LEN 1024
@@ -99,6 +101,10 @@ struct minr_job
 	char url[MAX_ARG_LEN];
 	char urlid[MD5_LEN * 2 + 1];
 	char download_url[MAX_ARG_LEN]; // Manually specified download URL (-U)
+	char batch[MAX_ARG_LEN];        // Manifest of components to be mined in one run (--batch)
+	int fetchers;                   // Download, expansion and mining workers of a batch (--pipeline)
+	int extractors;
+	int miners;
 	char metadata[MAX_ARG_LEN];
 	char license[MAX_ARG_LEN];    // Declared url license
 	char mined_path[MAX_ARG_LEN]; // Location of output mined/ directory
@@ -109,12 +115,14 @@ struct minr_job
 	bool exclude_detection;
 	bool scancode_mode;
 	char local_mining;
+	int threads; // Number of worker threads (-j)
 	
 	// minr -i
 	char dbname[MAX_PATH_LEN];
 	char import_path[MAX_PATH_LEN];
 	char import_table[MAX_PATH_LEN];
 	bool import_overwrite;
+	bool import_shadow; // Build tables into <table>.new and swap them in when done (-N)
 	bool skip_sort; // Do not sort before importing
 	bool skip_csv_check; // Do not check number of CSV fields
 	bool skip_delete; // Do not delete, -k(eep) files after importing
@@ -124,6 +132,8 @@ struct minr_job
 	// minr -f -t
 	char join_from[MAX_PATH_LEN];
 	char join_to[MAX_PATH_LEN];
+	bool join_merge; // Merge sorted sectors instead of appending (--merge)
+	bool join_mz_dedup; // Remove duplicated records from joined mz archives (--mz-dedup)
 
 	// minr -z
 	char mz[MAX_PATH_LEN];
@@ -138,10 +148,17 @@ struct minr_job
 	normalized_license *licenses; // Array of known license identifiers
 	int license_count;            // Number of known license identifiers
 
-	FILE **out_file;
-	FILE **out_file_extra;
-	FILE * out_pivot;
-	FILE *out_pivot_extra;
+	struct sink **out_file;
+	struct sink **out_file_extra;
+	struct sink *out_pivot;
+	struct sink *out_pivot_extra;
+	struct sink *out_url;          // mined/ tables, resolved once by url_mine_begin
+	struct sink *out_license;
+	struct sink *out_copyright;
+	struct sink *out_quality;
+	struct sink *out_crypto;
+	struct sink *out_attribution;
+	struct mine_queue *mine_queue; // Files found by recurse() are queued here for the mining workers (-j)
 
 };
 
@@ -155,19 +172,32 @@ extern char *ATTRIBUTION_NOTICES[];
 
 bool check_dependencies(void);
 bool download(struct minr_job *job);
+char *download_fetch(struct minr_job *job);
+void download_expand(struct minr_job *job, char *tmp_file);
+void load_urlid(struct minr_job *job, char *tmp_file);
 void recurse(struct minr_job *job, char *path);
+void mine(struct minr_job *job, char *path);
+void mine_entry(struct minr_job *job, char *path, char *data, uint64_t ln, uint8_t *md5);
+bool mine_wanted(struct minr_job *job, char *path, uint64_t size);
 void minr_join(struct minr_job *job);
-void minr_join_mz(char * table, char *source, char *destination, bool skip_delete, bool encrypted);
+void minr_join_mz(char * table, char *source, char *destination, bool skip_delete, int threads);
+void minr_join_mz_dir(char *src_dir_path, char *dst_dir_path, bool skip_delete, int threads);
+bool move_file(char *src, char *dst, bool skip_delete);
+bool file_append(char *file, char *destination);
 void mine_license(struct minr_job *job, char *id, bool license_file);
 bool mine_license_exec(struct minr_job *job);
-void mine_copyright(char *mined_path, char *md5, char *src, uint64_t src_ln, bool license_file);
-void mine_quality(char *mined_path, char *md5, char *src, long size);
+void mine_copyright(struct sink *out, char *md5, char *src, uint64_t src_ln, bool license_file);
+void mine_quality(struct sink *out, char *md5, char *src, long size);
 normalized_license *load_licenses(int *count);
 void mine_local_directory(struct minr_job *job, char* root);
 void mine_local_file(struct minr_job *job, char *path);
 void extract_csv(char *out, char *in, int n, long limit);
 int count_chr(char chr, char *str);
 int load_file(struct minr_job *job, char *path);
+int load_buffer(struct minr_job *job, char *data, uint64_t ln, bool copy, uint8_t *md5);
+char *load_contents(char *path, uint64_t *ln);
+void unload_file(struct minr_job *job);
+void load_thread_free(void);
 void print_md5(uint8_t *md5);
 bool check_file_extension(char * path, bool bin_mode);
 #endif
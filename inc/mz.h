@@ -12,7 +12,10 @@ typedef enum
     MZ_OPTIMISE_UNWANTED_HEADER = 16
 }mz_optimise_mode_t;
 
+extern char mz_dbname[];
+
 void mz_optimise(struct mz_job *job, mz_optimise_mode_t mode);
+void mz_optimise_dir(struct mz_job *job, mz_optimise_mode_t mode, int threads);
 void mz_extract(struct mz_job *job);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef __MZ_CODEC_H
+#define __MZ_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Record codecs. zstd records are told apart by their frame magic number */
+typedef enum
+{
+	MZ_CODEC_ZLIB = 0,
+	MZ_CODEC_ZSTD = 1
+} mz_codec_t;
+
+#define MZ_ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define MZ_ZSTD_LEVEL 9
+#define MZ_DICT_MAX 16
+#define MZ_DICT_SIZE (112 * 1024)
+#define MZ_DICT_SAMPLE_LN (64 * 1024)
+#define MZ_DICT_SAMPLES_LN (128 * 1048576)
+#define MZ_INFLATE_MIN_LN (64 * 1024)
+
+struct mz_job;
+struct mz_cache_item;
+
+bool mz_codec_set(char *name);
+void mz_codec_level(int level);
+bool mz_dict_load(char *path);
+void mz_codec_free(void);
+uint64_t mz_record_bound(uint64_t src_ln);
+uint64_t mz_record_compress(uint8_t *id, char *src, uint64_t src_ln, uint8_t *out);
+bool mz_record_inflate(uint8_t *zdata, uint32_t zdata_ln, char *data, uint64_t *data_ln);
+char *mz_inflate_buffer(uint8_t *zdata, uint32_t zdata_ln, uint64_t *data_ln);
+void mz_job_inflate(struct mz_job *job);
+void mz_codec_thread_free(void);
+void mz_codec_add(char *mined_path, uint8_t *md5, char *src, int src_ln, bool check, uint8_t *zsrc, struct mz_cache_item *mz_cache);
+bool mz_dict_train(char *path, char *dict_path);
+void mz_recompress(char *path, int threads);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __MZ_INDEX_H
+#define __MZ_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Sidecar index extension, appended to the archive path (0a1f.mz -> 0a1f.mzi) */
+#define MZ_INDEX_EXT "i"
+#define MZ_INDEX_MAGIC "MZI1"
+
+/* Index entry: MZ_MD5-byte id, 8-byte record offset and 4-byte compressed length */
+#define MZ_INDEX_ENTRY_LN (14 + 8 + 4)
+
+/**
+ * Index header. Entries follow, sorted by id (then offset).
+ * The index is only valid while the archive size and mtime match
+ */
+struct mz_index_header
+{
+	char magic[4];
+	uint32_t count;      // number of entries
+	uint64_t mz_ln;      // archive size
+	int64_t mtime_sec;   // archive mtime
+	int64_t mtime_nsec;
+};
+
+struct mz_job;
+
+bool mz_index_write(char *mz_path, uint8_t *mz, uint64_t mz_ln);
+bool mz_index_build(char *mz_path);
+bool mz_index_extend(char *mz_path, uint64_t old_ln);
+bool mz_index_valid(char *mz_path);
+void mz_index_remove(char *mz_path);
+int mz_index_lookup(char *mz_path, uint8_t *id, uint64_t *offset, uint32_t *zdata_ln);
+bool mz_index_cat(struct mz_job *job, char *key);
+
+#endif
@@ -6,5 +6,6 @@ void mz_mine_copyright(struct mz_job *job);
 void mz_mine_quality(struct mz_job *job);
 void mz_mine_license(struct mz_job *job);
 void mz_mine_crypto(struct mz_job *job);
+void mz_mine_multi(struct mz_job *job, char *path, char *detectors, char *out_path, int threads);
 
 #endif
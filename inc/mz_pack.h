@@ -0,0 +1,51 @@
+#ifndef __MZ_PACK_H
+#define __MZ_PACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A packed mz table directory holds mzpack.idx and segments mzpack.000, mzpack.001... */
+#define MZ_PACK_NAME "mzpack"
+#define MZ_PACK_INDEX MZ_PACK_NAME".idx"
+#define MZ_PACK_MAGIC "MZP1"
+#define MZ_PACK_SEGMENT_LN (1024 * 1048576ULL)
+
+/**
+ * Part of a sector (the contents of an NNNN.mz file) stored in a segment.
+ * A sector is the concatenation of its extents, in segment and offset order
+ */
+struct mz_pack_extent
+{
+	uint64_t offset;   // offset in the segment
+	uint64_t ln;
+	uint16_t mz_id;    // sector (first two MD5 bytes)
+	uint16_t segment;
+	uint32_t unused;
+};
+
+struct mz_pack
+{
+	char path[MAX_PATH_LEN];        // table directory
+	struct mz_pack_extent *extents;
+	uint32_t count;
+	uint32_t size;
+	uint32_t *first;                // first extent of each sector (MZ_FILES + 1 entries)
+	bool sorted;                    // false after appends, until the next read
+	bool changed;
+	uint16_t segment;               // segment receiving appends
+	uint64_t segment_ln;
+};
+
+bool mz_pack_exists(char *dir);
+struct mz_pack *mz_pack_open(char *dir);
+bool mz_pack_close(struct mz_pack *pack);
+uint8_t *mz_pack_read(struct mz_pack *pack, uint16_t mz_id, uint64_t *ln);
+bool mz_pack_append(struct mz_pack *pack, uint16_t mz_id, uint8_t *data, uint64_t ln);
+uint8_t *mz_sector_read(char *dir, struct mz_pack *pack, uint16_t mz_id, uint64_t *ln);
+char **mz_pack_list(struct mz_pack *pack, int *count);
+void mz_pack_remove(char *dir);
+bool mz_pack_convert(char *dir);
+bool mz_unpack_convert(char *dir);
+bool mz_pack_cat(char *dir, char *key);
+
+#endif
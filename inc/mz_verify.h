@@ -0,0 +1,19 @@
+#ifndef __MZ_VERIFY_H
+#define __MZ_VERIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MZ_VERIFY_REPORT "mz_check"
+
+/* Kinds of corrupted records */
+typedef enum
+{
+	MZ_VERIFY_FRAMING = 0, // truncated header or record, the rest of the archive is unreadable
+	MZ_VERIFY_INFLATE,     // the record cannot be decompressed
+	MZ_VERIFY_MD5          // the MD5 of the contents does not match the archive name and record id
+} mz_verify_error_t;
+
+bool mz_verify(char *path, char *report, int threads);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __MZ_WALK_H
+#define __MZ_WALK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Initial number of slots in an id set (grows as needed) */
+#define MZ_ID_SET_INITIAL 4096
+
+/**
+ * Open addressing hash set of MZ_MD5-byte mz record ids
+ */
+struct mz_id_set
+{
+	uint8_t *ids;
+	bool *used;
+	uint64_t size; // number of slots, always a power of two
+	uint64_t count;
+};
+
+/**
+ * An mz record as seen by a header walk: the payload is not decompressed
+ */
+struct mz_record
+{
+	uint8_t *id;       // MZ_MD5-byte id
+	uint8_t *zdata;    // compressed data
+	uint32_t zdata_ln;
+	uint64_t offset;   // record offset in the archive
+	uint64_t ln;       // record length, header included
+};
+
+typedef bool (*mz_walk_handler) (struct mz_record *record, void *ptr);
+
+struct mz_id_set *mz_id_set_new(uint64_t size);
+void mz_id_set_free(struct mz_id_set *set);
+bool mz_id_set_contains(struct mz_id_set *set, uint8_t *id);
+bool mz_id_set_add(struct mz_id_set *set, uint8_t *id);
+
+uint8_t *mz_map(char *path, uint64_t *mz_ln);
+void mz_unmap(uint8_t *mz, uint64_t mz_ln);
+bool mz_walk(uint8_t *mz, uint64_t mz_ln, mz_walk_handler handler, void *ptr);
+uint64_t mz_dedup(uint8_t *mz, uint64_t mz_ln, uint8_t *out, uint32_t *dup_c);
+bool mz_dedup_file(char *path, uint32_t *dup_c);
+bool mz_dump_keys(char *path);
+char **mz_dir_list(char *path, int *count);
+void mz_dir_list_free(char **names, int count);
+
+#endif
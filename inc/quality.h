@@ -1,5 +1,9 @@
 #ifndef __QUALITY_H
     #define __QUALITY_H
 
-void mine_quality(char *mined_path, char *md5, char *src, long size);
-#endif
+struct content_stats;
+struct sink;
+
+void mine_quality(struct sink *out, char *md5, char *src, long size);
+void mine_quality_scanned(struct sink *out, char *md5, struct content_stats *stats, long size);
+#endif
\ No newline at end of file
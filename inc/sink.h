@@ -0,0 +1,33 @@
+#ifndef __SINK_H
+#define __SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#define SINK_BUFFER_SIZE (64 * 1024) // buffered output per file, written out when full
+#define SINK_FLUSH_SECONDS 5         // buffered output older than this is written out on the next write
+#define SINK_LINE_SIZE 8192          // longest line formatted without an allocation
+#define SINK_BUCKETS 1024
+
+/* Buffered appends to a mined/ file, shared by all threads */
+struct sink
+{
+	char *path;
+	char *buf;                  // complete lines only (allocated on the first write)
+	uint64_t ln;
+	time_t flushed;             // time of the last write out
+	bool busy;                  // being written to (see sink_signal)
+	pthread_mutex_t lock;
+	struct sink *next;          // next sink in the same bucket
+};
+
+struct sink *sink_open(char *path);
+struct sink *sink_table(char *mined_path, char *table);
+void sink_write(struct sink *sink, char *data, uint64_t ln);
+void sink_printf(struct sink *sink, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void sink_flush_all(void);
+void sink_close_all(void);
+
+#endif
@@ -13,20 +13,10 @@
 #include <dirent.h>
 #include <string.h>
 #include <stdio.h>
+#include "crypto.h"
 
 #define SINIT 0
 #define SWORD 1
-#define LEAF_COUNT 40
-
-struct T_TrieNode;
-struct T_TrieNode{
-	int type;
-	int ocurrences;
-	unsigned short coding;
-	struct T_TrieNode * nodos[LEAF_COUNT];
-	//char algorithmName[20];
-	char *algorithmName;
-};
 
 FILE 		*fp;
 char		currentName[100];
@@ -1,5 +1,23 @@
 #ifndef __URL_H
     #define __URL_H
 
+/* A component going through the download, expansion and mining stages */
+struct url_component
+{
+	struct minr_job *job;
+	char *root_dir;     // temporary directory, removed once mined (NULL for local folders)
+	char *archive;      // downloaded file, waiting to be expanded
+	struct extract_archive *extract; // downloaded file to be mined in memory (see extract.c)
+	bool downloaded;
+};
+
 void url_download(struct minr_job *job);
+void url_fetch(struct url_component *c);
+void url_expand(struct url_component *c);
+void url_process(struct url_component *c);
+bool url_manifest_parse(char *line, char *metadata, char *url);
+void url_mine_begin(struct minr_job *job);
+void url_mine(struct minr_job *job);
+void url_mine_end(struct minr_job *job);
+int url_batch(struct minr_job *job, char *manifest);
 #endif
@@ -0,0 +1,32 @@
+#ifndef __URL_PIPELINE_H
+#define __URL_PIPELINE_H
+
+#include <pthread.h>
+#include "minr.h"
+#include "url.h"
+
+#define URL_QUEUE_SIZE 16
+#define URL_PIPELINE_MIN_FREE 25 // Fetchers wait while less than this % of tmp_path is free
+
+/* A component of the manifest, with its own copy of the job */
+struct url_item
+{
+	struct url_component component;
+	struct minr_job job;
+};
+
+/* Bounded queue between two stages */
+struct url_queue
+{
+	struct url_item *items[URL_QUEUE_SIZE];
+	int head;
+	int count;
+	int producers;              // workers still feeding the queue
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+int url_pipeline(struct minr_job *job, char *manifest);
+
+#endif
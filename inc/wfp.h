@@ -1,8 +1,11 @@
 #ifndef __WFP_H
 #define __WFP_H
 
+#include <stdint.h>
+
 void wfp_init(char * base_path);
 void wfp_free(void);
 void mz_wfp_extract(char *path);
+void mz_wfp_extract_sector(char *path, uint16_t mz_id, uint8_t *mz, uint64_t mz_ln);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/arena.c
+ *
+ * Per-thread scratch memory for the per-file mining allocations
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file arena.c
+  * @date 18 Oct 2026
+  * @brief The buffers needed while mining a file (compressed record, crypto keywords and
+  * results, copyright statement, snippet buffers) were allocated and freed for every file.
+  * They now come from a bump allocator owned by the calling thread and released all at
+  * once by arena_reset() when the next file starts. When a file needed more than one block,
+  * the reset replaces them with a single block as large as all of them, so once the
+  * largest file has been seen no more memory is requested and the pages already touched
+  * are reused instead of being faulted in again
+  */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+struct arena_block
+{
+	struct arena_block *next;   // previous (smaller) block
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/* Blocks of the calling thread, the one being filled first */
+static __thread struct arena_block *arena = NULL;
+
+/**
+ * @brief Add a block of at least size bytes to the arena of the calling thread
+ *
+ * @param size bytes needed
+ * @return the new block, or NULL
+ */
+static struct arena_block *arena_block_add(size_t size)
+{
+	size_t block_size = arena ? arena->size * 2 : ARENA_BLOCK_SIZE;
+	while (block_size < size)
+		block_size *= 2;
+
+	struct arena_block *block = malloc(sizeof(struct arena_block) + block_size);
+	if (!block)
+		return NULL;
+
+	block->next = arena;
+	block->size = block_size;
+	block->used = 0;
+	arena = block;
+	return block;
+}
+
+/**
+ * @brief Allocate scratch memory, valid until the next arena_reset()
+ *
+ * @param size bytes needed
+ * @return memory aligned to ARENA_ALIGN (not initialised), or NULL
+ */
+void *arena_alloc(size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+	struct arena_block *block = arena;
+	if (!block || block->size - block->used < size)
+		if (!(block = arena_block_add(size)))
+			return NULL;
+
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+/**
+ * @brief Allocate zeroed scratch memory, valid until the next arena_reset()
+ *
+ * @param size bytes needed
+ * @return memory aligned to ARENA_ALIGN, or NULL
+ */
+void *arena_calloc(size_t size)
+{
+	void *ptr = arena_alloc(size);
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+/**
+ * @brief Grow an arena allocation, in place when it is the last one made
+ *
+ * @param ptr memory returned by arena_alloc (or NULL)
+ * @param old_size its size
+ * @param size new size
+ * @return memory holding the old contents, or NULL (ptr is left untouched)
+ */
+void *arena_grow(void *ptr, size_t old_size, size_t size)
+{
+	if (ptr && arena && (char *) ptr >= arena->data && (char *) ptr < arena->data + arena->size)
+	{
+		size_t old_end = (old_size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+		size_t new_end = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+		size_t offset = (char *) ptr - arena->data;
+		if (offset + old_end == arena->used && offset + new_end <= arena->size)
+		{
+			arena->used = offset + new_end;
+			return ptr;
+		}
+	}
+
+	void *grown = arena_alloc(size);
+	if (grown && ptr)
+		memcpy(grown, ptr, old_size);
+	return grown;
+}
+
+/**
+ * @brief Release everything allocated from the arena of the calling thread. The memory
+ * is kept, merged into a single block when the last file needed more than one
+ */
+void arena_reset(void)
+{
+	if (!arena)
+		return;
+
+	if (!arena->next)
+	{
+		arena->used = 0;
+		return;
+	}
+
+	size_t total = 0;
+	while (arena)
+	{
+		struct arena_block *next = arena->next;
+		total += arena->size;
+		free(arena);
+		arena = next;
+	}
+
+	arena_block_add(total);
+}
+
+/**
+ * @brief Release the arena of the calling thread. Called by worker threads before they exit
+ */
+void arena_thread_free(void)
+{
+	while (arena)
+	{
+		struct arena_block *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
@@ -35,6 +35,10 @@
 #include "minr.h"
 #include "scancode.h"
 #include "file.h"
+#include "mz_codec.h"
+#include "mine_pool.h"
+#include "sink.h"
+#include "arena.h"
 #include <dirent.h>
 #include <ctype.h>
 
@@ -82,20 +86,10 @@ bool is_attribution_notice(char *path)
  */
 void attribution_add(struct minr_job *job)
 {
-	char path[MAX_PATH_LEN] = "\0";
-	sprintf(path, "%s/%s.csv", job->mined_path, TABLE_NAME_ATTRIBUTION);
-
 	char notice_id[MD5_LEN * 2 + 1] = "\0";
 	ldb_bin_to_hex(job->md5, MD5_LEN, notice_id);
 
-	FILE *fp = fopen(path, "a");
-	if (!fp)
-	{
-		printf("Cannot create file %s\n", path);
-		exit(EXIT_FAILURE);
-	}
-	fprintf(fp, "%s,%s\n", job->purlid, notice_id);
-	fclose(fp);
+	sink_printf(job->out_attribution, "%s,%s\n", job->purlid, notice_id);
 }
 
 
@@ -104,11 +98,8 @@ void attribution_add(struct minr_job *job)
  * 
  * @param path Path to the file
  */
-static bool validate_file(char *path)
+bool license_file_name(char *path)
 {
-	if (!is_file(path))
-		return false;
-
 	char *file_name = strrchr(path, '/'); //find the las /
 	if (!file_name)							  //if there is not / then point to the path
 		file_name = path;
@@ -145,6 +136,16 @@ static bool validate_file(char *path)
 	return false;
 }
 
+/**
+ * @brief Check if a given file exists and meets one of the name patterns of license_file_name()
+ * 
+ * @param path Path to the file
+ */
+static bool validate_file(char *path)
+{
+	return is_file(path) && license_file_name(path);
+}
+
 /**
  * @brief Find files in to a give directory that math the name patter specified in LICENSE_PATTERN and process those.
  * 
@@ -177,6 +178,7 @@ static bool find_files(struct minr_job *job)
 
 				if (load_file(job, tmp_path))
 					mine_license(job, job->versionid, true);
+				unload_file(job);
 				found = true;
 			}
 		}
@@ -221,11 +223,13 @@ bool mine_license_exec(struct minr_job *job)
  * 
  * @param job pointer to mnir job
  * @param path string path
+ * @param data file contents if already in memory (copied), or NULL to read path
+ * @param ln file size
  */
-void mine_attribution_notice(struct minr_job *job, char *path)
+void mine_attribution_notice(struct minr_job *job, char *path, char *data, uint64_t ln)
 {
 	/* Reload file after license analysis */
-	if (!load_file(job, path))
+	if (!(data ? load_buffer(job, data, ln, true, NULL) : load_file(job, path)))
 		return;
 
 	/* Write entry to mined/attribution.csv */
@@ -237,24 +241,21 @@ void mine_attribution_notice(struct minr_job *job, char *path)
 
 	ldb_prepare_dir(mzpath);
 
-	/* Compress data */
-	job->zsrc_ln = compressBound(job->src_ln + 1);
-	job->zsrc =calloc((job->zsrc_ln + 128), 1);
-
-	/* Save the first bytes of zsrc to accomodate the MZ header */
-	compress(job->zsrc + MZ_HEAD, &job->zsrc_ln, (uint8_t *)job->src, job->src_ln + 1);
-	uint32_t zln = job->zsrc_ln;
-
-	/* Only the last 14 bytes of the MD5 go to the mz record (first two bytes are the file name) */
-	memcpy(job->zsrc, job->md5 + 2, MZ_MD5);
-
-	/* Add the 32-bit compressed file length */
-	memcpy(job->zsrc + MZ_MD5, (char *)&zln, MZ_SIZE);
+	/* Compress data with the selected codec, into an mz record.
+	   Only the last 14 bytes of the MD5 go to the mz record (first two bytes are the file name) */
+	job->zsrc = arena_alloc(mz_record_bound(job->src_ln) + MZ_HEAD);
+	if (!job->zsrc)
+	{
+		unload_file(job);
+		return;
+	}
+	job->zsrc_ln = mz_record_compress(job->md5 + 2, job->src, job->src_ln, job->zsrc);
 
 	int mzid = uint16(job->md5);
-	int mzlen = job->zsrc_ln + MZ_HEAD;
+	int mzlen = job->zsrc_ln;
 
 	sprintf(mzpath, "%s/notices/%04x.mz", job->mined_path, mzid);
+	pthread_mutex_lock(&mine_csv_lock);
 	FILE *f = fopen(mzpath, "a");
 	if (f)
 	{
@@ -266,9 +267,8 @@ void mine_attribution_notice(struct minr_job *job, char *path)
 		}
 		fclose(f);
 	}
+	pthread_mutex_unlock(&mine_csv_lock);
 
-	mine_copyright(job->mined_path, job->purlid, job->src, job->src_ln, true);
-	free(job->src);
-	free(job->zsrc);
-
+	mine_copyright(job->out_copyright, job->purlid, job->src, job->src_ln, true);
+	unload_file(job);
 }
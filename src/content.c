@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/content.c
+ *
+ * Single pass content analysis for the detectors
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file content.c
+  * @date 18 Oct 2026
+  * @brief The binary check, quality and crypto detection used to walk each mined file on
+  * their own (the crypto tokenizer allocating a copy of every word). content_scan collects
+  * what they need in one pass: the first NUL, the line and indentation statistics, the
+  * SPDX tag and the crypto keywords, which are looked up in the trie as the token grows.
+  * Copyright and license detection only read the header and keep their own loops
+  */
+
+#include "minr.h"
+#include "license.h"
+#include "content.h"
+#include "arena.h"
+
+/**
+ * @brief Record a crypto keyword. The results of mine_crypto depend on the sequence of
+ * keywords found, so only a repetition of the previous keyword (which changes nothing) is skipped
+ *
+ * @param stats content statistics
+ * @param node trie node of the keyword
+ */
+static void content_keyword(struct content_stats *stats, struct T_TrieNode *node)
+{
+	if (stats->keyword_count && stats->keywords[stats->keyword_count - 1] == node)
+		return;
+
+	if (stats->keyword_count == stats->keyword_size)
+	{
+		int size = stats->keyword_size ? stats->keyword_size * 2 : 16;
+		struct T_TrieNode **keywords = arena_grow(stats->keywords, stats->keyword_size * sizeof(struct T_TrieNode *), size * sizeof(struct T_TrieNode *));
+		if (!keywords)
+			return;
+		stats->keywords = keywords;
+		stats->keyword_size = size;
+	}
+	stats->keywords[stats->keyword_count++] = node;
+}
+
+/**
+ * @brief Feed a character to the crypto tokenizer. Tokens are runs of trie characters,
+ * and those longer than two ending on an algorithm node are keywords
+ *
+ * @param stats content statistics
+ * @param node trie node reached by the current token (NULL once it left the trie)
+ * @param token_ln length of the current token
+ * @param c character
+ */
+static inline void content_token(struct content_stats *stats, struct T_TrieNode **node, uint64_t *token_ln, char c)
+{
+	int8_t index = crypto_index[(uint8_t) c];
+	if (index >= 0)
+	{
+		if (!(*token_ln)++)
+			*node = root->nodos[index];
+		else if (*node)
+			*node = (*node)->nodos[index];
+		return;
+	}
+
+	if (*token_ln > 2 && *node && (*node)->type != -1 && (*node)->algorithmName)
+		content_keyword(stats, *node);
+	*token_ln = 0;
+}
+
+/**
+ * @brief Scan src once, up to its first NUL byte, collecting the statistics used by
+ * is_binary, mine_quality and mine_crypto
+ *
+ * @param[out] stats content statistics (keywords are kept in the arena until arena_reset)
+ * @param src file contents followed by a NUL byte
+ * @param src_ln file size
+ * @param tokens look for crypto keywords (crypto definitions must be loaded)
+ */
+void content_scan(struct content_stats *stats, char *src, uint64_t src_ln, bool tokens)
+{
+	memset(stats, 0, sizeof(struct content_stats));
+
+	struct T_TrieNode *node = NULL;
+	uint64_t token_ln = 0;
+	int line_length = 0;
+	bool line_start = true;
+	uint64_t i;
+
+	for (i = 0; i < src_ln && src[i]; i++)
+	{
+		char c = src[i];
+
+		if (line_start)
+		{
+			/* Deal with leading spaces and tabs */
+			if (c == ' ') stats->space_start = true;
+			else if (c == '\t') stats->tab_start = true;
+
+			/* Deal with slash star or double slash */
+			else if (c == '/')
+			{
+				if (src[i + 1] == '/' || src[i + 1] == '*') stats->comments++;
+				line_start = false;
+			}
+
+			/* Deal with "#" */
+			else if (c == '#')
+			{
+				stats->comments++;
+				line_start = false;
+			}
+
+			else line_start = false;
+		}
+
+		/* Deal with new line */
+		if (c == '\n')
+		{
+			if (line_length > 2) stats->relevant_bytes += line_length;
+			stats->lines++;
+			line_start = true;
+			line_length = 0;
+		}
+		else line_length++;
+
+		/* Search for SPDX-License-Identifier */
+		if (!stats->spdx_tag && i < MAX_FILE_HEADER)
+			stats->spdx_tag = is_spdx_license_identifier(src + i);
+
+		if (tokens)
+			content_token(stats, &node, &token_ln, c);
+	}
+
+	stats->nul = i;
+	if (tokens)
+		content_token(stats, &node, &token_ln, 0);
+}
+
+/**
+ * @brief Look for crypto keywords past the first NUL byte, which content_scan stops at
+ * (binaries are usually discarded before reaching crypto detection)
+ *
+ * @param stats content statistics
+ * @param src file contents
+ * @param src_ln file size
+ */
+void content_scan_tail(struct content_stats *stats, char *src, uint64_t src_ln)
+{
+	struct T_TrieNode *node = NULL;
+	uint64_t token_ln = 0;
+
+	for (uint64_t i = stats->nul + 1; i < src_ln; i++)
+		content_token(stats, &node, &token_ln, src[i]);
+	content_token(stats, &node, &token_ln, 0);
+}
+
+/**
+ * @brief When mine_license finds no SPDX tag it cuts src at the end of the header, and the
+ * detectors running after it only see that part. Update stats accordingly
+ *
+ * @param stats content statistics
+ * @param src file contents, after mine_license
+ * @param src_ln file size
+ */
+void content_header_cut(struct content_stats *stats, char *src, uint64_t src_ln)
+{
+	if (src_ln > MAX_FILE_HEADER - 1 && stats->nul > MAX_FILE_HEADER - 1 && !src[MAX_FILE_HEADER - 1])
+		stats->nul = MAX_FILE_HEADER - 1;
+}
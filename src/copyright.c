@@ -31,6 +31,8 @@
 
 #include "minr.h"
 #include "copyright.h"
+#include "sink.h"
+#include "arena.h"
 
 bool is_file(char *path);
 bool is_dir(char *path);
@@ -145,7 +147,7 @@ int copyright_len(char *txt)
 }
 
 /**
- * @brief Allocates memory, copies copyright declaration and returns pointer (or NULL)
+ * @brief Copies copyright declaration into arena memory and returns pointer (or NULL)
  * 
  * @param txt 
  * @return char*  
@@ -155,7 +157,8 @@ char *extract_copyright(char *txt)
 	int len = copyright_len(txt);
 	if (!len) return NULL;
 
-	char *copyright = malloc(len + 1);
+	char *copyright = arena_alloc(len + 1);
+	if (!copyright) return NULL;
 	memcpy(copyright, txt, len);
 	copyright[len] = 0;
 	if (copyright[len - 1] == '\n') copyright[len - 1] = 0;
@@ -172,13 +175,13 @@ char *extract_copyright(char *txt)
  * 1 = Detected in file header
  * 2 = Declared in LICENSE file
  * 
- * @param mined_path 
+ * @param out copyright csv sink (NULL prints to stdout)
  * @param md5 
  * @param src 
  * @param src_ln 
  * @param license_file 
  */
-void mine_copyright(char *mined_path, char *md5, char *src, uint64_t src_ln, bool license_file)
+void mine_copyright(struct sink *out, char *md5, char *src, uint64_t src_ln, bool license_file)
 {
 	/* Max bytes/lines to analyze */
 	int max_bytes = MAX_FILE_HEADER;
@@ -186,13 +189,6 @@ void mine_copyright(char *mined_path, char *md5, char *src, uint64_t src_ln, boo
 	int max_lines = 20;
 	int line = 0;
 
-	/* Assemble csv path */
-	char csv_path[MAX_PATH_LEN] = "\0";
-	if (mined_path)
-	{
-		strcpy(csv_path, mined_path);
-		strcat(csv_path, "/"TABLE_NAME_COPYRIGHT".csv");
-	}
 
 	char *s = src;
 	while (*s)
@@ -218,18 +214,9 @@ void mine_copyright(char *mined_path, char *md5, char *src, uint64_t src_ln, boo
 			char *copyright = extract_copyright(s);
 			if (copyright)
 			{
-				if (*csv_path)
-				{
-					FILE *fp = fopen(csv_path, "a");
-					if (license_file)
-						fprintf(fp, "%s,2,%s\n", md5, copyright);
-					else
-						fprintf(fp, "%s,1,%s\n", md5, copyright);
-					fclose(fp);
-				}
+				if (out)
+					sink_printf(out, "%s,%d,%s\n", md5, license_file ? 2 : 1, copyright);
 				else printf("%s,%s\n", md5, copyright);
-
-				free(copyright);
 				return;
 			}
 		}
@@ -36,6 +36,9 @@
 #include <unistd.h>
 #include "minr.h"
 #include "crypto.h"
+#include "content.h"
+#include "arena.h"
+#include "sink.h"
 #include "trie.h"
 #include <string.h>
 #include "crypto_loads.h"
@@ -51,44 +54,38 @@ struct T_SearchResult{
 };
 /**/
 struct T_TrieNode * root;
-struct T_SearchResult * results;
+int8_t crypto_index[256];
 
 /**
  * @brief Appends a new result.
  * 
  * Insert a new element in the result linked list ordered by algorithm name. 
- * If the algorithm already exists, the result is discarded.
+ * If the algorithm already exists, the result is discarded. Nodes are allocated
+ * from the arena and released by arena_reset().
  * 
+ * @param results Pointer to the result list of the file being mined
  * @param element Structure that contains an existing algorithm leaf
  * @return int 
  */
-int appendToResults(struct T_TrieNode *element){
+int appendToResults(struct T_SearchResult **results, struct T_TrieNode *element){
 
-	struct T_SearchResult* temp = (struct T_SearchResult*) calloc(1,sizeof(struct T_SearchResult));
+	struct T_SearchResult* temp = arena_calloc(sizeof(struct T_SearchResult));
+	if (!temp)
+		return 0;
 
 	temp->element= element;
 	temp->nextElement=NULL;
-	struct T_SearchResult* temp2 = results;
-	struct T_SearchResult** temp3 = &results;
+	struct T_SearchResult* temp2 = *results;
+	struct T_SearchResult** temp3 = results;
 	
 	int res =0;
 
 	while((temp2 != NULL) && (res<1) )
 	{
-		if(temp->element==NULL) {
-			free(temp);
-			return 0;
-		}
-		if(temp2->element->algorithmName==NULL) {
-			free(temp);
-			return 0;
-		}
+		if(temp->element==NULL) return 0;
+		if(temp2->element->algorithmName==NULL) return 0;
 		res = strcmp(temp2->element->algorithmName,temp->element->algorithmName);
-		if(res==0)
-		{
-			free(temp);
-			return 0;
-		};
+		if(res==0) return 0;
 		
 		temp3 = &temp2->nextElement;
    	temp2 = temp2->nextElement;
@@ -113,6 +110,10 @@ void load_crypto_definitions(void){
 
     root=(struct T_TrieNode *) calloc (1,sizeof (struct T_TrieNode));
     load_default_crypto();
+
+    /* Trie index of every character, for content_scan */
+    for (int c = 0; c < 256; c++)
+        crypto_index[c] = indexOf((char) c);
     
 }
 
@@ -153,40 +154,6 @@ printf("Creating definitions...\n");
 		// free(root);
 }
 
-/**
- * @brief Gets a token from a valid portion of a char array .
- * 
- * @param	text The text to search from.
- * @param	start Begining of search area. If a valid token is found, the effective begining is returned.
- * @param	end Effective index of token end.
- * @param	maxLen Bounds the search to a limited index.
-*/
-char *getNextToken(char * text,uint64_t *start,uint64_t *end,uint64_t maxLen){
-	uint64_t startToken=*start;
-	uint64_t endToken=0;
-	char *aux;
-	
-	while((startToken<maxLen)&&(indexOf(text[startToken])==-1))
-		startToken++;
-	endToken=startToken;
-	while((endToken<maxLen)&&(indexOf(text[endToken])!=-1))
-		endToken++;
-		
-	if(startToken==endToken){
-	*start=startToken;
-	*end=endToken;
-	return NULL;
-	}
-	aux =(char *) calloc(1,endToken-startToken+1);
-
-	memcpy(aux,&text[startToken],endToken-startToken);
-	aux[endToken-startToken]='\0';
-	*start=startToken;
-	*end=endToken;
-	return aux;
-
-}
-
 /**
  * @brief Free the memory allocated for the cryptographic definitions.
  * 
@@ -198,63 +165,28 @@ void clean_crypto_definitions(void)
 
 
 /**
- * @brief Mines a given path that contains MD5 Files. 
- * @param mined_path 
+ * @brief Output the cryptographic algorithms found by content_scan.
+ * @param out cryptography csv sink (NULL prints to stdout)
  * @param md5 name of file to be mined.
+ * @param stats Content statistics of the file.
  * @param src The contents of the MD5 file.
  * @param src_ln Size of the buffer to be mined (equal to filesize)
- * @since 2.1.2	
 */
-void mine_crypto(char *mined_path, char *md5, char *src, uint64_t src_ln)
+void mine_crypto_scanned(struct sink *out, char *md5, struct content_stats *stats, char *src, uint64_t src_ln)
 {
-	
-	//FILE *fp;
-	char *auxLn;
-	uint64_t start = 0;
-	uint64_t end = 0;
-	/* Assemble csv path */
-	char csv_path[MAX_PATH_LEN] = "\0";
-	char dumpToFile=0;
+	/* The whole buffer is searched, also past a NUL byte */
+	content_scan_tail(stats, src, src_ln);
 
-	if (mined_path)
-	{	dumpToFile=1;
-		strcpy(csv_path, mined_path);
-		strcat(csv_path, "/"TABLE_NAME_CRYPTOGRAPHY".csv");
-	}
-	 FILE * fp;
-	 
-	if (dumpToFile) {
-		fp = fopen(csv_path, "a");
-		dumpToFile=1;
-	}
-	results=NULL;
-	
-	while(start<src_ln){
-		auxLn=getNextToken(src,&start, &end,src_ln);
-		if((start==end)) 
-			break;
-		 else {
-			start=end;
-			if((auxLn!=NULL)&&(strlen(auxLn)>2)){
-			toLower(auxLn);
-			
-			struct T_TrieNode * nodo = searchAlgorithm(auxLn, root) ;
-			if(nodo!=NULL && nodo->algorithmName!=NULL){
-				appendToResults(nodo);
-								
-			}
-			}
-		}
-		if(auxLn!=NULL) free(auxLn);
-	}
+	/* Results are local, so files can be mined concurrently */
+	struct T_SearchResult * results=NULL;
+	for (int i = 0; i < stats->keyword_count; i++)
+		appendToResults(&results, stats->keywords[i]);
 	
 	struct T_SearchResult * aux=results; 
- 	struct T_SearchResult * old=aux;
-	
+
 	while(aux!=NULL){
-	old=aux;
-	if(dumpToFile) 
-		fprintf(fp,"%s,%s,%d\n",md5,
+	if(out) 
+		sink_printf(out,"%s,%s,%d\n",md5,
 					aux->element->algorithmName,
 					aux->element->coding); 
 	else {
@@ -264,19 +196,19 @@ void mine_crypto(char *mined_path, char *md5, char *src, uint64_t src_ln)
 					 }	
 	aux=aux->nextElement;
 	}
-		aux=results;
-		while(aux!=NULL){
-			old=aux;
-			aux=aux->nextElement;
-			free(old);
-	}
-		free(aux);
-		
-		
-		
-	if (dumpToFile)
-		fclose(fp);
-			
-	
-	
+}
+
+/**
+ * @brief Mines a given path that contains MD5 Files. 
+ * @param out cryptography csv sink (NULL prints to stdout)
+ * @param md5 name of file to be mined.
+ * @param src The contents of the MD5 file.
+ * @param src_ln Size of the buffer to be mined (equal to filesize)
+ * @since 2.1.2	
+*/
+void mine_crypto(struct sink *out, char *md5, char *src, uint64_t src_ln)
+{
+	struct content_stats stats;
+	content_scan(&stats, src, src_ln, true);
+	mine_crypto_scanned(out, md5, &stats, src, src_ln);
 }
@@ -0,0 +1,894 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/extract.c
+ *
+ * In-memory extraction of zip and tar archives
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file extract.c
+  * @date 18 Oct 2026
+  * @brief Zip (and jar, whl...), tar and tar.gz archives are mapped (which also gives the
+  * urlid MD5), then their entries are decompressed into memory and passed to mine() with the
+  * paths they would have been expanded to, instead of being written to tmp_path and read back.
+  * Entries mine() would discard by name or size are not decompressed. Zip archives are listed
+  * from their central directory. Tar streams are only read once: the top directory is taken
+  * from the first entry, or from a later one while nothing has been mined yet (a tarball with
+  * other files ahead of a directory named after it is mined whole). Archives using features
+  * not handled here (zip64, encryption, sparse files...) are left to the external tools (see
+  * download_expand), also when a tar stream turns out broken before anything was mined.
+  * Symbolic links are not followed (as with the external tools, which do not mine them), while
+  * tar hard links, which tar materialises as copies, are mined from their target in a second
+  * pass over the stream, only made when the archive holds any
+  */
+
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "minr.h"
+#include <ldb.h>
+#include "file.h"
+#include "minr_log.h"
+#include "attributions.h"
+#include "mine_pool.h"
+#include "extract.h"
+
+#define EXTRACT_DISCARD_LN 65536
+#define EXTRACT_STORED 0
+#define EXTRACT_DEFLATED 8
+
+/* Archive extensions handled in memory */
+static const struct
+{
+	char *extension;
+	extract_format_t format;
+} extract_formats[] = {
+	{".aar", EXTRACT_ZIP},
+	{".egg", EXTRACT_ZIP},
+	{".jar", EXTRACT_ZIP},
+	{".nupkg", EXTRACT_ZIP},
+	{".war", EXTRACT_ZIP},
+	{".whl", EXTRACT_ZIP},
+	{".zip", EXTRACT_ZIP},
+	{".tar", EXTRACT_TAR},
+	{".tar.gz", EXTRACT_TAR_GZ},
+	{".tgz", EXTRACT_TAR_GZ}};
+
+/* Sequential reader of a tar stream, plain or gzipped */
+struct extract_stream
+{
+	uint8_t *in;
+	uint64_t in_ln;
+	uint64_t pos;               // input consumed
+	bool gz;
+	bool ended;                 // last gzip member finished
+	bool error;
+	bool stop;                  // set by a handler to end the walk
+	uint64_t got;               // bytes output by the last extract_read
+	z_stream zs;
+	uint8_t *discard;
+};
+
+typedef bool (*extract_tar_handler)(struct extract_archive *archive, struct extract_stream *s, char *name, uint64_t size, bool dir, char *link, void *ptr);
+
+static uint16_t le16(uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int extract_format(char *path)
+{
+	int ln = strlen(path);
+	for (int i = 0; i < sizeof(extract_formats) / sizeof(extract_formats[0]); i++)
+	{
+		int ext_ln = strlen(extract_formats[i].extension);
+		if (ln > ext_ln && !strcmp(path + ln - ext_ln, extract_formats[i].extension))
+			return extract_formats[i].format;
+	}
+	return -1;
+}
+
+/**
+ * @brief Return true if the archive can be mined in memory (judging by its extension)
+ *
+ * @param path archive path
+ */
+bool extract_supported(char *path)
+{
+	return extract_format(path) >= 0;
+}
+
+/**
+ * @brief Normalize an entry name as the external tools would expand it: leading "/" and "./"
+ * are removed, and names climbing out of the archive are rejected
+ *
+ * @param name entry name (modified)
+ * @return normalized name, or NULL if the entry is not extracted
+ */
+char *extract_normalize(char *name)
+{
+	while (*name == '/' || (name[0] == '.' && name[1] == '/'))
+		name += (*name == '/') ? 1 : 2;
+
+	if (!*name || !strcmp(name, "..") || !strncmp(name, "../", 3) || strstr(name, "/../"))
+		return NULL;
+
+	int ln = strlen(name);
+	if (ln >= 3 && !strcmp(name + ln - 3, "/.."))
+		return NULL;
+
+	return name;
+}
+
+/* Entries under a directory named after the archive make it the top directory (see download_expand) */
+static void extract_check_prefix(struct extract_archive *archive, char *name)
+{
+	int ln = strlen(archive->stem);
+	if (*archive->prefix || !ln)
+		return;
+	if (!strncmp(name, archive->stem, ln) && name[ln] == '/')
+		strcpy(archive->prefix, archive->stem);
+}
+
+/**
+ * @brief List the entries of a zip archive from its central directory
+ *
+ * @param archive archive
+ * @return false if the archive cannot be handled in memory
+ */
+static bool extract_zip_list(struct extract_archive *archive)
+{
+	uint8_t *data = archive->data;
+	uint64_t ln = archive->ln;
+	if (ln < 22)
+		return false;
+
+	/* Find the end of central directory record (followed by a comment of up to 64KB) */
+	uint64_t eocd = ln - 22;
+	uint64_t min = ln > 22 + 65535 ? ln - 22 - 65535 : 0;
+	while (le32(data + eocd) != 0x06054b50)
+	{
+		if (eocd == min)
+			return false;
+		eocd--;
+	}
+
+	uint16_t count = le16(data + eocd + 10);
+	uint32_t cd_ln = le32(data + eocd + 12);
+	uint32_t cd = le32(data + eocd + 16);
+
+	/* Zip64 */
+	if (count == 0xffff || cd == 0xffffffff || (uint64_t) cd + cd_ln > eocd)
+		return false;
+
+	archive->entries = calloc(count + 1, sizeof(struct extract_zip_entry));
+	uint64_t p = cd;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (p + 46 > eocd || le32(data + p) != 0x02014b50)
+			return false;
+
+		uint8_t *h = data + p;
+		uint16_t flags = le16(h + 8);
+		uint16_t method = le16(h + 10);
+		uint32_t zsize = le32(h + 20);
+		uint32_t size = le32(h + 24);
+		uint16_t name_ln = le16(h + 28);
+		uint32_t local = le32(h + 42);
+		bool symlink = (h[5] == 3) && ((le32(h + 38) >> 16) & S_IFMT) == S_IFLNK;
+
+		if (p + 46 + name_ln > eocd)
+			return false;
+		if (zsize == 0xffffffff || size == 0xffffffff || local == 0xffffffff)
+			return false;
+
+		char *name = strndup((char *) h + 46, name_ln);
+		p += 46 + name_ln + le16(h + 30) + le16(h + 32);
+
+		/* Locate the data after the local header */
+		if ((uint64_t) local + 30 > ln || le32(data + local) != 0x04034b50)
+		{
+			free(name);
+			return false;
+		}
+		uint64_t offset = (uint64_t) local + 30 + le16(data + local + 26) + le16(data + local + 28);
+		if (offset + zsize > ln)
+		{
+			free(name);
+			return false;
+		}
+
+		char *normalized = extract_normalize(name);
+		if (normalized)
+			extract_check_prefix(archive, normalized);
+
+		/* Directories and links are not mined */
+		bool dir = name_ln && name[name_ln - 1] == '/';
+		if (!normalized || dir || symlink)
+		{
+			free(name);
+			continue;
+		}
+
+		/* Encrypted files are left to unzip */
+		if (flags & 1)
+		{
+			free(name);
+			return false;
+		}
+
+		/* Only stored and deflated entries are handled */
+		if (method != EXTRACT_STORED && method != EXTRACT_DEFLATED)
+		{
+			free(name);
+			return false;
+		}
+
+		struct extract_zip_entry *entry = &archive->entries[archive->entry_count++];
+		entry->name = strdup(normalized);
+		entry->offset = offset;
+		entry->zsize = zsize;
+		entry->size = size;
+		entry->method = method;
+		free(name);
+	}
+
+	archive->zs_ready = (inflateInit2(&archive->zs, -MAX_WBITS) == Z_OK);
+	return archive->zs_ready;
+}
+
+/**
+ * @brief Decompress a zip entry
+ *
+ * @param archive archive
+ * @param entry zip entry
+ * @return entry contents followed by a NUL byte, or NULL
+ */
+static char *extract_zip_read(struct extract_archive *archive, struct extract_zip_entry *entry)
+{
+	char *data = malloc((uint64_t) entry->size + 2);
+	if (!data)
+		return NULL;
+
+	bool ok = false;
+	if (entry->method == EXTRACT_STORED)
+	{
+		ok = (entry->zsize == entry->size);
+		if (ok)
+			memcpy(data, archive->data + entry->offset, entry->size);
+	}
+	else
+	{
+		z_stream *zs = &archive->zs;
+		inflateReset(zs);
+		zs->next_in = archive->data + entry->offset;
+		zs->avail_in = entry->zsize;
+		zs->next_out = (uint8_t *) data;
+		zs->avail_out = entry->size;
+		ok = (inflate(zs, Z_FINISH) == Z_STREAM_END && zs->total_out == entry->size);
+	}
+
+	if (!ok)
+	{
+		free(data);
+		return NULL;
+	}
+	data[entry->size] = 0;
+	data[entry->size + 1] = 0;
+	return data;
+}
+
+/* Return true when a tar stream has no more input */
+static bool extract_eof(struct extract_stream *s)
+{
+	if (!s->gz)
+		return s->pos >= s->in_ln;
+	return s->ended && !s->zs.avail_in && s->pos >= s->in_ln;
+}
+
+/**
+ * @brief Read from a tar stream
+ *
+ * @param s tar stream
+ * @param out output buffer, or NULL to skip the data
+ * @param n bytes to be read
+ * @return false if the stream is truncated or corrupted
+ */
+static bool extract_read(struct extract_stream *s, uint8_t *out, uint64_t n)
+{
+	s->got = 0;
+	if (!s->gz)
+	{
+		uint64_t available = s->pos < s->in_ln ? s->in_ln - s->pos : 0;
+		s->got = n < available ? n : available;
+		if (out)
+			memcpy(out, s->in + s->pos, s->got);
+		s->pos += s->got;
+		return s->got == n;
+	}
+
+	while (n)
+	{
+		/* Feed input in chunks (avail_in is 32-bit) */
+		if (!s->zs.avail_in && s->pos < s->in_ln)
+		{
+			uint64_t chunk = s->in_ln - s->pos;
+			if (chunk > (1 << 30))
+				chunk = 1 << 30;
+			s->zs.next_in = s->in + s->pos;
+			s->zs.avail_in = chunk;
+			s->pos += chunk;
+		}
+
+		/* A finished gzip member may be followed by another one */
+		if (s->ended)
+		{
+			if (!s->zs.avail_in)
+				return false;
+			inflateReset(&s->zs);
+			s->ended = false;
+		}
+
+		uint64_t want = n;
+		if (!out && want > EXTRACT_DISCARD_LN)
+			want = EXTRACT_DISCARD_LN;
+		if (want > (1 << 30))
+			want = 1 << 30;
+
+		s->zs.next_out = out ? out : s->discard;
+		s->zs.avail_out = want;
+		int result = inflate(&s->zs, Z_NO_FLUSH);
+		uint64_t produced = want - s->zs.avail_out;
+
+		if (result == Z_STREAM_END)
+			s->ended = true;
+		else if (result != Z_OK && !(result == Z_BUF_ERROR && produced))
+			return false;
+		else if (!produced && !s->zs.avail_in && s->pos >= s->in_ln)
+			return false;
+
+		n -= produced;
+		s->got += produced;
+		if (out)
+			out += produced;
+	}
+	return true;
+}
+
+/* Parse an octal (or base-256) tar header number */
+static uint64_t extract_tar_number(uint8_t *p, int ln)
+{
+	uint64_t n = 0;
+	if (*p & 0x80)
+	{
+		n = *p & 0x3f;
+		for (int i = 1; i < ln; i++)
+			n = (n << 8) | p[i];
+		return n;
+	}
+
+	int i = 0;
+	while (i < ln && p[i] == ' ')
+		i++;
+	for (; i < ln && p[i] >= '0' && p[i] <= '7'; i++)
+		n = n * 8 + (p[i] - '0');
+	return n;
+}
+
+static bool extract_tar_checksum(uint8_t *h)
+{
+	uint64_t sum = 0;
+	for (int i = 0; i < EXTRACT_TAR_BLOCK; i++)
+		sum += (i >= 148 && i < 156) ? ' ' : h[i];
+	return sum == extract_tar_number(h + 148, 8);
+}
+
+/* Take the path, link target and size of the next entry from a pax extended header */
+static void extract_tar_pax(char *pax, uint64_t ln, char **long_name, char **long_link, uint64_t *size)
+{
+	uint64_t p = 0;
+	while (p < ln)
+	{
+		char *end = NULL;
+		uint64_t record_ln = strtoull(pax + p, &end, 10);
+		if (!record_ln || p + record_ln > ln || !end || *end != ' ')
+			break;
+
+		char *key = end + 1;
+		char *record_end = pax + p + record_ln - 1;
+		if (!strncmp(key, "path=", 5))
+		{
+			free(*long_name);
+			*long_name = strndup(key + 5, record_end - key - 5);
+		}
+		else if (!strncmp(key, "linkpath=", 9))
+		{
+			free(*long_link);
+			*long_link = strndup(key + 9, record_end - key - 9);
+		}
+		else if (!strncmp(key, "size=", 5))
+			*size = strtoull(key + 5, NULL, 10);
+		p += record_ln;
+	}
+}
+
+/**
+ * @brief Walk the entries of a tar stream. The handler may read the data of regular files,
+ * which are skipped otherwise. Hard links are passed with their (normalized) target and no data
+ *
+ * @param archive archive
+ * @param handler entry handler, returning true if it read the entry data
+ * @param ptr handler data
+ * @return false if the archive cannot be handled in memory
+ */
+static bool extract_tar_walk(struct extract_archive *archive, extract_tar_handler handler, void *ptr)
+{
+	struct extract_stream s;
+	memset(&s, 0, sizeof(s));
+	s.in = archive->data;
+	s.in_ln = archive->ln;
+	s.gz = (archive->format == EXTRACT_TAR_GZ);
+	if (s.gz)
+	{
+		if (inflateInit2(&s.zs, 16 + MAX_WBITS) != Z_OK)
+			return false;
+		s.discard = malloc(EXTRACT_DISCARD_LN);
+	}
+
+	uint8_t h[EXTRACT_TAR_BLOCK];
+	char *long_name = NULL;
+	char *long_link = NULL;
+	uint64_t pax_size = 0;
+	bool ok = true;
+
+	while (!extract_eof(&s))
+	{
+		if (!extract_read(&s, h, EXTRACT_TAR_BLOCK))
+		{
+			ok = false;
+			break;
+		}
+
+		/* End of archive */
+		bool zero = true;
+		for (int i = 0; i < EXTRACT_TAR_BLOCK && zero; i++)
+			zero = !h[i];
+		if (zero)
+			break;
+
+		if (!extract_tar_checksum(h))
+		{
+			ok = false;
+			break;
+		}
+
+		uint64_t size = extract_tar_number(h + 124, 12);
+		char type = h[156];
+
+		/* GNU long name, long link and pax headers apply to the next entry */
+		if (type == 'L' || type == 'K' || type == 'x')
+		{
+			uint64_t padded = (size + EXTRACT_TAR_BLOCK - 1) & ~(uint64_t) (EXTRACT_TAR_BLOCK - 1);
+			char *header = size <= EXTRACT_MAX_HEADER ? malloc(padded + 1) : NULL;
+			if (!header || !extract_read(&s, (uint8_t *) header, padded))
+			{
+				free(header);
+				ok = false;
+				break;
+			}
+			header[size] = 0;
+			if (type == 'L')
+			{
+				free(long_name);
+				long_name = strdup(header);
+			}
+			else if (type == 'K')
+			{
+				free(long_link);
+				long_link = strdup(header);
+			}
+			else
+				extract_tar_pax(header, size, &long_name, &long_link, &pax_size);
+			free(header);
+			continue;
+		}
+
+		/* Sparse files are left to tar */
+		if (type == 'S')
+		{
+			ok = false;
+			break;
+		}
+
+		if (pax_size)
+			size = pax_size;
+		uint64_t padded = (size + EXTRACT_TAR_BLOCK - 1) & ~(uint64_t) (EXTRACT_TAR_BLOCK - 1);
+
+		/* Assemble the entry name */
+		char name[MAX_PATH_LEN * 2] = "\0";
+		if (long_name)
+			snprintf(name, sizeof(name), "%s", long_name);
+		else if (!memcmp(h + 257, "ustar", 5) && h[345])
+			snprintf(name, sizeof(name), "%.155s/%.100s", (char *) h + 345, (char *) h);
+		else
+			snprintf(name, sizeof(name), "%.100s", (char *) h);
+
+		/* Hard link target */
+		char link[MAX_PATH_LEN * 2] = "\0";
+		if (type == '1')
+			snprintf(link, sizeof(link), "%s", long_link ? long_link : "");
+		if (type == '1' && !long_link)
+			snprintf(link, sizeof(link), "%.100s", (char *) h + 157);
+
+		free(long_name);
+		free(long_link);
+		long_name = NULL;
+		long_link = NULL;
+		pax_size = 0;
+
+		bool file = (type == '0' || type == '\0' || type == '7');
+		bool dir = (type == '5');
+		char *normalized = extract_normalize(name);
+		char *target = (type == '1') ? extract_normalize(link) : NULL;
+
+		/* Only regular files carry data to be extracted (symbolic links are not mined) */
+		uint64_t consumed = 0;
+		if (normalized && (file || dir || target))
+			if (handler(archive, &s, normalized, file ? size : 0, dir, target, ptr) && file)
+				consumed = size;
+
+		if (s.stop)
+			break;
+
+		if (s.error || !extract_read(&s, NULL, padded - consumed))
+		{
+			ok = false;
+			break;
+		}
+	}
+
+	free(long_name);
+	free(long_link);
+	if (s.gz)
+	{
+		inflateEnd(&s.zs);
+		free(s.discard);
+	}
+	return ok;
+}
+
+/* Opening handler: take the top directory from the first entry and stop */
+static bool extract_tar_first(struct extract_archive *archive, struct extract_stream *s, char *name, uint64_t size, bool dir, char *link, void *ptr)
+{
+	extract_check_prefix(archive, name);
+	s->stop = true;
+	return false;
+}
+
+/* The archive would be expanded into tmp_dir, its top directory (if any) is mined */
+static void extract_enter_prefix(struct minr_job *job, struct extract_archive *archive)
+{
+	if (*archive->prefix && strlen(job->tmp_dir) + strlen(archive->prefix) + 1 < sizeof(job->tmp_dir))
+	{
+		strcat(job->tmp_dir, "/");
+		strcat(job->tmp_dir, archive->prefix);
+	}
+}
+
+/**
+ * @brief Assemble the path an entry would be expanded to and tell whether it has to be read
+ *
+ * @param job pointer to minr job
+ * @param archive archive
+ * @param name entry name
+ * @param size entry size
+ * @param[out] path expanded path
+ * @param[out] license true for license files in the top directory (see mine_license_exec)
+ * @return true if the entry has to be decompressed
+ */
+static bool extract_wanted(struct minr_job *job, struct extract_archive *archive, char *name, uint64_t size, char *path, bool *license)
+{
+	int prefix_ln = strlen(archive->prefix);
+	if (prefix_ln && (strncmp(name, archive->prefix, prefix_ln) || name[prefix_ln] != '/'))
+		return false;
+
+	if (!valid_path(archive->root, name))
+		return false;
+
+	sprintf(path, "%s/%s", archive->root, name);
+	char *relative = path + strlen(job->tmp_dir) + 1;
+	*license = !strchr(relative, '/') && license_file_name(relative);
+
+	return *license || mine_wanted(job, path, size);
+}
+
+/* Mine a decompressed entry (data is freed) */
+static void extract_deliver(struct minr_job *job, struct extract_archive *archive, char *path, char *data, uint64_t size, bool license)
+{
+	archive->delivered++;
+	if (license)
+	{
+		if (load_buffer(job, data, size, true, NULL))
+			mine_license(job, job->versionid, true);
+		unload_file(job);
+	}
+
+	if (mine_wanted(job, path, size))
+		mine_submit(job, path, data, size);
+	else
+		free(data);
+}
+
+/**
+ * @brief Read the data of a tar entry into a new buffer followed by two NUL bytes. An entry
+ * cut short by the end of the stream is returned truncated, as tar leaves it, with s->error set
+ *
+ * @param s tar stream
+ * @param path expanded path (for the log)
+ * @param[in,out] size entry size, the size read if the entry is truncated
+ * @return entry data, or NULL
+ */
+static char *extract_tar_read(struct extract_stream *s, char *path, uint64_t *size)
+{
+	char *data = malloc(*size + 2);
+	if (!data)
+	{
+		minr_log("Not memory available to extract %s\n", path);
+		return NULL;
+	}
+
+	if (!extract_read(s, (uint8_t *) data, *size))
+	{
+		/* tar writes the whole blocks it could read */
+		s->error = true;
+		*size = s->got & ~(uint64_t) (EXTRACT_TAR_BLOCK - 1);
+		if (!*size)
+		{
+			free(data);
+			return NULL;
+		}
+	}
+	data[*size] = 0;
+	data[*size + 1] = 0;
+	return data;
+}
+
+/* Mining handler for tar entries */
+static bool extract_tar_mine(struct extract_archive *archive, struct extract_stream *s, char *name, uint64_t size, bool dir, char *link, void *ptr)
+{
+	struct minr_job *job = ptr;
+	char path[MAX_PATH_LEN] = "\0";
+	bool license = false;
+
+	/* The top directory can still be chosen while nothing has been mined */
+	if (!*archive->prefix && !archive->delivered)
+	{
+		extract_check_prefix(archive, name);
+		extract_enter_prefix(job, archive);
+	}
+
+	/* Hard links are mined in a second pass, once their target is known */
+	if (link)
+	{
+		archive->links = realloc(archive->links, (archive->link_count + 1) * sizeof(struct extract_tar_link));
+		archive->links[archive->link_count].name = strdup(name);
+		archive->links[archive->link_count].target = strdup(link);
+		archive->link_count++;
+		return false;
+	}
+
+	if (dir || !extract_wanted(job, archive, name, size, path, &license))
+		return false;
+
+	char *data = extract_tar_read(s, path, &size);
+	if (!data)
+		return s->error;
+
+	extract_deliver(job, archive, path, data, size, license);
+	return !s->error;
+}
+
+/* Hard link handler: mine the files linked to this entry under the link names */
+static bool extract_tar_links(struct extract_archive *archive, struct extract_stream *s, char *name, uint64_t size, bool dir, char *link, void *ptr)
+{
+	struct minr_job *job = ptr;
+	if (dir || link)
+		return false;
+
+	char *data = NULL;
+	bool read = false;
+	for (uint32_t i = 0; i < archive->link_count; i++)
+	{
+		char path[MAX_PATH_LEN] = "\0";
+		bool license = false;
+		struct extract_tar_link *l = &archive->links[i];
+		if (strcmp(l->target, name) || !extract_wanted(job, archive, l->name, size, path, &license))
+			continue;
+
+		if (!read)
+		{
+			read = true;
+			if (!(data = extract_tar_read(s, path, &size)))
+				return s->error;
+			if (s->error)
+				break;
+		}
+
+		char *copy = malloc(size + 2);
+		if (!copy)
+			continue;
+		memcpy(copy, data, size + 2);
+		extract_deliver(job, archive, path, copy, size, license);
+	}
+
+	free(data);
+	return read;
+}
+
+/**
+ * @brief Map an archive, calculating its MD5, and find its top directory (zip archives are
+ * listed, tar streams are read up to their first entry). Returns NULL if the archive
+ * cannot be mined in memory and has to be expanded with the external tools
+ *
+ * @param path archive path
+ * @return archive (see extract_close), or NULL
+ */
+struct extract_archive *extract_open(char *path)
+{
+	int format = extract_format(path);
+	if (format < 0)
+		return NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	struct extract_archive *archive = calloc(1, sizeof(struct extract_archive));
+	archive->format = format;
+	archive->path = strdup(path);
+	archive->data = data;
+	archive->ln = st.st_size;
+
+	/* The archive would be expanded next to it */
+	char tmp[MAX_PATH_LEN] = "\0";
+	strcpy(tmp, path);
+	strcpy(archive->root, dirname(tmp));
+	strcpy(tmp, path);
+	strcpy(archive->stem, basename(tmp));
+	char *ext = strrchr(archive->stem, '.');
+	if (ext)
+		*ext = 0;
+
+	MD5(data, archive->ln, archive->md5);
+
+	bool ok = (format == EXTRACT_ZIP) ? extract_zip_list(archive) : extract_tar_walk(archive, extract_tar_first, NULL);
+	if (!ok)
+	{
+		minr_log("Expanding %s with external tools\n", path);
+		extract_close(archive);
+		return NULL;
+	}
+
+	return archive;
+}
+
+/**
+ * @brief Mine the files of an archive, as download_expand and mine_tree would do
+ * (job->tmp_dir and job->urlid are set from the archive by the caller)
+ *
+ * @param job pointer to minr job
+ * @param archive archive
+ * @return false if a tar stream was found broken before any file was mined, in which case
+ * job->tmp_dir is restored and the archive has to be expanded with the external tools
+ */
+bool extract_mine(struct minr_job *job, struct extract_archive *archive)
+{
+	char tmp_dir[MAX_PATH_LEN] = "\0";
+	strcpy(tmp_dir, job->tmp_dir);
+	extract_enter_prefix(job, archive);
+
+	mine_pool_start(job);
+
+	bool ok = true;
+	if (archive->format == EXTRACT_ZIP)
+	{
+		for (uint32_t i = 0; i < archive->entry_count; i++)
+		{
+			struct extract_zip_entry *entry = &archive->entries[i];
+			char path[MAX_PATH_LEN] = "\0";
+			bool license = false;
+
+			if (!extract_wanted(job, archive, entry->name, entry->size, path, &license))
+				continue;
+
+			char *data = extract_zip_read(archive, entry);
+			if (!data)
+			{
+				minr_log("Cannot extract %s\n", path);
+				continue;
+			}
+			extract_deliver(job, archive, path, data, entry->size, license);
+		}
+	}
+	else if (!extract_tar_walk(archive, extract_tar_mine, job))
+	{
+		if (archive->delivered)
+			printf("Error extracting %s\n", archive->path);
+		else
+			ok = false;
+	}
+	else if (archive->link_count && !extract_tar_walk(archive, extract_tar_links, job))
+		printf("Error extracting links of %s\n", archive->path);
+
+	mine_pool_stop(job);
+
+	if (!ok)
+	{
+		minr_log("Expanding %s with external tools\n", archive->path);
+		strcpy(job->tmp_dir, tmp_dir);
+	}
+	return ok;
+}
+
+/**
+ * @brief Unmap an archive opened with extract_open
+ *
+ * @param archive archive
+ */
+void extract_close(struct extract_archive *archive)
+{
+	if (!archive)
+		return;
+
+	for (uint32_t i = 0; i < archive->entry_count; i++)
+		free(archive->entries[i].name);
+	free(archive->entries);
+	for (uint32_t i = 0; i < archive->link_count; i++)
+	{
+		free(archive->links[i].name);
+		free(archive->links[i].target);
+	}
+	free(archive->links);
+	free(archive->path);
+	if (archive->zs_ready)
+		inflateEnd(&archive->zs);
+	munmap(archive->data, archive->ln);
+	free(archive);
+}
@@ -36,11 +36,40 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <libgen.h>
 
 
 #include "minr.h"
 #include "file.h"
 #include "minr_log.h"
+#include "sink.h"
+/**
+ * @brief Verify if a stat'ed path is a file to be mined: a regular file, not hidden
+ * 
+ * @param path Path of the file.
+ * @param mode st_mode of the file.
+ * @return true the path is a file, false otherwise. 
+ */
+bool is_file_mode(char *path, mode_t mode)
+{
+	if (mode == 33024)
+	{
+		minr_log("Warning the file %s will be ignored - st_mode = 33024\n", path);
+		return false;
+	}
+	if (S_ISREG(mode)) 
+	{
+		/*discard hidden files */
+		char * file_name = strrchr(path, '/');
+		if (file_name && file_name[1] == '.')
+			return false;
+		return true;
+	}
+	return false;
+}
+
 /**
  * @brief Verify if a path is a file and exists.
  * 
@@ -52,21 +81,7 @@ bool is_file(char *path)
     struct stat pstat;
 	
     if (!stat(path, &pstat))
-	{
-		if (pstat.st_mode == 33024)
-		{
-			minr_log("Warning the file %s will be ignored - st_mode = 33024\n", path);
-			return false;
-		}
-		if (S_ISREG(pstat.st_mode)) 
-		{
-			/*discard hidden files */
-			char * file_name = strrchr(path, '/');
-			if (file_name && file_name[1] == '.')
-				return false;
-			return true;
-		}
-	}
+		return is_file_mode(path, pstat.st_mode);
     return false;
 
 }
@@ -129,6 +144,92 @@ bool valid_path(char *dir, char *file)
 
 
 
+/**
+ * @brief Walk a directory of walk_tree(), opened relative to its parent directory
+ * 
+ * @param parent descriptor of the parent directory
+ * @param name directory name
+ * @param path buffer holding the directory path
+ * @param ln directory path length
+ * @param found callback for the files found
+ * @param ptr argument for found
+ */
+static void walk_dir(int parent, char *name, char *path, int ln, void (*found)(void *ptr, char *path), void *ptr)
+{
+	int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	DIR *dp = fdopendir(fd);
+	if (!dp)
+	{
+		close(fd);
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dp)))
+	{
+		if (!not_a_dot(entry->d_name))
+			continue;
+
+		int name_ln = strlen(entry->d_name);
+		if (ln + 1 + name_ln >= MAX_PATH_LEN)
+			continue;
+		path[ln] = '/';
+		memcpy(path + ln + 1, entry->d_name, name_ln + 1);
+
+		/* Only entries of unknown type need a stat */
+		unsigned char type = entry->d_type;
+		struct stat st;
+		if (type == DT_UNKNOWN)
+		{
+			if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW))
+				continue;
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+		}
+
+		/* Links to directories are not followed */
+		if (type == DT_DIR)
+			walk_dir(fd, entry->d_name, path, ln + 1 + name_ln, found, ptr);
+
+		/* Hidden files are skipped (see is_file_mode) */
+		else if (*entry->d_name == '.')
+			continue;
+
+		else if (type == DT_REG)
+			found(ptr, path);
+
+		else if (type == DT_LNK && !fstatat(fd, entry->d_name, &st, 0) && S_ISREG(st.st_mode))
+			found(ptr, path);
+	}
+
+	path[ln] = '\0';
+	closedir(dp);
+}
+
+/**
+ * @brief Walk a directory tree calling found() for every regular file (or link to one), with
+ * a descriptor per directory level: directories are opened with openat() relative to their
+ * parent, and d_type saves the stat of each entry (fstatat is only needed for links and
+ * file systems that do not fill d_type). The path passed to found() is only valid during the
+ * call and must not be modified
+ * 
+ * @param root root directory
+ * @param found callback for the files found
+ * @param ptr argument for found
+ */
+void walk_tree(char *root, void (*found)(void *ptr, char *path), void *ptr)
+{
+	char path[MAX_PATH_LEN];
+	int ln = strlen(root);
+	if (ln >= MAX_PATH_LEN)
+		return;
+	memcpy(path, root, ln + 1);
+
+	walk_dir(AT_FDCWD, root, path, ln, found, ptr);
+}
+
 /**
  * @brief Returns true if "path" is not a single nor a double dot 
  * 
@@ -142,12 +243,12 @@ bool not_a_dot (char *path)
 }
 
 /**
- * @brief Open 256 "file" descriptors
+ * @brief Open 256 "file" sinks
  * 
  * @param mined_path 
- * @return FILE** 
+ * @return struct sink** 
  */
-FILE **open_file (char *mined_path, char * set_name)
+struct sink **open_file (char *mined_path, char * set_name)
 {
 	char *path = calloc(MAX_PATH_LEN, 1);
 
@@ -160,11 +261,11 @@ FILE **open_file (char *mined_path, char * set_name)
 	}
 
 	/* Open all 256 files (append, text) */
-	FILE **out = calloc(sizeof(FILE*) * 256, 1);
+	struct sink **out = calloc(sizeof(struct sink *) * 256, 1);
 	for (int i=0; i < 256; i++)
 	{
 		sprintf(path, "%s/%s/%02x.csv", mined_path, set_name, i);
-		out[i] = fopen(path, "a");
+		out[i] = sink_open(path);
 		if (out[i] == NULL)
 		{
 			printf("Cannot open file %s\n", path);
@@ -276,7 +377,6 @@ int remove_callback(const char *fpath, const struct stat *sb, int typeflag, stru
         perror("Error removing file or directory");
     }
 
-    close(ftwbuf->base);
     return rv;
 }
 
@@ -291,3 +391,120 @@ void rm_dir(char *path) {
         perror("Error removing a directory");
     }
 }
+
+/**
+ * @brief Flush to disk every regular file in a directory, and the directory itself
+ * 
+ * @param path directory path
+ * @return true if everything was synced
+ */
+bool sync_dir(char *path)
+{
+	DIR *dp = opendir(path);
+	if (!dp)
+		return false;
+
+	bool synced = true;
+	struct dirent *entry;
+	while ((entry = readdir(dp)))
+	{
+		if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+			continue;
+
+		int fd = openat(dirfd(dp), entry->d_name, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (fsync(fd))
+			synced = false;
+		close(fd);
+	}
+
+	if (fsync(dirfd(dp)))
+		synced = false;
+	closedir(dp);
+	return synced;
+}
+
+/**
+ * @brief Write a file and flush it to disk, checking every step. On errors the file is removed
+ * 
+ * @param path file path
+ * @param data contents
+ * @param ln data size
+ * @return true if the whole file was written and synced
+ */
+bool file_write_synced(char *path, uint8_t *data, uint64_t ln)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return false;
+
+	uint64_t done = 0;
+	while (done < ln)
+	{
+		ssize_t written = write(fd, data + done, ln - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			break;
+		done += written;
+	}
+
+	bool ok = (done == ln) && !fsync(fd);
+	if (close(fd))
+		ok = false;
+
+	if (!ok)
+		unlink(path);
+	return ok;
+}
+
+/**
+ * @brief Flush a directory entry (a rename or a new file) to disk. Unlike sync_dir(),
+ * the files of the directory are not synced
+ * 
+ * @param path path of a file in the directory
+ */
+void sync_parent(char *path)
+{
+	char dir[MAX_PATH_LEN + 32] = "\0";
+	snprintf(dir, sizeof(dir), "%s", path);
+	int fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+	{
+		fsync(fd);
+		close(fd);
+	}
+}
+
+/**
+ * @brief Replace a file with new contents. The data is written and flushed to path.tmp,
+ * which is renamed over path only once complete. On any error the temporary file is
+ * removed and path is left untouched
+ * 
+ * @param path file path
+ * @param data new contents
+ * @param ln data size
+ * @return true if path was replaced
+ */
+bool file_replace(char *path, uint8_t *data, uint64_t ln)
+{
+	char tmp[MAX_PATH_LEN + 32] = "\0";
+	if (strlen(path) + 5 > sizeof(tmp))
+		return false;
+	sprintf(tmp, "%s.tmp", path);
+
+	if (!file_write_synced(tmp, data, ln))
+		return false;
+
+	if (rename(tmp, path))
+	{
+		unlink(tmp);
+		return false;
+	}
+
+	/* Only the directory entry is synced, sync_dir() would flush every
+	   archive of a sources/ table each time one is replaced */
+	sync_parent(path);
+	return true;
+}
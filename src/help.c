@@ -47,9 +47,14 @@ void show_help ()
 	printf("\n");
 	printf("-d METADATA  Comma separated list of vendor,component,version,release_date,license,purl\n");
 	printf("-u URL       Url to be mined (it also accepts a local folder)\n");
-	printf("-U URL       Optional URL to be recorded instead of the mined one (-u)\n");
+	printf("-U URL       Optional URL to be recorded instead of the mined one (-u). Not valid with --batch\n");
 	printf("-S For SCANCODE license mining\n");
 	printf("-A For extra-tables mode (mine everything). The ignored files will be mined inside the mined/extra directory\n");
+	printf("--batch FILE  Mine all the components listed in FILE in a single run. Each line holds\n\
+	     vendor,component,version,release_date,license,purl,url (url may be a local folder)\n");
+	printf("--pipeline F,E,M  With --batch, download, expand and mine components concurrently with\n\
+	     F fetchers, E extractors and M miners. Fetchers wait while the tmp directory (-T) is\n\
+	     less than 25%% free\n");
 	printf("\n");
 
 	printf("Mining configuration:\n");
@@ -57,6 +62,12 @@ void show_help ()
 	printf("-a     Process all files, regardless of their extensions (default: off)\n");
 	printf("-x     Exclude .mz generation (do not keep a copy of the original source code)\n");
 	printf("-X     Exclude metadata detection (license, copyright, quality, etc)\n");
+	printf("-j N   Mine the files of the component with N worker threads (default: 1).\n\
+	     Lines within each mined/ sector are not kept in traversal order\n");
+	printf("--mz-codec zlib|zstd  Codec used to compress files into .mz archives (default: zlib).\n\
+	     zstd requires building with ZSTD=1\n");
+	printf("--mz-dict FILE  Load a zstd dictionary (see mz --train-dict), used to compress new .mz\n\
+	     records and to read records compressed with it (i.e. with -z). Can be repeated\n");
 	printf("\n");
 
 	printf("Mining snippet WFP: Minr extracts snippet fingerprint from all code in a .mz arhive (mined/sources/)\n");
@@ -72,8 +83,12 @@ void show_help ()
 
 	printf("All these formats can be aggregated by concatenation. Minr provides a mined/ joining function:\n");
 	printf("\n");
-	printf("-f DIR Merge source DIR\n");
+	printf("-f DIR Merge source DIR. Several sources can be given as a comma separated list (-f dir1,dir2,...)\n");
 	printf("-t DIR into destination DIR (and erase source DIR)\n");
+	printf("-M, --merge  Merge sorted .csv and .bin sectors removing duplicates, instead of concatenating.\n\
+	     Unsorted sectors are sorted first. Results are ready for importing with -s\n");
+	printf("-E, --mz-dedup  Remove duplicated files from joined .mz archives (reads record headers only)\n");
+	printf("-j N   Join sectors using N worker threads (default: 1). Also used by -i for .mz tables\n");
 	printf("\n");
 	printf("Example minr -f dir1/mined -t dir2/mined\n");
 	printf("\n");
@@ -89,6 +104,8 @@ void show_help ()
 	printf("-D        Set the OSS DB name (default: oss)\n");
 	printf("-I TABLE  Restrict importation to a specific table\n");
 	printf("-O        Overwrite destination data rather than appending (MAY LEAD TO DATA LOSS)\n");
+	printf("-N        Shadow import: build each table into TABLE.new and swap it in when complete.\n\
+	  Scanners keep reading the previous data meanwhile, which is kept in TABLE.old for rollback\n");
 	printf("\n\n");
 	printf("Local mining:\n\n");
 	printf("-L TARGET  Analyse file/directory (and sub directories) to detect license license declarations \n");
@@ -29,6 +29,7 @@
 #include <sys/time.h>
 #include <libgen.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #include "minr.h"
 #include "import.h"
@@ -39,6 +40,7 @@
 #include "hex.h"
 #include "ignorelist.h"
 #include "minr_log.h"
+#include "mz_pack.h"
 
 
 int (*decode) (int op, unsigned char *key, unsigned char *nonce,
@@ -128,16 +130,17 @@ void progress(char *prompt, size_t count, size_t max, bool percent)
  * the first byte is the file name
  *
  * @param db_name DB name
+ * @param table destination table name (wfp, or its shadow copy)
  * @param filename filename string
  * @param skip_delete true to avoid delete
  * @return true is succed
  */
-bool ldb_import_snippets(char *db_name, char *filename, bool skip_delete)
+bool ldb_import_snippets(char *db_name, char *table, char *filename, bool skip_delete)
 {
 	/* Table definition */
 	struct ldb_table oss_wfp;
 	strcpy(oss_wfp.db, db_name);
-	strcpy(oss_wfp.table, "wfp");
+	strcpy(oss_wfp.table, table);
 	oss_wfp.key_ln = 4;
 	oss_wfp.rec_ln = 18;
 	oss_wfp.ts_ln = 2;
@@ -202,8 +205,8 @@ bool ldb_import_snippets(char *db_name, char *filename, bool skip_delete)
 	uint8_t *buffer = malloc(buffer_ln);
 
 	/* Create table if it doesn't exist */
-	if (!ldb_table_exists(db_name, "wfp"))
-		ldb_create_table(db_name, "wfp", 4, rec_ln);
+	if (!ldb_table_exists(db_name, table))
+		ldb_create_table(db_name, table, 4, rec_ln);
 
 	/* Open ldb */
 	out = ldb_open(oss_wfp, last_wfp, "r+");
@@ -795,7 +798,8 @@ bool this_table(char *table, struct minr_job *job)
  */
 void wipe_table(char *table, struct minr_job *job)
 {
-	if (!job->import_overwrite)
+	/* Shadow imports never touch the live table */
+	if (!job->import_overwrite || job->import_shadow)
 		return;
 
 	bool is_mz = false;
@@ -819,7 +823,223 @@ void wipe_table(char *table, struct minr_job *job)
 				sprintf(path, "%s/%s/%s/%02x.ldb", LDB_ROOT, job->dbname, table, i);
 			unlink(path);
 		}
+		if (is_mz)
+		{
+			sprintf(path, "%s/%s/%s", LDB_ROOT, job->dbname, table);
+			mz_pack_remove(path);
+		}
+	}
+}
+
+/**
+ * @brief Get the name of the table receiving the imported data.
+ * Shadow imports (-N) write into <table>.new, which is swapped in when done.
+ *
+ * @param job pointer to minr job
+ * @param table table name
+ * @param[out] target destination table name
+ */
+static void import_target(struct minr_job *job, char *table, char *target)
+{
+	if (job->import_shadow)
+		sprintf(target, "%s.new", table);
+	else
+		strcpy(target, table);
+}
+
+/**
+ * @brief Create the shadow copy <table>.new of a table. Unless overwrite is requested (-O),
+ * the shadow is seeded with the live data so the import appends to it as usual.
+ * A table that does not exist yet is created first under its live name, so its
+ * configuration is written as a normal import would (the empty directory is removed
+ * and the shadow is later renamed into place)
+ *
+ * @param table table name
+ * @param job pointer to minr job
+ * @param key_ln table key length (0 for mz tables, which have no LDB configuration)
+ * @param rec_ln table record length
+ */
+static void shadow_table_prepare(char *table, struct minr_job *job, int key_ln, int rec_ln)
+{
+	char live[2 * MAX_PATH_LEN] = "\0";
+	char shadow[2 * MAX_PATH_LEN + 8] = "\0";
+	sprintf(live, "%s/%s/%s", LDB_ROOT, job->dbname, table);
+	sprintf(shadow, "%s.new", live);
+
+	if (key_ln && !ldb_table_exists(job->dbname, table))
+	{
+		if (!ldb_database_exists(job->dbname))
+			ldb_create_database(job->dbname);
+		ldb_create_table(job->dbname, table, key_ln, rec_ln);
+		rmdir(live);
+	}
+
+	/* Remove leftovers from an interrupted import */
+	if (is_dir(shadow))
+		rm_dir(shadow);
+
+	create_dir(shadow);
+	if (!is_dir(shadow))
+	{
+		printf("Cannot create directory %s\n", shadow);
+		exit(EXIT_FAILURE);
+	}
+
+	if (job->import_overwrite || !is_dir(live))
+		return;
+
+	printf("Copying %s into %s\n", live, shadow);
+	DIR *dp = opendir(live);
+	if (!dp)
+	{
+		printf("Cannot open directory %s\n", live);
+		exit(EXIT_FAILURE);
+	}
+
+	struct dirent *entry;
+	char src[3 * MAX_PATH_LEN] = "\0";
+	char dst[3 * MAX_PATH_LEN] = "\0";
+	while ((entry = readdir(dp)))
+	{
+		sprintf(src, "%s/%s", live, entry->d_name);
+		if (!is_file(src))
+			continue;
+		sprintf(dst, "%s/%s", shadow, entry->d_name);
+		move_file(src, dst, true);
+	}
+	closedir(dp);
+}
+
+/**
+ * @brief Swap a completed shadow table <table>.new into place. The previous
+ * data is kept as <table>.old (replacing any older one) for rollback.
+ *
+ * @param table table name
+ * @param job pointer to minr job
+ */
+static void shadow_table_commit(char *table, struct minr_job *job)
+{
+	char db[sizeof(LDB_ROOT) + MAX_PATH_LEN] = "\0";
+	char live[sizeof(db) + MAX_PATH_LEN] = "\0";
+	char shadow[sizeof(live) + 4] = "\0";
+	char old[sizeof(live) + 4] = "\0";
+	sprintf(db, "%s/%s", LDB_ROOT, job->dbname);
+	sprintf(live, "%s/%s", db, table);
+	sprintf(shadow, "%s.new", live);
+	sprintf(old, "%s.old", live);
+
+	/* The configuration is kept by the live name, a shadow one would be left behind */
+	char shadow_cfg[sizeof(shadow) + 4] = "\0";
+	sprintf(shadow_cfg, "%s.cfg", shadow);
+	unlink(shadow_cfg);
+
+	/* Make sure the new data is on disk before it becomes visible */
+	if (!sync_dir(shadow))
+	{
+		printf("Cannot sync %s\n", shadow);
+		exit(EXIT_FAILURE);
+	}
+
+	if (is_dir(old))
+		rm_dir(old);
+
+	if (!is_dir(live))
+	{
+		if (rename(shadow, live))
+		{
+			printf("Cannot rename %s to %s\n", shadow, live);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Atomic exchange: readers see either the old or the new table, never a missing one */
+	else if (!renameat2(AT_FDCWD, shadow, AT_FDCWD, live, RENAME_EXCHANGE))
+	{
+		/* The previous data is now at <table>.new, which would be taken for a stale shadow */
+		if (rename(shadow, old))
+		{
+			printf("Cannot rename %s to %s\n", shadow, old);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Filesystems without RENAME_EXCHANGE leave a brief window without the table */
+	else if (rename(live, old) || rename(shadow, live))
+	{
+		printf("Cannot swap %s into %s\n", shadow, live);
+		exit(EXIT_FAILURE);
+	}
+
+	sync_dir(db);
+	if (is_dir(old))
+		printf("Table %s swapped in, previous data kept in %s\n", live, old);
+	else
+		printf("Table %s created\n", live);
+}
+
+/**
+ * @brief Prepare a table for importation: wipe it (-O) or create its shadow copy (-N)
+ *
+ * @param job pointer to minr job
+ * @param table table name
+ * @param has_input true if the mined directory has data for this table
+ * @param key_ln table key length, used to create it (0 for mz tables)
+ * @param rec_ln table record length
+ * @return false if there is nothing to import into the table
+ */
+static bool import_table_begin(struct minr_job *job, char *table, bool has_input, int key_ln, int rec_ln)
+{
+	if (!job->import_shadow)
+	{
+		/* Wipe existing data if overwrite is requested */
+		wipe_table(table, job);
+		return has_input;
 	}
+
+	/* Tables without data in the mined directory are left untouched */
+	if (!has_input)
+		return false;
+
+	shadow_table_prepare(table, job, key_ln, rec_ln);
+	return true;
+}
+
+/**
+ * @brief Finish a table importation, swapping in the shadow table in shadow mode (-N)
+ *
+ * @param job pointer to minr job
+ * @param table table name
+ */
+static void import_table_end(struct minr_job *job, char *table)
+{
+	if (job->import_shadow)
+		shadow_table_commit(table, job);
+}
+
+/**
+ * @brief Import an mz table (sources or notices)
+ *
+ * @param job pointer to minr job
+ * @param table table name
+ */
+static void import_mz(struct minr_job *job, char *table)
+{
+	if (!this_table(table, job))
+		return;
+
+	char src[2 * MAX_PATH_LEN] = "\0";
+	sprintf(src, "%s/%s", job->import_path, table);
+
+	if (!import_table_begin(job, table, is_dir(src), 0, 0))
+		return;
+
+	char target[MAX_PATH_LEN] = "\0";
+	char dst[sizeof(LDB_ROOT) + 2 * MAX_PATH_LEN] = "\0";
+	import_target(job, table, target);
+	sprintf(dst, "%s/%s/%s", LDB_ROOT, job->dbname, target);
+
+	minr_join_mz_dir(src, dst, job->skip_delete, job->threads);
+	import_table_end(job, table);
 }
 
 /**
@@ -831,12 +1051,16 @@ void import_multiple_files(struct minr_job *job, char * table, bool secondary_ke
 {
 	if (!this_table(table, job))
 		return;
-	/* Wipe existing data if overwrite is requested */
-	wipe_table(table, job);
 
 	char path[2 * MAX_PATH_LEN] = "\0";
 	sprintf(path, "%s/%s", job->import_path, table);
 
+	if (!import_table_begin(job, table, is_dir(path), 16, 0))
+		return;
+
+	char target[MAX_PATH_LEN] = "\0";
+	import_target(job, table, target);
+
 	if (is_dir(path))
 	{
 		for (int i = 0; i < 256; i++)
@@ -847,24 +1071,30 @@ void import_multiple_files(struct minr_job *job, char * table, bool secondary_ke
 			if (csv_sort(path, job->skip_sort))
 			{
 				/* 3 fields expected (file id, url id, URL) */
-				ldb_import_csv(job, path, table, true, fields);
+				ldb_import_csv(job, path, target, true, fields);
 			}
 		}
 		sprintf(path, "%s/%s", job->import_path, table);
 		if (!job->skip_delete)
 			rmdir(path);
 	}
+	import_table_end(job, table);
 }
 
 /* Import snippets */
 void import_snippets(struct minr_job *job)
 {
-	/* Wipe existing data if overwrite is requested */
-	wipe_table("wfp", job);
-
 	char path[2 * MAX_PATH_LEN] = "\0";
 	sprintf(path, "%s/%s", job->import_path, TABLE_NAME_WFP);
-	if (is_dir(path))
+
+	bool has_input = is_dir(path);
+	if (!import_table_begin(job, "wfp", has_input, 4, 18))
+		return;
+
+	char target[MAX_PATH_LEN] = "\0";
+	import_target(job, "wfp", target);
+
+	if (has_input)
 	{
 		printf("WFP IDs in ignorelist: %lu\n", IGNORED_WFP_LN / 4);
 		for (int i = 0; i < 256; i++)
@@ -872,13 +1102,14 @@ void import_snippets(struct minr_job *job)
 			sprintf(path, "%s/%s/%02x.bin", job->import_path, TABLE_NAME_WFP, i);
 			if (bin_sort(path, job->skip_sort))
 			{
-				ldb_import_snippets(job->dbname, path, job->skip_delete);
+				ldb_import_snippets(job->dbname, target, path, job->skip_delete);
 			}
 		}
 	}
 	sprintf(path, "%s/%s", job->import_path, TABLE_NAME_WFP);
 	if (!job->skip_delete)
 		rmdir(path);
+	import_table_end(job, "wfp");
 }
 
 
@@ -895,22 +1126,23 @@ void single_file_import(struct minr_job *job, char *filename, char *tablename, i
 	if (!this_table(tablename, job))
 		return;
 
-	/* Wipe existing data if overwrite is requested */
-	wipe_table(tablename, job);
-
-	printf("Importing %s\n", filename);
-
 	char path[2 * MAX_PATH_LEN] = "\0";
 	sprintf(path, "%s/%s", job->import_path, filename);
 	check_file_extension(path, job->bin_import);
 
-	if (is_file(path))
+	if (!import_table_begin(job, tablename, is_file(path), 16, 0))
+		return;
+
+	printf("Importing %s\n", filename);
+
+	char target[MAX_PATH_LEN] = "\0";
+	import_target(job, tablename, target);
+
+	if (csv_sort(path, job->skip_sort))
 	{
-		if (csv_sort(path, job->skip_sort))
-		{
-			ldb_import_csv(job, path, tablename,false, nfields);
-		}
+		ldb_import_csv(job, path, target, false, nfields);
 	}
+	import_table_end(job, tablename);
 }
 
 static char * version_get_daily(char * json)
@@ -1077,23 +1309,9 @@ void mined_import(struct minr_job *job)
 		exit(EXIT_FAILURE);
 	}
 
-	char db_path[MAX_PATH_LEN * 2];
-	sprintf(db_path, "%s/%s", LDB_ROOT, job->dbname);
-
 	/* Import MZ archives */
-	if (this_table("sources", job))
-	{
-		/* Wipe existing data if overwrite is requested */
-		wipe_table("sources", job);
-		minr_join_mz("sources", job->import_path, db_path, job->skip_delete, job->bin_import);
-	}
-
-	if (this_table("notices", job))
-	{
-		/* Wipe existing data if overwrite is requested */
-		wipe_table("notices", job);
-		minr_join_mz("notices", job->import_path, db_path, job->skip_delete, job->bin_import);
-	}
+	import_mz(job, "sources");
+	import_mz(job, "notices");
 
 	/* Attribution ts 2 fields: id, notice ID */
 	single_file_import(job, TABLE_NAME_ATTRIBUTION".csv", "attribution", 2);
@@ -9,11 +9,48 @@
 
 #include <unistd.h>
 #include <libgen.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include "minr_log.h"
 #include "minr.h"
 #include "file.h"
+#include <ldb.h>
 #include <dirent.h>
+#include <pthread.h>
+#include "bsort.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_pack.h"
+
+/* Block size used to look for the last LF of a CSV file */
+#define TRUNCATE_BLOCK_LN (64 * 1024)
+
+/* Buffer size for copies that cannot be done in the kernel */
+#define COPY_BUFFER_LN (1024 * 1024)
+
+/* Snippet records are wfp(4) + md5(16) + line(1) */
+#define WFP_REC_LN 21
+
+/* Types of sector files found in a mined/ directory */
+enum join_kind {JOIN_CSV, JOIN_WFP, JOIN_MZ};
+
+/* A table directory being joined from several sources */
+struct join_table
+{
+	char **src_dirs;
+	int src_count;
+	char *dst_dir;
+	enum join_kind kind;
+	bool skip_delete;
+	bool merge;
+	bool mz_dedup; // remove duplicated records from joined mz archives
+	char **names; // sector file names found in any source
+	int name_count;
+	int next; // next sector to be joined
+	pthread_mutex_t lock;
+};
 
 /**
  * @brief  If the CSV file does not end with LF, eliminate the last line
@@ -22,50 +59,58 @@
  */
 void truncate_csv(char *path)
 {
-
-	FILE *file = fopen(path, "r");
-	if (!file)
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
 	{
 		printf("Cannot open source file %s\n", path);
 		exit(EXIT_FAILURE);
 	}
 
 	/* Obtain file size */
-	fseeko64(file, 0, SEEK_END);
-	uint64_t size = ftello64(file);
+	struct stat st;
+	fstat(fd, &st);
+	uint64_t size = st.st_size;
 
 	/* Empty file, it is ok */
 	if (!size)
 	{
-		fclose(file);
+		close(fd);
 		return;
 	}
 
 	/* Read last byte */	
 	uint8_t last_byte[1] = "\0";
-	fseeko64(file, size - 1, SEEK_SET);
-	fread(last_byte, 1, 1, file);
+	pread(fd, last_byte, 1, size - 1);
 
 	/* Ends with chr(10), it is ok */
 	if (*last_byte == 10)
 	{
-		fclose(file);
+		close(fd);
 		return;
 	}
 
 	printf("Truncated %s\n", path);
 
-	int i = 0;
-	for (i = size - 1; i > 0; i--)
+	/* Look for the last LF, reading backwards one block at a time */
+	uint8_t *block = malloc(TRUNCATE_BLOCK_LN);
+	uint64_t end = size - 1;
+	uint64_t lf = 0;
+	while (end > 0 && !lf)
 	{
-
-		fseeko64(file, i, SEEK_SET);
-		fread(last_byte, 1, 1, file);
-		if (*last_byte == 10) break;
+		uint64_t start = end > TRUNCATE_BLOCK_LN ? end - TRUNCATE_BLOCK_LN : 0;
+		ssize_t ln = pread(fd, block, end - start, start);
+		if (ln <= 0)
+			break;
+
+		uint8_t *found = memrchr(block, 10, ln);
+		if (found)
+			lf = start + (found - block);
+		end = start;
 	}
 
-	fclose(file);
-	if (i > 0) truncate(path, i + 1);
+	free(block);
+	close(fd);
+	if (lf > 0) truncate(path, lf + 1);
 	return;
 }
 
@@ -95,53 +140,132 @@ void mkdir_if_not_exist(char *destination)
 }
 
 /**
- * @brief Move a file to a new location by copying byte by byte.
- * If the file already exist it is overwritten.
+ * @brief Copy the remaining contents of a file descriptor into another.
+ * Uses copy_file_range() (in-kernel, reflinks where supported), then sendfile(),
+ * and finally a large read/write buffer when neither is available.
+ * 
+ * @param in source file descriptor
+ * @param out destination file descriptor, positioned where data must be written
+ * @param size number of bytes to copy
+ * @return true on success
+ */
+static bool fd_copy(int in, int out, uint64_t size)
+{
+	uint64_t left = size;
+
+	while (left)
+	{
+		ssize_t ln = copy_file_range(in, NULL, out, NULL, left, 0);
+		if (ln <= 0)
+			break;
+		left -= ln;
+	}
+
+	while (left)
+	{
+		ssize_t ln = sendfile(out, in, NULL, left);
+		if (ln <= 0)
+			break;
+		left -= ln;
+	}
+
+	if (!left)
+		return true;
+
+	uint8_t *buffer = malloc(COPY_BUFFER_LN);
+	while (left)
+	{
+		ssize_t ln = read(in, buffer, left < COPY_BUFFER_LN ? left : COPY_BUFFER_LN);
+		if (ln <= 0)
+			break;
+
+		ssize_t written = 0;
+		while (written < ln)
+		{
+			ssize_t w = write(out, buffer + written, ln - written);
+			if (w <= 0)
+			{
+				free(buffer);
+				return false;
+			}
+			written += w;
+		}
+		left -= ln;
+	}
+	free(buffer);
+
+	return !left;
+}
+
+/**
+ * @brief Move a file to a new location, or append it to an existing one.
+ * A move whose source is deleted is a rename() when both files are on the same
+ * filesystem. Otherwise data is copied in the kernel (see fd_copy).
  * 
  * @param src src path
  * @param dst dst path 
+ * @param append true to append to dst, false to overwrite it
+ * @param mkdir true to create the destination directory if needed
  * @param skip_delete if true the src file is not deleted after the copy is done.
  * @return true success. False otherwise.
  */
-static bool write_file(char *src, char *dst, char * mode, bool mkdir, bool skip_delete) {
+static bool write_file(char *src, char *dst, bool append, bool mkdir, bool skip_delete) {
 		
 	if (mkdir)
 	{
 		mkdir_if_not_exist(dst);
 	}
+
+	/* Same filesystem: no data needs to be moved */
+	if (!append && !skip_delete)
+	{
+		if (!rename(src, dst))
+			return true;
+		if (errno != EXDEV)
+		{
+			printf("Cannot move %s into %s\n", src, dst);
+			exit(EXIT_FAILURE);
+		}
+	}
 		
-	FILE *srcf = fopen(src, "rb");
-	if (!srcf)
+	int srcf = open(src, O_RDONLY);
+	if (srcf < 0)
 	{	
 		printf("Cannot open source file %s\n", src);
 		exit(EXIT_FAILURE);
 	}
 
-	FILE *dstf = fopen(dst, mode);
-	if (!dstf)
+	/* copy_file_range() does not accept O_APPEND, so seek to the end instead */
+	int dstf = open(dst, O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0666);
+	if (dstf < 0)
 	{	
 		printf("Cannot open destinstion file %s\n", dst);
 		exit(EXIT_FAILURE);
 	}
+	if (append)
+		lseek(dstf, 0, SEEK_END);
 
-	/* Copy byte by byte */
-	int byte = 0;
-	while (!feof(srcf))
+	struct stat st;
+	fstat(srcf, &st);
+	bool copied = fd_copy(srcf, dstf, st.st_size);
+
+	close(srcf);
+	if (close(dstf))
+		copied = false;
+
+	if (!copied)
 	{
-		byte = fgetc(srcf);
-		if (feof(srcf)) break;
-		fputc(byte, dstf);
+		printf("Cannot write %s into %s\n", src, dst);
+		exit(EXIT_FAILURE);
 	}
 
-	fclose(srcf);
-	fclose(dstf);
 	if (!skip_delete) unlink(src);
 	return true;
 }
 
 bool move_file(char *src, char *dst, bool skip_delete)
 {
-	return write_file(src,dst, "wb", true, skip_delete);
+	return write_file(src, dst, false, true, skip_delete);
 }
 /**
  * @brief Append the contents of a file to the end of another file.
@@ -152,95 +276,429 @@ bool move_file(char *src, char *dst, bool skip_delete)
 
 bool file_append(char *file, char *destination)
 {
-	return write_file(file,destination, "ab", false, true);
+	return write_file(file, destination, true, false, true);
 }
 
 /**
- * @brief join two binary files
+ * @brief Compare two CSV lines (without LF) byte by byte, as LC_ALL=C sort does
  * 
- * @param source path to the source file
- * @param destination path to destination file
+ * @return <0, 0 or >0 as memcmp
+ */
+static int line_cmp(char *a, ssize_t a_ln, char *b, ssize_t b_ln)
+{
+	int cmp = memcmp(a, b, a_ln < b_ln ? a_ln : b_ln);
+	if (cmp)
+		return cmp;
+	return (a_ln > b_ln) - (a_ln < b_ln);
+}
+
+/**
+ * @brief Read the next CSV line, removing the trailing LF
+ * 
+ * @return line length, or -1 at the end of the file
+ */
+static ssize_t next_line(FILE *fp, char **line, size_t *size)
+{
+	ssize_t ln = getline(line, size, fp);
+	if (ln > 0 && (*line)[ln - 1] == '\n')
+		(*line)[--ln] = 0;
+	return ln;
+}
+
+/**
+ * @brief Check if a CSV file is sorted (LC_ALL=C) and free of duplicated lines
+ * 
+ * @param path file path
+ * @return true if sorted and unique
+ */
+static bool csv_is_sorted(char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return false;
+
+	char *line = NULL, *last = NULL;
+	size_t size = 0, last_size = 0;
+	ssize_t ln, last_ln = -1;
+	bool sorted = true;
+
+	while ((ln = next_line(fp, &line, &size)) != -1)
+	{
+		if (last_ln >= 0 && line_cmp(last, last_ln, line, ln) >= 0)
+		{
+			sorted = false;
+			break;
+		}
+
+		/* Keep the line just read as "last" and reuse the old buffer */
+		char *tmp = last; last = line; line = tmp;
+		size_t tmp_size = last_size; last_size = size; size = tmp_size;
+		last_ln = ln;
+	}
+
+	free(line);
+	free(last);
+	fclose(fp);
+	return sorted;
+}
+
+/**
+ * @brief Check if a snippet file is sorted and free of duplicated records
+ * 
+ * @param path file path
+ * @return true if sorted and unique
+ */
+static bool bin_is_sorted(char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	uint8_t rec[WFP_REC_LN], last[WFP_REC_LN];
+	bool first = true;
+	bool sorted = true;
+
+	while (fread(rec, WFP_REC_LN, 1, fp) == 1)
+	{
+		if (!first && memcmp(last, rec, WFP_REC_LN) >= 0)
+		{
+			sorted = false;
+			break;
+		}
+		memcpy(last, rec, WFP_REC_LN);
+		first = false;
+	}
+
+	fclose(fp);
+	return sorted;
+}
+
+/**
+ * @brief Sort a join sector if it is not sorted already. CSV files are sorted with
+ * LC_ALL=C sort -u, snippet files with bsort (duplicates are dropped by the merge)
+ * 
+ * @param path file path
  * @param snippets true if it is a snippet file
- * @param skip_delete true to avoid deletion
  */
-void bin_join(char *source, char *destination, bool snippets, bool skip_delete)
+static void join_sort(char *path, bool snippets)
 {
-	/* If source does not exist, no need to join */
-	if (!is_file(source)) 
+	if (snippets)
 	{
-		minr_log("Error: File %s does not exist\n", source);
+		if (!bin_is_sorted(path))
+			bsort(path);
 		return;
 	}
 
-	if (is_file(destination))
+	if (csv_is_sorted(path))
+		return;
+
+	char *command = malloc(MAX_ARG_LEN + 3 * MAX_PATH_LEN);
+	sprintf(command, "LC_ALL=C sort -T %s -u -o %s %s", tmp_path, path, path);
+	if (system(command))
 	{
-		/* Snippet records should divide by 21 */
-		if (snippets) if (file_size(destination) % 21)
+		printf("Cannot execute %s\n", command);
+		exit(EXIT_FAILURE);
+	}
+	free(command);
+}
+
+/**
+ * @brief Merge sorted CSV files into out, dropping duplicated lines.
+ * Every input is expected to be sorted and unique (see join_sort)
+ * 
+ * @param in input files
+ * @param n number of input files
+ * @param out output file
+ */
+static void csv_merge_files(FILE **in, int n, FILE *out)
+{
+	char **line = calloc(n, sizeof(char *));
+	size_t *size = calloc(n, sizeof(size_t));
+	ssize_t *ln = calloc(n, sizeof(ssize_t));
+
+	for (int i = 0; i < n; i++)
+		ln[i] = next_line(in[i], &line[i], &size[i]);
+
+	while (true)
+	{
+		/* Find the lowest line */
+		int min = -1;
+		for (int i = 0; i < n; i++)
+			if (ln[i] != -1 && (min < 0 || line_cmp(line[i], ln[i], line[min], ln[min]) < 0))
+				min = i;
+		if (min < 0)
+			break;
+
+		fwrite(line[min], ln[min], 1, out);
+		fputc('\n', out);
+
+		/* Advance every input holding the same line */
+		for (int i = 0; i < n; i++)
+			if (i != min && ln[i] != -1 && !line_cmp(line[i], ln[i], line[min], ln[min]))
+				ln[i] = next_line(in[i], &line[i], &size[i]);
+		ln[min] = next_line(in[min], &line[min], &size[min]);
+	}
+
+	for (int i = 0; i < n; i++)
+		free(line[i]);
+	free(line);
+	free(size);
+	free(ln);
+}
+
+/**
+ * @brief Merge sorted snippet files into out, dropping duplicated records
+ * 
+ * @param in input files
+ * @param n number of input files
+ * @param out output file
+ */
+static void bin_merge_files(FILE **in, int n, FILE *out)
+{
+	uint8_t *rec = malloc(n * WFP_REC_LN);
+	bool *ok = calloc(n, sizeof(bool));
+	uint8_t last[WFP_REC_LN];
+	bool first = true;
+
+	for (int i = 0; i < n; i++)
+		ok[i] = fread(rec + i * WFP_REC_LN, WFP_REC_LN, 1, in[i]) == 1;
+
+	while (true)
+	{
+		/* Find the lowest record */
+		int min = -1;
+		for (int i = 0; i < n; i++)
+			if (ok[i] && (min < 0 || memcmp(rec + i * WFP_REC_LN, rec + min * WFP_REC_LN, WFP_REC_LN) < 0))
+				min = i;
+		if (min < 0)
+			break;
+
+		/* bsort does not remove duplicates, so compare with the last record written */
+		uint8_t *r = rec + min * WFP_REC_LN;
+		if (first || memcmp(last, r, WFP_REC_LN))
 		{
-			printf("File %s does not contain 21-byte records\n", destination);
+			fwrite(r, WFP_REC_LN, 1, out);
+			memcpy(last, r, WFP_REC_LN);
+			first = false;
+		}
+
+		ok[min] = fread(r, WFP_REC_LN, 1, in[min]) == 1;
+	}
+
+	free(rec);
+	free(ok);
+}
+
+/**
+ * @brief Merge sorted sectors into a destination sector (--merge).
+ * The result is written next to the destination and renamed over it.
+ * 
+ * @param paths input files (the destination itself must be included if it exists)
+ * @param n number of input files
+ * @param destination path to destination file
+ * @param snippets true for snippet files
+ */
+static void merge_join(char **paths, int n, char *destination, bool snippets)
+{
+	char tmp[MAX_PATH_LEN + 8] = "\0";
+	sprintf(tmp, "%s.merge", destination);
+
+	FILE **in = calloc(n, sizeof(FILE *));
+	for (int i = 0; i < n; i++)
+	{
+		in[i] = fopen(paths[i], "rb");
+		if (!in[i])
+		{
+			printf("Cannot open %s\n", paths[i]);
 			exit(EXIT_FAILURE);
 		}
+		setvbuf(in[i], NULL, _IOFBF, COPY_BUFFER_LN);
+	}
+
+	FILE *out = fopen(tmp, "wb");
+	if (!out)
+	{
+		printf("Cannot create %s\n", tmp);
+		exit(EXIT_FAILURE);
 	}
+	setvbuf(out, NULL, _IOFBF, COPY_BUFFER_LN);
 
-	/* If destination does not exist. Source is moved */
+	if (snippets)
+		bin_merge_files(in, n, out);
 	else
+		csv_merge_files(in, n, out);
+
+	for (int i = 0; i < n; i++)
+		fclose(in[i]);
+	free(in);
+
+	if (fclose(out) || rename(tmp, destination))
+	{
+		printf("Cannot write %s\n", destination);
+		unlink(tmp);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Append files to the end of a destination file, opening it only once
+ * 
+ * @param paths files to be appended
+ * @param n number of files
+ * @param destination path to destination file
+ */
+static void append_join(char **paths, int n, char *destination)
+{
+	int dstf = open(destination, O_WRONLY | O_CREAT, 0666);
+	if (dstf < 0)
+	{
+		printf("Cannot open destinstion file %s\n", destination);
+		exit(EXIT_FAILURE);
+	}
+	lseek(dstf, 0, SEEK_END);
+
+	for (int i = 0; i < n; i++)
 	{
-		printf("Moving %s into %s\n", source, destination);
-		if (!move_file(source, destination, skip_delete))
+		int srcf = open(paths[i], O_RDONLY);
+		if (srcf < 0)
 		{
-			printf("Cannot move file\n");
+			printf("Cannot open source file %s\n", paths[i]);
 			exit(EXIT_FAILURE);
 		}
-		return;
+
+		struct stat st;
+		fstat(srcf, &st);
+		if (!fd_copy(srcf, dstf, st.st_size))
+		{
+			printf("Cannot write %s into %s\n", paths[i], destination);
+			exit(EXIT_FAILURE);
+		}
+		close(srcf);
 	}
 
-	printf("Joining into %s\n", destination);
-	file_append(source, destination);
-	if (!skip_delete) unlink(source);
+	if (close(dstf))
+	{
+		printf("Cannot write %s\n", destination);
+		exit(EXIT_FAILURE);
+	}
 }
 
 /**
- * @brief Join two csv files
+ * @brief Join one sector from several sources into its destination.
+ * The destination is written once: it is either moved from the first source and
+ * appended the rest, appended all sources, or merged with all of them (--merge).
  * 
- * @param source path to source file
- * @param destination path to destination file 
- * @param skip_delete true for skip deletion
+ * @param sources paths to the source files (must exist)
+ * @param n number of sources
+ * @param destination path to destination file
+ * @param kind type of sector
+ * @param skip_delete true to avoid deletion
+ * @param merge true to merge sorted sectors instead of appending (csv and snippets only)
+ * @param mz_dedup true to remove duplicated records from joined mz archives
  */
-void csv_join(char *source, char *destination, bool skip_delete)
+static void join_sector(char **sources, int n, char *destination, enum join_kind kind, bool skip_delete, bool merge, bool mz_dedup)
 {
-	/* check if the file is encoded*/
-	if (check_file_extension(source, false))
+	bool snippets = (kind == JOIN_WFP);
+	merge &= (kind != JOIN_MZ);
+
+	for (int i = 0; i < n; i++)
 	{
-		strcat(destination, ".enc");
+		if (kind == JOIN_CSV)
+			truncate_csv(sources[i]);
+		if (merge)
+			join_sort(sources[i], snippets);
 	}
 
-	/* If source does not exist, no need to join */
-	if (is_file(source)) 
-		truncate_csv(source); 
-	
-	else 
-		return;
+	bool dst_exists = is_file(destination);
 
-	if (is_file(destination))
-	{	
-		truncate_csv(destination);
+	/* mz indexes are kept up to date on new archives and on archives which had one */
+	bool mz_index = (kind == JOIN_MZ && !strstr(destination, ".enc"));
+	uint64_t index_ln = 0;
+	if (mz_index && dst_exists)
+	{
+		mz_index = mz_index_valid(destination);
+		if (mz_index)
+			index_ln = file_size(destination);
+	}
+
+	if (dst_exists)
+	{
+		if (kind == JOIN_CSV)
+			truncate_csv(destination);
+
+		/* Snippet records should divide by 21 */
+		else if (snippets && file_size(destination) % WFP_REC_LN)
+		{
+			printf("File %s does not contain 21-byte records\n", destination);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (merge && (dst_exists || n > 1))
+	{
+		printf("Merging into %s\n", destination);
+		char **inputs = calloc(n + 1, sizeof(char *));
+		int inputs_n = 0;
+		if (dst_exists)
+		{
+			join_sort(destination, snippets);
+			inputs[inputs_n++] = destination;
+		}
+		for (int i = 0; i < n; i++)
+			inputs[inputs_n++] = sources[i];
+
+		merge_join(inputs, inputs_n, destination, snippets);
+		free(inputs);
 	}
 
-	/* If destination does not exist. Source is moved */
 	else
 	{
-		printf("Moving into %s\n", destination);
-		if (!move_file(source, destination, skip_delete))
+		/* If destination does not exist, the first source is moved */
+		int first = 0;
+		if (!dst_exists)
+		{
+			printf("Moving %s into %s\n", sources[0], destination);
+			if (!move_file(sources[0], destination, skip_delete))
+			{
+				printf("Cannot move file\n");
+				exit(EXIT_FAILURE);
+			}
+			first = 1;
+		}
+
+		if (first < n)
 		{
-			printf("Cannot move file\n");
+			printf("Joining into %s\n", destination);
+			append_join(sources + first, n - first, destination);
+		}
+	}
+
+	/* Drop records already present in the archive, reading only record headers */
+	if (kind == JOIN_MZ && mz_dedup)
+	{
+		uint32_t dup_c = 0;
+		if (!mz_dedup_file(destination, &dup_c))
+		{
+			printf("Cannot deduplicate %s\n", destination);
 			exit(EXIT_FAILURE);
 		}
-		return;
+		if (dup_c)
+		{
+			printf("%u duplicated files eliminated from %s\n", dup_c, destination);
+			index_ln = 0;
+		}
 	}
 
-	printf("Joining into %s\n", destination);
-	file_append(source, destination);
-	if (!skip_delete) unlink(source);
+	if (mz_index && !mz_index_extend(destination, index_ln))
+		printf("Cannot index %s\n", destination);
+
+	if (!skip_delete)
+		for (int i = 0; i < n; i++)
+		{
+			unlink(sources[i]);
+			if (kind == JOIN_MZ)
+				mz_index_remove(sources[i]);
+		}
 }
 
 char * check_dir_extensions(const char * directory, char ** failed) 
@@ -259,13 +717,13 @@ char * check_dir_extensions(const char * directory, char ** failed)
     // Iterate through the files in the directory
     while ((entry = readdir(dir))) 
 	{
-        if (entry->d_type == DT_REG) 
-		{  // Only if it's a regular file
+        if (entry->d_type == DT_REG && strncmp(entry->d_name, MZ_PACK_NAME".", strlen(MZ_PACK_NAME) + 1)) 
+		{  // Only if it's a regular file (mz pack files are checked by mz_pack_open)
             char *extension = strrchr(entry->d_name, '.');
 
             if (extension != NULL) 
 			{
-                if (!strcmp(extension,".json"))
+                if (!strcmp(extension,".json") || !strcmp(extension, ".mz"MZ_INDEX_EXT))
 					continue;
 
 				if (!prev_extension) 
@@ -290,13 +748,15 @@ char * check_dir_extensions(const char * directory, char ** failed)
     return prev_extension;
 }
 
-char * dir_test(char *source, char *destination, char * table)
+/**
+ * @brief Check that source and destination directories contain files with a single, matching extension
+ * 
+ * @param src_dir_path source directory
+ * @param dst_dir_path destination directory
+ * @return char* source extension (empty if the source has no files), NULL if the source cannot be open
+ */
+static char * dir_test_path(char *src_dir_path, char *dst_dir_path)
 {
-	
-	char src_dir_path[MAX_PATH_LEN] = "\0";
-	char dst_dir_path[MAX_PATH_LEN] = "\0";
-	
-	sprintf(src_dir_path, "%s/%s", source, table);	
 	if (!is_dir(src_dir_path))
 	{
 		minr_log("Skipped: %s directory could not be open\n", src_dir_path);
@@ -309,7 +769,7 @@ char * dir_test(char *source, char *destination, char * table)
 
 	if (!ext_src)
 	{
-		fprintf(stderr, "Aborted: File extensions inside %s directory do not match. Please check %s before to proceed.\n", source, failed);
+		fprintf(stderr, "Aborted: File extensions inside %s directory do not match. Please check %s before to proceed.\n", src_dir_path, failed);
 		free(failed);
 		exit(EXIT_FAILURE);
 	}
@@ -320,7 +780,7 @@ char * dir_test(char *source, char *destination, char * table)
 		return ext_src;
 	}
 
-	sprintf(dst_dir_path, "%s/%s", destination, table);char * ext_dst = NULL;
+	char * ext_dst = NULL;
 	if (is_dir(dst_dir_path))
 	{
 		minr_log("Checking extensions from: %s\n", dst_dir_path);
@@ -346,220 +806,498 @@ char * dir_test(char *source, char *destination, char * table)
 	return ext_src;
 }
 
-/**
- * @brief Join two mz sources
- * 
- * @param source paht to source
- * @param destination  path to destination
- * @param skip_delete true to skip deletion
- */
-void minr_join_mz(char * table, char *source, char *destination, bool skip_delete, bool encrypted)
+char * dir_test(char *source, char *destination, char * table)
 {
 	char src_dir_path[MAX_PATH_LEN] = "\0";
+	char dst_dir_path[MAX_PATH_LEN] = "\0";
 	
 	sprintf(src_dir_path, "%s/%s", source, table);	
-	if (!is_dir(src_dir_path))
+	sprintf(dst_dir_path, "%s/%s", destination, table);
+	return dir_test_path(src_dir_path, dst_dir_path);
+}
+
+/**
+ * @brief Check if a file name belongs to a sector of the given kind
+ * 
+ * @param name file name
+ * @param kind type of sector
+ * @return true if it does
+ */
+static bool sector_name(char *name, enum join_kind kind)
+{
+	char *ext = strchr(name, '.');
+	if (!ext || *name == '.')
+		return false;
+
+	switch (kind)
 	{
-		minr_log("Warning: Source %s directory could not be open\n", src_dir_path);
-		return;
- 	}
-	
-	minr_log("Checking extensions from: %s\n", src_dir_path);
+		case JOIN_CSV:
+			return !strcmp(ext, ".csv") || !strcmp(ext, ".csv.enc");
+		case JOIN_WFP:
+			return !strcmp(ext, ".bin");
+		case JOIN_MZ:
+			return !strcmp(ext, ".mz") || !strcmp(ext, ".mz.enc");
+	}
+	return false;
+}
 
-	char * ext_src = dir_test(source, destination, table);
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
 
-	for (int i = 0; i < 65536; i++)
+/**
+ * @brief List the sectors found in any of the source directories, sorted and without duplicates.
+ * Only existing files are visited, instead of probing every possible sector name.
+ * 
+ * @param table table being joined
+ */
+static void join_table_list(struct join_table *table)
+{
+	int size = 256;
+	table->names = malloc(size * sizeof(char *));
+	table->name_count = 0;
+
+	for (int s = 0; s < table->src_count; s++)
 	{
-		char src_path[MAX_PATH_LEN] = "\0";
-		char dst_path[MAX_PATH_LEN] = "\0";
-		sprintf(src_path, "%s/%s/%04x.%s", source, table, i, strcmp(ext_src, ".enc") == 0 ? "mz.enc" : "mz");
-		sprintf(dst_path, "%s/%s/%04x.%s", destination, table, i, strcmp(ext_src, ".enc") == 0 ? "mz.enc" : "mz");
-		bin_join(src_path, dst_path, false, skip_delete);
+		DIR *dp = opendir(table->src_dirs[s]);
+		if (!dp)
+			continue;
+
+		struct dirent *entry;
+		while ((entry = readdir(dp)))
+		{
+			if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+				continue;
+			if (!sector_name(entry->d_name, table->kind))
+				continue;
+
+			if (table->name_count == size)
+			{
+				size *= 2;
+				table->names = realloc(table->names, size * sizeof(char *));
+			}
+			table->names[table->name_count++] = strdup(entry->d_name);
+		}
+		closedir(dp);
 	}
-	
-	if (!skip_delete) 
-		rmdir(src_dir_path);
-	
-	free(ext_src);
+
+	qsort(table->names, table->name_count, sizeof(char *), name_cmp);
+
+	/* Remove duplicated names */
+	int unique = 0;
+	for (int i = 0; i < table->name_count; i++)
+	{
+		if (unique && !strcmp(table->names[unique - 1], table->names[i]))
+			free(table->names[i]);
+		else
+			table->names[unique++] = table->names[i];
+	}
+	table->name_count = unique;
 }
 
 /**
- * @brief  Join two snippets file
+ * @brief Worker thread joining sectors of a table until none is left
  * 
- * @param source path to source
- * @param destination path to destination
- * @param skip_delete true to skip deletion
+ * @param ptr pointer to the join table
+ * @return NULL
  */
-void minr_join_snippets(char *source, char *destination, bool skip_delete)
+static void *join_table_worker(void *ptr)
 {
-	char src_path[MAX_PATH_LEN] = "\0";
+	struct join_table *table = ptr;
+	char **sources = calloc(table->src_count, sizeof(char *));
+	for (int s = 0; s < table->src_count; s++)
+		sources[s] = malloc(MAX_PATH_LEN);
 	char dst_path[MAX_PATH_LEN] = "\0";
 
-	for (int i = 0; i < 256; i++)
+	while (true)
 	{
-		sprintf(src_path, "%s/%s/%02x.bin", source, TABLE_NAME_WFP, i);
-		sprintf(dst_path, "%s/%s/%02x.bin", destination, TABLE_NAME_WFP, i);
-		bin_join(src_path, dst_path, true, skip_delete);
+		pthread_mutex_lock(&table->lock);
+		int i = table->next++;
+		pthread_mutex_unlock(&table->lock);
+		if (i >= table->name_count)
+			break;
+
+		/* Collect the sources holding this sector */
+		int n = 0;
+		for (int s = 0; s < table->src_count; s++)
+		{
+			sprintf(sources[n], "%s/%s", table->src_dirs[s], table->names[i]);
+			if (is_file(sources[n]))
+				n++;
+		}
+		if (!n)
+			continue;
+
+		sprintf(dst_path, "%s/%s", table->dst_dir, table->names[i]);
+		join_sector(sources, n, dst_path, table->kind, table->skip_delete, table->merge, table->mz_dedup);
 	}
-	sprintf(src_path, "%s/%s", source, TABLE_NAME_WFP);
-	if (!skip_delete) rmdir(src_path);
+
+	for (int s = 0; s < table->src_count; s++)
+		free(sources[s]);
+	free(sources);
+	return NULL;
 }
 
+/**
+ * @brief Join mz table directories when the destination or any source is packed (see mz_pack.c).
+ * Sectors are read from the source packs and loose files, and appended to the destination
+ * pack if it has one, or to its NNNN.mz files otherwise
+ * 
+ * @param src_dirs source table directories
+ * @param src_count number of source directories
+ * @param dst_dir destination table directory
+ * @param skip_delete true to avoid deletion
+ */
+static void join_mz_pack(char **src_dirs, int src_count, char *dst_dir, bool skip_delete)
+{
+	if (!is_dir(dst_dir))
+		create_dir(dst_dir);
+
+	struct mz_pack *dst_pack = mz_pack_exists(dst_dir) ? mz_pack_open(dst_dir) : NULL;
+	char path[MAX_PATH_LEN + 16] = "\0";
+
+	for (int s = 0; s < src_count; s++)
+	{
+		if (!is_dir(src_dirs[s]))
+			continue;
+
+		printf("Joining %s into %s\n", src_dirs[s], dst_dir);
+		struct mz_pack *src_pack = mz_pack_exists(src_dirs[s]) ? mz_pack_open(src_dirs[s]) : NULL;
+
+		for (int i = 0; i < MZ_FILES; i++)
+		{
+			uint64_t ln = 0;
+			uint8_t *data = mz_sector_read(src_dirs[s], src_pack, i, &ln);
+			if (!data)
+				continue;
+
+			bool ok = true;
+			if (dst_pack)
+				ok = mz_pack_append(dst_pack, i, data, ln);
+			else
+			{
+				sprintf(path, "%s/%04x.mz", dst_dir, i);
+				int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+				ok = (fd >= 0 && write(fd, data, ln) == ln);
+				if (fd >= 0)
+					close(fd);
+			}
+			free(data);
+
+			if (!ok)
+			{
+				printf("Cannot write sector %04x into %s\n", i, dst_dir);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (src_pack)
+			mz_pack_close(src_pack);
+	}
+
+	/* Sources are only removed once the destination pack index is saved */
+	if (dst_pack && !mz_pack_close(dst_pack))
+		exit(EXIT_FAILURE);
+
+	if (!skip_delete)
+		for (int s = 0; s < src_count; s++)
+		{
+			int count = 0;
+			char **names = mz_dir_list(src_dirs[s], &count);
+			for (int i = 0; i < count; i++)
+			{
+				sprintf(path, "%s/%s", src_dirs[s], names[i]);
+				unlink(path);
+				mz_index_remove(path);
+			}
+			mz_dir_list_free(names, count);
+			mz_pack_remove(src_dirs[s]);
+			rmdir(src_dirs[s]);
+		}
+}
 
-static bool minr_join_test(struct minr_job *job)
+/**
+ * @brief Join a table directory from several sources into a destination directory.
+ * Sectors are distributed among worker threads, and each destination sector is written once.
+ * 
+ * @param src_dirs source table directories
+ * @param src_count number of source directories
+ * @param dst_dir destination table directory
+ * @param kind type of sector
+ * @param skip_delete true to avoid deletion
+ * @param merge true to merge sorted sectors instead of appending
+ * @param mz_dedup true to remove duplicated records from joined mz archives
+ * @param threads number of worker threads
+ */
+static void join_dirs(char **src_dirs, int src_count, char *dst_dir, enum join_kind kind, bool skip_delete, bool merge, bool mz_dedup, int threads)
 {
-	char *source = job->join_from;
-	char *destination = job->join_to;
+	if (kind == JOIN_MZ)
+	{
+		bool packed = mz_pack_exists(dst_dir);
+		for (int s = 0; s < src_count; s++)
+			packed |= mz_pack_exists(src_dirs[s]);
+		if (packed)
+		{
+			join_mz_pack(src_dirs, src_count, dst_dir, skip_delete);
+			return;
+		}
+	}
+
+	struct join_table table;
+	table.src_dirs = src_dirs;
+	table.src_count = src_count;
+	table.dst_dir = dst_dir;
+	table.kind = kind;
+	table.skip_delete = skip_delete;
+	table.merge = merge;
+	table.mz_dedup = mz_dedup;
+	table.next = 0;
+	pthread_mutex_init(&table.lock, NULL);
+
+	join_table_list(&table);
 
-	if (!is_dir(source))
+	if (table.name_count)
 	{
-		printf("Could not open directory %s, skipping", source);
-		return true;
+		if (!is_dir(dst_dir))
+			create_dir(dst_dir);
+		if (!is_dir(dst_dir))
+		{
+			printf("Cannot create directory %s\n", dst_dir);
+			exit(EXIT_FAILURE);
+		}
+
+		if (threads > table.name_count)
+			threads = table.name_count;
+		if (threads < 1)
+			threads = 1;
+
+		pthread_t *workers = calloc(threads, sizeof(pthread_t));
+		for (int t = 1; t < threads; t++)
+			pthread_create(&workers[t], NULL, join_table_worker, &table);
+		join_table_worker(&table);
+		for (int t = 1; t < threads; t++)
+			pthread_join(workers[t], NULL);
+		free(workers);
 	}
 
+	for (int i = 0; i < table.name_count; i++)
+		free(table.names[i]);
+	free(table.names);
+	pthread_mutex_destroy(&table.lock);
+
+	if (!skip_delete)
+		for (int s = 0; s < src_count; s++)
+			rmdir(src_dirs[s]);
+}
+
+/**
+ * @brief Join a table from several mined/ sources into a destination mined/ directory
+ * 
+ * @param sources mined/ source directories
+ * @param src_count number of sources
+ * @param destination mined/ destination directory
+ * @param table table directory, relative to the mined/ directory
+ * @param kind type of sector
+ * @param job pointer to minr job
+ */
+static void join_table(char **sources, int src_count, char *destination, char *table, enum join_kind kind, struct minr_job *job)
+{
+	char **src_dirs = calloc(src_count, sizeof(char *));
+	for (int s = 0; s < src_count; s++)
+		asprintf(&src_dirs[s], "%s/%s", sources[s], table);
+
+	char dst_dir[MAX_PATH_LEN] = "\0";
+	sprintf(dst_dir, "%s/%s", destination, table);
+
+	join_dirs(src_dirs, src_count, dst_dir, kind, job->skip_delete, job->join_merge, job->join_mz_dedup, job->threads);
+
+	for (int s = 0; s < src_count; s++)
+		free(src_dirs[s]);
+	free(src_dirs);
+}
+
+/**
+ * @brief Join two mz directories
+ * 
+ * @param src_dir_path path to the source mz directory
+ * @param dst_dir_path path to the destination mz directory
+ * @param skip_delete true to skip deletion
+ * @param threads number of worker threads
+ */
+void minr_join_mz_dir(char *src_dir_path, char *dst_dir_path, bool skip_delete, int threads)
+{
+	if (!is_dir(src_dir_path))
+	{
+		minr_log("Warning: Source %s directory could not be open\n", src_dir_path);
+		return;
+ 	}
+
+	free(dir_test_path(src_dir_path, dst_dir_path));
+	join_dirs(&src_dir_path, 1, dst_dir_path, JOIN_MZ, skip_delete, false, false, threads);
+}
+
+/**
+ * @brief Join two mz sources
+ * 
+ * @param source paht to source
+ * @param destination  path to destination
+ * @param skip_delete true to skip deletion
+ * @param threads number of worker threads
+ */
+void minr_join_mz(char * table, char *source, char *destination, bool skip_delete, int threads)
+{
+	char src_dir_path[MAX_PATH_LEN] = "\0";
+	char dst_dir_path[MAX_PATH_LEN] = "\0";
+	
+	sprintf(src_dir_path, "%s/%s", source, table);	
+	sprintf(dst_dir_path, "%s/%s", destination, table);	
+	minr_join_mz_dir(src_dir_path, dst_dir_path, skip_delete, threads);
+}
+
+/**
+ * @brief Split the comma separated list of join sources (-f) and validate them
+ * 
+ * @param job pointer to minr job
+ * @param[out] sources source directories
+ * @return number of sources
+ */
+static int minr_join_test(struct minr_job *job, char ***sources)
+{
+	char *destination = job->join_to;
+
 	if (!is_dir(destination))
 	{
 		printf("destination %s must be a directory\n", destination);
 		exit(EXIT_FAILURE);
 	}
 
-	if (!strcmp(source, destination))
+	char *list = strdup(job->join_from);
+	char *saveptr = NULL;
+	int count = 0;
+	*sources = NULL;
+
+	for (char *source = strtok_r(list, ",", &saveptr); source; source = strtok_r(NULL, ",", &saveptr))
 	{
-		printf("Source and destination cannot be the same\n");
-		exit(EXIT_FAILURE);
+		if (!is_dir(source))
+		{
+			printf("Could not open directory %s, skipping\n", source);
+			continue;
+		}
+
+		if (!strcmp(source, destination))
+		{
+			printf("Source and destination cannot be the same\n");
+			exit(EXIT_FAILURE);
+		}
+
+		dir_test(source, destination, TABLE_NAME_FILE);
+		dir_test(source, destination, TABLE_NAME_PIVOT);
+		dir_test(source, destination, TABLE_NAME_SOURCES);
+		dir_test(source, destination, TABLE_NAME_NOTICES);
+
+		*sources = realloc(*sources, (count + 1) * sizeof(char *));
+		(*sources)[count++] = strdup(source);
 	}
-	//dir_test(source, destination, "\0");
 
-	dir_test(source, destination, TABLE_NAME_FILE);	
-	dir_test(source, destination, TABLE_NAME_PIVOT);
-	dir_test(source, destination, TABLE_NAME_SOURCES);
-	dir_test(source, destination, TABLE_NAME_NOTICES);
+	free(list);
+	return count;
+}
 
-	return true;
+/**
+ * @brief Join a single-file CSV table (i.e. url.csv) from several sources
+ * 
+ * @param sources mined/ source directories
+ * @param src_count number of sources
+ * @param destination mined/ destination directory
+ * @param table table name
+ * @param job pointer to minr job
+ */
+static void join_csv_file(char **sources, int src_count, char *destination, char *table, struct minr_job *job)
+{
+	char **paths = calloc(src_count, sizeof(char *));
+	char dst_path[MAX_PATH_LEN] = "\0";
+
+	/* Plain and encoded tables are joined separately */
+	for (int enc = 0; enc < 2; enc++)
+	{
+		int n = 0;
+		for (int s = 0; s < src_count; s++)
+		{
+			asprintf(&paths[n], "%s/%s.csv%s", sources[s], table, enc ? ".enc" : "");
+			if (is_file(paths[n]))
+				n++;
+			else
+				free(paths[n]);
+		}
+
+		if (n)
+		{
+			sprintf(dst_path, "%s/%s.csv%s", destination, table, enc ? ".enc" : "");
+			join_sector(paths, n, dst_path, JOIN_CSV, job->skip_delete, job->join_merge, false);
+		}
+
+		for (int i = 0; i < n; i++)
+			free(paths[i]);
+	}
+	free(paths);
 }
 
 /**
- * @brief minr join function. Join the files specified in the job
+ * @brief minr join function. Join the files specified in the job.
+ * Several sources can be given (-f dir1,dir2,...), they are all joined in a single pass
  * 
  * @param job pointer to mnir job
  */
 void minr_join(struct minr_job *job)
 {
-	minr_join_test(job);
+	char **sources = NULL;
+	int src_count = minr_join_test(job, &sources);
+	if (!src_count)
+		return;
+
 	char src_path[MAX_PATH_LEN] = "\0";
-	char dst_path[MAX_PATH_LEN] = "\0";
-	char *source = job->join_from;
 	char *destination = job->join_to;
 
 	/* Join urls */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_URL);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_URL);
-	csv_join(src_path, dst_path, job->skip_delete);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_URL, job);
 
 	/* Join files */
-	for (int i = 0; i < 256; i++)
-	{
-		sprintf(src_path, "%s/%s/%02x.csv", source, TABLE_NAME_FILE, i);
-		sprintf(dst_path, "%s/%s/%02x.csv", destination,TABLE_NAME_FILE, i);
-		csv_join(src_path, dst_path, job->skip_delete);
-	}
-	sprintf(src_path, "%s/%s", source, TABLE_NAME_FILE);
-	if (!job->skip_delete) rmdir(src_path);
+	join_table(sources, src_count, destination, TABLE_NAME_FILE, JOIN_CSV, job);
 
 	/* Join pivot */
-	for (int i = 0; i < 256; i++)
-	{
-		sprintf(src_path, "%s/%s/%02x.csv", source, TABLE_NAME_PIVOT, i);
-		sprintf(dst_path, "%s/%s/%02x.csv", destination, TABLE_NAME_PIVOT, i);
-		csv_join(src_path, dst_path, job->skip_delete);
-	}
-	sprintf(src_path, "%s/%s", source, TABLE_NAME_PIVOT);
-	if (!job->skip_delete) rmdir(src_path);
+	join_table(sources, src_count, destination, TABLE_NAME_PIVOT, JOIN_CSV, job);
 
 	/* Join snippets */
-	minr_join_snippets(source, destination, job->skip_delete);
+	join_table(sources, src_count, destination, TABLE_NAME_WFP, JOIN_WFP, job);
 
 	/* Join MZ (sources/ and notices/) */
-	minr_join_mz(TABLE_NAME_SOURCES, source, destination, job->skip_delete, job->bin_import);
-	minr_join_mz(TABLE_NAME_NOTICES, source, destination, job->skip_delete, job->bin_import);
-
-	/* Join licenses */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_LICENSE);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_LICENSE);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join dependencies */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_DEPENDENCY);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_DEPENDENCY);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join quality */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_QUALITY);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_QUALITY);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join copyright */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_COPYRIGHT);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_COPYRIGHT);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join vulnerabilities */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_VULNERABILITY);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_VULNERABILITY);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join attribution */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_ATTRIBUTION);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_ATTRIBUTION);
-	csv_join(src_path, dst_path, job->skip_delete);
-
-	/* Join cryptography */
-	sprintf(src_path, "%s/%s.csv", source, TABLE_NAME_CRYPTOGRAPHY);
-	sprintf(dst_path, "%s/%s.csv", destination, TABLE_NAME_CRYPTOGRAPHY);
-	csv_join(src_path, dst_path, job->skip_delete);
+	join_table(sources, src_count, destination, TABLE_NAME_SOURCES, JOIN_MZ, job);
+	join_table(sources, src_count, destination, TABLE_NAME_NOTICES, JOIN_MZ, job);
+
+	/* Join single-file tables */
+	join_csv_file(sources, src_count, destination, TABLE_NAME_LICENSE, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_DEPENDENCY, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_QUALITY, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_COPYRIGHT, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_VULNERABILITY, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_ATTRIBUTION, job);
+	join_csv_file(sources, src_count, destination, TABLE_NAME_CRYPTOGRAPHY, job);
 
 	/* Join Extra tables */
-	sprintf(src_path, "%s/extra", source);
-	sprintf(dst_path, "%s/extra", destination);
+	join_table(sources, src_count, destination, "extra/"TABLE_NAME_FILE, JOIN_CSV, job);
+	join_table(sources, src_count, destination, "extra/"TABLE_NAME_PIVOT, JOIN_CSV, job);
+	join_table(sources, src_count, destination, "extra/"TABLE_NAME_SOURCES, JOIN_MZ, job);
 
-	if (is_dir(src_path) && is_dir(destination))
+	for (int s = 0; s < src_count; s++)
 	{
-		/* Join files */
-		for (int i = 0; i < 256; i++)
+		if (!job->skip_delete)
 		{
-			sprintf(src_path, "%s/extra/%s/%02x.csv", source, TABLE_NAME_FILE, i);
-			sprintf(dst_path, "%s/extra/%s/%02x.csv", destination, TABLE_NAME_FILE, i);
-			csv_join(src_path, dst_path, job->skip_delete);
-		}
-		
-		sprintf(src_path, "%s/%s", source, TABLE_NAME_FILE);
-		if (!job->skip_delete) 
+			sprintf(src_path, "%s/extra", sources[s]);
 			rmdir(src_path);
-		/* Join Pivot */
-		for (int i = 0; i < 256; i++)
-		{
-			sprintf(src_path, "%s/extra/%s/%02x.csv", source, TABLE_NAME_PIVOT, i);
-			sprintf(dst_path, "%s/extra/%s/%02x.csv", destination, TABLE_NAME_PIVOT, i);
-			csv_join(src_path, dst_path, job->skip_delete);
+			rmdir(sources[s]);
 		}
-
-		sprintf(src_path, "%s/%s", source, TABLE_NAME_PIVOT);
-		if (!job->skip_delete) 
-			rmdir(src_path);
-
-		/* Join Extra sources */
-		for (int i = 0; i < 65536; i++)
-		{
-			sprintf(src_path, "%s/extra/%s/%04x.mz", source, TABLE_NAME_SOURCES, i);
-			sprintf(dst_path, "%s/extra/%s/%04x.mz", destination, TABLE_NAME_SOURCES, i);
-			bin_join(src_path, dst_path, false, job->skip_delete);
-		}
-		
-		sprintf(src_path, "%s/%s", source, TABLE_NAME_SOURCES);
-		if (!job->skip_delete) 
-			rmdir(src_path);
+		free(sources[s]);
 	}
-
-	if (!job->skip_delete) 
-		rmdir(source);
+	free(sources);
 }
@@ -35,6 +35,8 @@
 #include <unistd.h>
 #include "minr.h"
 #include "license.h"
+#include "sink.h"
+#include "arena.h"
 
 bool is_file(char *path);
 bool is_dir(char *path);
@@ -58,7 +60,7 @@ bool is_spdx_license_identifier(char *src)
  * @brief Returns pointer to SPDX-License-Identifier tag (null if not found)
  * 
  * @param src source string
- * @return char* 
+ * @return char* licenses separated by '#' (arena memory)
  */
 char *spdx_license_identifier(char *src)
 {
@@ -80,13 +82,13 @@ char *spdx_license_identifier(char *src)
 		return NULL;
 	}
 	
-	char * line = strndup(s, line_end - s);
+	char line[MAX_LICENSE_TEXT];
+	memcpy(line, s, line_end - s);
+	line[line_end - s] = 0;
 
 	char * and = NULL;
 	char * or = NULL;
 	
-	if (!line)
-		return NULL;
 	s = line;
 	/* End string at end of tag */
 	do
@@ -125,8 +127,10 @@ char *spdx_license_identifier(char *src)
 		strcat(license, "#");
 	} while ( and || or);
 	
-	free(line);
-	return strdup(license);
+	char *out = arena_alloc(strlen(license) + 1);
+	if (out)
+		strcpy(out, license);
+	return out;
 }
 
 /**
@@ -354,22 +358,16 @@ char *mine_license_header(char *src, uint64_t src_ln, normalized_license *licens
  */
 void mine_license(struct minr_job *job, char *id, bool license_file)
 {
-	FILE *fp;
-
-	/* Assemble csv path */
-	char csv_path[MAX_PATH_LEN] = "\0";
-	if (!job->local_mining)
-	{
-		strcpy(csv_path, job->mined_path);
-		strcat(csv_path,"/"TABLE_NAME_LICENSE".csv");
-	}
+	/* Output sink of the csv */
+	struct sink *out = job->local_mining ? NULL : job->out_license;
 
 	/* SPDX license tag detection */
 	char *license = mine_spdx_license_identifier(job->src, job->src_ln);
 	
 	if (license)
 	{
-		char * lic = strtok(license,"#");
+		char *saveptr = NULL;
+		char * lic = strtok_r(license, "#", &saveptr);
 		while (lic)
 		{		
 			char * l = lic + strlen(lic);
@@ -383,17 +381,12 @@ void mine_license(struct minr_job *job, char *id, bool license_file)
 				l--;
 			}
 
-			if (!job->local_mining)
-			{
-				fp = fopen(csv_path, "a");
-				fprintf(fp, "%s,%d,%s\n", id, license_file ? 3 : 1, lic);
-				fclose(fp);
-			}
+			if (out)
+				sink_printf(out, "%s,%d,%s\n", id, license_file ? 3 : 1, lic);
 			else
 				printf("%s,%s\n", id, lic);
-			lic = strtok(NULL,"#");
+			lic = strtok_r(NULL, "#", &saveptr);
 		}
-		free(license);
 	}
 
 	/* License header detection */
@@ -406,12 +399,8 @@ void mine_license(struct minr_job *job, char *id, bool license_file)
 			if (license_file)
 				*license_source = '3';
 
-			if (!job->local_mining)
-			{
-				fp = fopen(csv_path, "a");
-				fprintf(fp, "%s,%s,%s\n", id, license_source, license);
-				fclose(fp);
-			}
+			if (out)
+				sink_printf(out, "%s,%s,%s\n", id, license_source, license);
 			else
 				printf("%s,%s\n", id, license);
 		}
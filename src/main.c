@@ -29,6 +29,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -50,10 +51,21 @@
 #include "import.h"
 #include "crypto.h"
 #include "url.h"
+#include "url_pipeline.h"
 #include "scancode.h"
 #include "minr_log.h"
+#include "mz_codec.h"
+#include "mz_pack.h"
 #include <dlfcn.h>
 
+/* Long options without a short equivalent */
+enum
+{
+	OPTION_MZ_CODEC = 256,
+	OPTION_MZ_DICT,
+	OPTION_BATCH,
+	OPTION_PIPELINE
+};
 
 void * lib_handle = NULL;
 bool lib_load()
@@ -97,6 +109,10 @@ int main(int argc, char *argv[])
 	*job.purlid = 0;
 	*job.license = 0;
 	*job.download_url = 0;
+	*job.batch = 0;
+	job.fetchers = 0;
+	job.extractors = 0;
+	job.miners = 0;
 	job.all_extensions = false;
 	job.exclude_mz = false;
 	job.exclude_detection = false;
@@ -109,10 +125,14 @@ int main(int argc, char *argv[])
 	*job.import_path=0;
 	*job.import_table=0;
 	job.import_overwrite=false;
+	job.import_shadow = false;
 	job.bin_import = false;
 	// Join job
 	*job.join_from=0;
 	*job.join_to=0;
+	job.join_merge = false;
+	job.join_mz_dedup = false;
+	job.threads = 1;
 
 	// Snippet mine job
 	*job.mz=0;
@@ -130,8 +150,17 @@ int main(int argc, char *argv[])
 
 	job.src = NULL;
 	job.zsrc = NULL;
+	job.out_file = NULL;
+	job.out_file_extra = NULL;
 	job.out_pivot = NULL;
 	job.out_pivot_extra = NULL;
+	job.out_url = NULL;
+	job.out_license = NULL;
+	job.out_copyright = NULL;
+	job.out_quality = NULL;
+	job.out_crypto = NULL;
+	job.out_attribution = NULL;
+	job.mine_queue = NULL;
 
 	/* Parse arguments */
 	int option;
@@ -139,7 +168,18 @@ int main(int argc, char *argv[])
 
 	bool lib_encoder_present = lib_load();
 
-	while ((option = getopt(argc, argv, ":c:C:L:Q:Y:o:m:g:w:t:f:T:i:I:l:z:u:U:d:D:V:SxXsnkeahvOAb")) != -1)
+	static struct option long_options[] =
+	{
+		{"merge", no_argument, NULL, 'M'},
+		{"mz-dedup", no_argument, NULL, 'E'},
+		{"mz-codec", required_argument, NULL, OPTION_MZ_CODEC},
+		{"mz-dict", required_argument, NULL, OPTION_MZ_DICT},
+		{"batch", required_argument, NULL, OPTION_BATCH},
+		{"pipeline", required_argument, NULL, OPTION_PIPELINE},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((option = getopt_long(argc, argv, ":c:C:L:Q:Y:o:m:g:w:t:f:T:i:I:l:z:u:U:d:D:V:j:SxXsnkeahvOANbME", long_options, NULL)) != -1)
 	{
 
 		/* Check valid alpha is entered */
@@ -183,6 +223,33 @@ int main(int argc, char *argv[])
 				strcpy(job.join_from, optarg);
 				break;
 
+			case 'M':
+				job.join_merge = true;
+				break;
+
+			case 'E':
+				job.join_mz_dedup = true;
+				break;
+
+			case OPTION_MZ_CODEC:
+				if (!mz_codec_set(optarg))
+					exit(EXIT_FAILURE);
+				break;
+
+			case OPTION_MZ_DICT:
+				if (!mz_dict_load(optarg))
+					exit(EXIT_FAILURE);
+				break;
+
+			case 'j':
+				job.threads = atoi(optarg);
+				if (job.threads < 1)
+				{
+					printf("Invalid number of threads: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
 			case 'T':
 				strcpy(tmp_path, optarg);
 				break;
@@ -210,6 +277,10 @@ int main(int argc, char *argv[])
 				job.import_overwrite = true;
 				break;
 
+			case 'N':
+				job.import_shadow = true;
+				break;
+
 			case 'l':
 				generate_license_ids_c(optarg);
 				exit(EXIT_SUCCESS);
@@ -236,6 +307,19 @@ int main(int argc, char *argv[])
 				strcpy(job.download_url, optarg);
 				break;
 
+			case OPTION_BATCH:
+				strcpy(job.batch, optarg);
+				break;
+
+			case OPTION_PIPELINE:
+				if (sscanf(optarg, "%d,%d,%d", &job.fetchers, &job.extractors, &job.miners) != 3 ||
+					job.fetchers < 1 || job.extractors < 1 || job.miners < 1)
+				{
+					printf("Invalid pipeline: %s (expected FETCHERS,EXTRACTORS,MINERS)\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
 			case 'C':
 				job.local_mining = 4;
 				strcpy(job.url, optarg);
@@ -366,7 +450,7 @@ int main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		char *file_path = calloc(MAX_PATH_LEN + 1, 1);
+		char *file_path = calloc(MAX_PATH_LEN + 32, 1);
 
 		/* Open all file handlers in mined/snippets (256 files) */
 		if (is_dir(job.mz))
@@ -377,15 +461,34 @@ int main(int argc, char *argv[])
 		/* Import snippets from the entire sources/ directory */
 		if (is_dir(job.mz))
 		{
+			char sources[MAX_PATH_LEN + 16] = "\0";
+			sprintf(sources, "%s/sources", job.mz);
+			struct mz_pack *pack = mz_pack_exists(sources) ? mz_pack_open(sources) : NULL;
+
 			for (int i = 0; i < MZ_FILES; i++)
 			{
-				sprintf(file_path, "%s/sources/%04x.mz", job.mz, i);
-				if (file_size(file_path))
+				sprintf(file_path, "%s/%04x.mz", sources, i);
+
+				/* Packed tables are read sector by sector, loose files included */
+				if (pack)
+				{
+					uint64_t mz_ln = 0;
+					uint8_t *mz = mz_sector_read(sources, pack, i, &mz_ln);
+					if (mz)
+					{
+						printf("%s\n", file_path);
+						mz_wfp_extract_sector(file_path, i, mz, mz_ln);
+						free(mz);
+					}
+				}
+				else if (file_size(file_path))
 				{
 					printf("%s\n", file_path);
 					mz_wfp_extract(file_path);
 				}
 			}
+			if (pack)
+				mz_pack_close(pack);
 		}
 
 		/* Import snippets from a single file */
@@ -399,6 +502,29 @@ int main(int argc, char *argv[])
 
 	}
 
+	/* Mine the components of a manifest */
+	else if (*job.batch)
+	{
+		/* -U replaces the url of a single component, it would be recorded for all of them */
+		if (*job.download_url)
+		{
+			printf("-U cannot be used with --batch\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (!create_dir(job.mined_path) || (job.mine_all && !create_dir(job.mined_extra_path)))
+		{
+			printf("Cannot create output structure in %s\n", job.mined_path);
+			exit(EXIT_FAILURE);
+		}
+
+		job.licenses = load_licenses(&job.license_count);
+		int errors = job.miners ? url_pipeline(&job, job.batch) : url_batch(&job, job.batch);
+		if (errors)
+			exit_code = EXIT_FAILURE;
+		free(job.licenses);
+	}
+
 	/* Mine URL */
 	else if (*job.metadata && *job.url)
 	{
@@ -442,6 +568,7 @@ int main(int argc, char *argv[])
 	}
 
 	clean_crypto_definitions();
+	mz_codec_free();
 	if (lib_encoder_present)
 	{
 		dlclose(lib_handle);
@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/md5_mb.c
+ *
+ * Multi-buffer MD5
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file md5_mb.c
+  * @date 18 Oct 2026
+  * @brief A single MD5 stream is a chain of dependent steps, so most of the files mined (a few KB
+  * each) cannot keep a core busy. On processors with AVX2 up to MD5_MB_LANES independent buffers
+  * are hashed at once, one per 32-bit lane: each lane walks its own blocks (its padding comes from
+  * a tail copy) and is given the next buffer as soon as it finishes. Without AVX2, or for a single
+  * buffer, each buffer is hashed with MD5() from libldb. Digests are the same either way
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ldb.h>
+
+#include "md5_mb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MD5_MB_AVX2
+#endif
+
+#define MD5_BLOCK 64
+
+/* A buffer being hashed by a lane */
+struct md5_lane
+{
+	int job;                    // buffer index, -1 for an idle lane
+	const uint8_t *data;
+	uint64_t blocks;            // full blocks of data
+	uint64_t total;             // blocks, padding included
+	uint64_t next;              // next block to be hashed
+	uint8_t tail[2 * MD5_BLOCK];// last partial block and padding
+};
+
+static const uint32_t md5_iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+/**
+ * @brief Returns true if buffers can be hashed by the AVX2 engine on this processor
+ */
+bool md5_mb_available(void)
+{
+#ifdef MD5_MB_AVX2
+	static int avx2 = -1;
+	if (avx2 < 0)
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return avx2;
+#else
+	return false;
+#endif
+}
+
+#ifdef MD5_MB_AVX2
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const int md5_s[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+/* Prepare a lane for a buffer: its last partial block is copied along with the padding */
+static void md5_lane_start(struct md5_lane *lane, int job, const uint8_t *data, uint64_t ln)
+{
+	lane->job = job;
+	lane->data = data;
+	lane->blocks = ln / MD5_BLOCK;
+	lane->next = 0;
+
+	uint64_t rem = ln % MD5_BLOCK;
+	int tail_blocks = rem < MD5_BLOCK - 8 ? 1 : 2;
+	memset(lane->tail, 0, sizeof(lane->tail));
+	if (rem)
+		memcpy(lane->tail, data + ln - rem, rem);
+	lane->tail[rem] = 0x80;
+
+	uint64_t bits = ln * 8;
+	for (int i = 0; i < 8; i++)
+		lane->tail[tail_blocks * MD5_BLOCK - 8 + i] = bits >> (8 * i);
+
+	lane->total = lane->blocks + tail_blocks;
+}
+
+static const uint8_t *md5_lane_block(struct md5_lane *lane)
+{
+	if (lane->next < lane->blocks)
+		return lane->data + lane->next * MD5_BLOCK;
+	return lane->tail + (lane->next - lane->blocks) * MD5_BLOCK;
+}
+
+/**
+ * @brief Load 32 bytes of each lane's block and transpose them, so that w[i] holds word i
+ * of the eight lanes
+ *
+ * @param w transposed words
+ * @param blocks block of each lane
+ * @param offset byte offset in the blocks (0 or 32)
+ */
+__attribute__((target("avx2"), optimize("O2")))
+static void md5_avx2_load(__m256i *w, const uint8_t **blocks, int offset)
+{
+	__m256i r[8], t[8], u[8];
+	for (int l = 0; l < 8; l++)
+		r[l] = _mm256_loadu_si256((const __m256i *) (blocks[l] + offset));
+
+	for (int i = 0; i < 8; i += 2)
+	{
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (int i = 0; i < 8; i += 4)
+	{
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		w[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		w[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+/**
+ * @brief Hash one block per lane, updating the state of the eight lanes. Built optimized
+ * even in debug builds: unoptimized vector code is slower than a single scalar stream
+ *
+ * @param st state words (a, b, c, d) of the lanes
+ * @param blocks block of each lane
+ */
+__attribute__((target("avx2"), optimize("O2")))
+static void md5_avx2_block(__m256i *st, const uint8_t **blocks)
+{
+	__m256i w[16];
+	md5_avx2_load(w, blocks, 0);
+	md5_avx2_load(w + 8, blocks, 32);
+
+	__m256i a = st[0], b = st[1], c = st[2], d = st[3];
+	__m256i ones = _mm256_set1_epi32(-1);
+
+	for (int i = 0; i < 64; i++)
+	{
+		int round = i >> 4;
+		__m256i f;
+		int g;
+		switch (round)
+		{
+		case 0:
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			g = i;
+			break;
+		case 1:
+			f = _mm256_xor_si256(c, _mm256_and_si256(d, _mm256_xor_si256(b, c)));
+			g = (5 * i + 1) & 15;
+			break;
+		case 2:
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			g = (3 * i + 5) & 15;
+			break;
+		default:
+			f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+			g = (7 * i) & 15;
+			break;
+		}
+
+		__m256i t = _mm256_add_epi32(_mm256_add_epi32(a, f), _mm256_add_epi32(_mm256_set1_epi32(md5_k[i]), w[g]));
+		int s = md5_s[round][i & 3];
+		t = _mm256_or_si256(_mm256_sllv_epi32(t, _mm256_set1_epi32(s)), _mm256_srlv_epi32(t, _mm256_set1_epi32(32 - s)));
+
+		a = d;
+		d = c;
+		c = b;
+		b = _mm256_add_epi32(b, t);
+	}
+
+	st[0] = _mm256_add_epi32(st[0], a);
+	st[1] = _mm256_add_epi32(st[1], b);
+	st[2] = _mm256_add_epi32(st[2], c);
+	st[3] = _mm256_add_epi32(st[3], d);
+}
+
+/**
+ * @brief Hash count buffers with the AVX2 engine. Lanes take the next buffer as soon as they
+ * finish, idle lanes hash a dummy block
+ */
+__attribute__((target("avx2"), optimize("O2")))
+static void md5_avx2(uint8_t **data, uint64_t *ln, uint8_t (*md5)[MD5_MB_DIGEST], int count)
+{
+	static const uint8_t idle[MD5_BLOCK] = {0};
+	struct md5_lane lanes[MD5_MB_LANES];
+	uint32_t words[4][MD5_MB_LANES];
+	int next_job = 0;
+	int active = 0;
+
+	for (int l = 0; l < MD5_MB_LANES; l++)
+	{
+		lanes[l].job = -1;
+		for (int i = 0; i < 4; i++)
+			words[i][l] = md5_iv[i];
+		if (next_job < count)
+		{
+			md5_lane_start(&lanes[l], next_job, data[next_job], ln[next_job]);
+			next_job++;
+			active++;
+		}
+	}
+
+	while (active)
+	{
+		/* Run the blocks that every busy lane still has */
+		uint64_t run = UINT64_MAX;
+		for (int l = 0; l < MD5_MB_LANES; l++)
+			if (lanes[l].job >= 0 && lanes[l].total - lanes[l].next < run)
+				run = lanes[l].total - lanes[l].next;
+
+		__m256i st[4];
+		for (int i = 0; i < 4; i++)
+			st[i] = _mm256_loadu_si256((__m256i *) words[i]);
+
+		for (uint64_t r = 0; r < run; r++)
+		{
+			const uint8_t *blocks[MD5_MB_LANES];
+			for (int l = 0; l < MD5_MB_LANES; l++)
+			{
+				if (lanes[l].job < 0)
+					blocks[l] = idle;
+				else
+				{
+					blocks[l] = md5_lane_block(&lanes[l]);
+					lanes[l].next++;
+				}
+			}
+			md5_avx2_block(st, blocks);
+		}
+
+		for (int i = 0; i < 4; i++)
+			_mm256_storeu_si256((__m256i *) words[i], st[i]);
+
+		/* Collect the digests of the finished lanes and give them the next buffers */
+		for (int l = 0; l < MD5_MB_LANES; l++)
+		{
+			if (lanes[l].job < 0 || lanes[l].next < lanes[l].total)
+				continue;
+
+			for (int i = 0; i < 4; i++)
+				for (int b = 0; b < 4; b++)
+					md5[lanes[l].job][i * 4 + b] = words[i][l] >> (8 * b);
+
+			lanes[l].job = -1;
+			active--;
+			for (int i = 0; i < 4; i++)
+				words[i][l] = md5_iv[i];
+
+			if (next_job < count)
+			{
+				md5_lane_start(&lanes[l], next_job, data[next_job], ln[next_job]);
+				next_job++;
+				active++;
+			}
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Calculate the MD5 of count independent buffers
+ *
+ * @param data buffers
+ * @param ln buffer lengths
+ * @param[out] md5 digests
+ * @param count number of buffers
+ */
+void md5_mb(uint8_t **data, uint64_t *ln, uint8_t (*md5)[MD5_MB_DIGEST], int count)
+{
+#ifdef MD5_MB_AVX2
+	if (count > 1 && md5_mb_available())
+	{
+		md5_avx2(data, ln, md5, count);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; i++)
+		MD5(data[i], ln[i], md5[i]);
+}
+
+/**
+ * @brief Copy a buffer into the next slot of a batch (which must not be full)
+ *
+ * @param batch md5 batch
+ * @param data buffer
+ * @param ln buffer length
+ * @return copy of the buffer, followed by a NUL byte
+ */
+char *md5_batch_add(struct md5_batch *batch, char *data, uint64_t ln)
+{
+	int i = batch->count++;
+	if (ln + 1 > batch->slot_size[i])
+	{
+		free(batch->slot[i]);
+		batch->slot[i] = malloc(ln + 1);
+		if (!batch->slot[i])
+		{
+			fprintf(stderr, "Not memory available\n");
+			exit(EXIT_FAILURE);
+		}
+		batch->slot_size[i] = ln + 1;
+	}
+
+	memcpy(batch->slot[i], data, ln);
+	batch->slot[i][ln] = 0;
+	batch->data[i] = batch->slot[i];
+	batch->ln[i] = ln;
+	return batch->slot[i];
+}
+
+/**
+ * @brief Calculate the MD5 of the buffers in a batch into batch->md5. The caller empties the
+ * batch (count = 0) once the results are used
+ *
+ * @param batch md5 batch
+ */
+void md5_batch_run(struct md5_batch *batch)
+{
+	md5_mb((uint8_t **) batch->data, batch->ln, batch->md5, batch->count);
+}
+
+/**
+ * @brief Release the slots of a batch
+ *
+ * @param batch md5 batch
+ */
+void md5_batch_free(struct md5_batch *batch)
+{
+	for (int i = 0; i < MD5_MB_LANES; i++)
+		free(batch->slot[i]);
+	memset(batch, 0, sizeof(*batch));
+}
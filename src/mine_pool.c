@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mine_pool.c
+ *
+ * Multi-threaded mining of the files of a component
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mine_pool.c
+  * @date 18 Oct 2026
+  * @brief The component directory is walked by the calling thread, which queues the files
+  * found for a pool of workers. Each worker mines with its own copy of the job (file
+  * buffers and MD5s are private), while appends to the shared mined/ files are serialized:
+  * sources/ archives are locked by the first MD5 byte, and .csv files go through the sinks
+  * of sink.c. Lines within a sector may come out in a different order than with a single
+  * thread (import sorts them). Archives expanded
+  * in memory (see extract.c) queue the contents of their files along with the paths
+  */
+
+#include "minr.h"
+#include "mz_codec.h"
+#include "mine_pool.h"
+#include "md5_mb.h"
+#include "arena.h"
+
+pthread_mutex_t mine_csv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mine_sector_locks[FILE_FILES] = {[0 ... FILE_FILES - 1] = PTHREAD_MUTEX_INITIALIZER};
+
+/* Mining worker */
+struct mine_worker
+{
+	struct minr_job job;
+	struct mine_queue *queue;
+};
+
+/**
+ * @brief Lock the sources/ archives of a first MD5 byte
+ *
+ * @param sector first byte of the file MD5
+ */
+void mine_sector_lock(uint8_t sector)
+{
+	pthread_mutex_lock(&mine_sector_locks[sector]);
+}
+
+/**
+ * @brief Unlock the sources/ archives locked with mine_sector_lock
+ *
+ * @param sector first byte of the file MD5
+ */
+void mine_sector_unlock(uint8_t sector)
+{
+	pthread_mutex_unlock(&mine_sector_locks[sector]);
+}
+
+/**
+ * @brief Queue a file to be mined, waiting while the queue is full
+ *
+ * @param queue mining queue
+ * @param path file path (copied)
+ * @param data file contents (handed over to the worker), or NULL
+ * @param ln file size
+ */
+static void mine_queue_push(struct mine_queue *queue, char *path, char *data, uint64_t ln)
+{
+	char *copy = strdup(path);
+	uint64_t bytes = data ? ln : 0;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == MINE_QUEUE_SIZE || (queue->count && queue->bytes + bytes > MINE_QUEUE_BYTES))
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+
+	struct mine_item *item = &queue->items[(queue->head + queue->count) % MINE_QUEUE_SIZE];
+	item->path = copy;
+	item->data = data;
+	item->ln = ln;
+	queue->count++;
+	queue->bytes += bytes;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Take the next files to be mined (up to max), waiting while the queue is empty
+ *
+ * @param queue mining queue
+ * @param[out] items files to be mined
+ * @param max maximum number of files taken
+ * @return number of files taken, 0 when the traversal is finished and the queue is empty
+ */
+static int mine_queue_pop(struct mine_queue *queue, struct mine_item *items, int max)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->count && !queue->done)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+
+	int count = 0;
+	while (queue->count && count < max)
+	{
+		struct mine_item *item = &items[count++];
+		*item = queue->items[queue->head];
+		queue->head = (queue->head + 1) % MINE_QUEUE_SIZE;
+		queue->count--;
+		if (item->data)
+			queue->bytes -= item->ln;
+	}
+	if (count)
+		pthread_cond_broadcast(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return count;
+}
+
+/**
+ * @brief Read the wanted files of a batch and calculate the MD5 of all the contents at once
+ *
+ * @param job pointer to minr job
+ * @param items files to be mined
+ * @param count number of files
+ * @param[out] md5 MD5 of the files with contents
+ */
+static void mine_batch_hash(struct minr_job *job, struct mine_item *items, int count, uint8_t (*md5)[MD5_MB_DIGEST])
+{
+	uint8_t *data[MD5_MB_LANES];
+	uint64_t ln[MD5_MB_LANES];
+	uint8_t out[MD5_MB_LANES][MD5_MB_DIGEST];
+	int map[MD5_MB_LANES];
+	int n = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		/* Files discarded by name are never read (see mine_entry) */
+		if (!items[i].data && mine_wanted(job, items[i].path, UINT64_MAX))
+			items[i].data = load_contents(items[i].path, &items[i].ln);
+
+		if (items[i].data && items[i].ln)
+		{
+			data[n] = (uint8_t *) items[i].data;
+			ln[n] = items[i].ln;
+			map[n++] = i;
+		}
+	}
+
+	md5_mb(data, ln, out, n);
+	for (int i = 0; i < n; i++)
+		memcpy(md5[map[i]], out[i], MD5_MB_DIGEST);
+}
+
+/**
+ * @brief Worker thread mining queued files until the traversal is finished. Files are taken
+ * in batches of MD5_MB_LANES, so that their MD5 can be calculated together
+ *
+ * @param ptr pointer to the worker
+ * @return NULL
+ */
+static void *mine_worker(void *ptr)
+{
+	struct mine_worker *w = ptr;
+	struct mine_item items[MD5_MB_LANES];
+	uint8_t md5[MD5_MB_LANES][MD5_MB_DIGEST];
+	int count;
+
+	while ((count = mine_queue_pop(w->queue, items, MD5_MB_LANES)))
+	{
+		mine_batch_hash(&w->job, items, count, md5);
+		for (int i = 0; i < count; i++)
+		{
+			mine_entry(&w->job, items[i].path, items[i].data, items[i].ln, items[i].data && items[i].ln ? md5[i] : NULL);
+			free(items[i].path);
+		}
+	}
+
+	mz_codec_thread_free();
+	load_thread_free();
+	arena_thread_free();
+	return NULL;
+}
+
+/**
+ * @brief Mine a file, or queue it for the mining workers if mine_pool_start was called
+ *
+ * @param job pointer to minr job
+ * @param path file path
+ * @param data file contents followed by a NUL byte (freed once mined), or NULL to read path
+ * @param ln file size
+ */
+void mine_submit(struct minr_job *job, char *path, char *data, uint64_t ln)
+{
+	if (job->mine_queue)
+		mine_queue_push(job->mine_queue, path, data, ln);
+	else
+		mine_entry(job, path, data, ln, NULL);
+}
+
+/**
+ * @brief Start job->threads mining workers (if more than one), which take the files
+ * passed to mine_submit until mine_pool_stop is called
+ *
+ * @param job pointer to minr job
+ */
+void mine_pool_start(struct minr_job *job)
+{
+	if (job->threads < 2 || job->mine_queue)
+		return;
+
+	struct mine_queue *queue = calloc(1, sizeof(struct mine_queue));
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+
+	queue->threads = job->threads;
+	queue->workers = calloc(queue->threads, sizeof(struct mine_worker));
+	queue->tids = calloc(queue->threads, sizeof(pthread_t));
+
+	for (int t = 0; t < queue->threads; t++)
+	{
+		queue->workers[t].job = *job;
+		queue->workers[t].job.mine_queue = NULL;
+		queue->workers[t].queue = queue;
+		pthread_create(&queue->tids[t], NULL, mine_worker, &queue->workers[t]);
+	}
+
+	job->mine_queue = queue;
+}
+
+/**
+ * @brief Wait for the mining workers to mine all the queued files, and stop them
+ *
+ * @param job pointer to minr job
+ */
+void mine_pool_stop(struct minr_job *job)
+{
+	struct mine_queue *queue = job->mine_queue;
+	if (!queue)
+		return;
+	job->mine_queue = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->done = true;
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+
+	for (int t = 0; t < queue->threads; t++)
+		pthread_join(queue->tids[t], NULL);
+
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->tids);
+	free(queue->workers);
+	free(queue);
+}
+
+/**
+ * @brief Mine all the files under path. With job->threads > 1 the files found are
+ * mined by a pool of worker threads
+ *
+ * @param job pointer to minr job
+ * @param path root path
+ */
+void mine_tree(struct minr_job *job, char *path)
+{
+	mine_pool_start(job);
+	recurse(job, path);
+	mine_pool_stop(job);
+}
@@ -30,6 +30,9 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <zlib.h>
 #include "attributions.h"
 #include "file.h"
@@ -38,27 +41,47 @@
 #include "ignored_files.h"
 #include <ldb.h>
 #include "crypto.h"
+#include "content.h"
+#include "quality.h"
 #include "minr_log.h"
+#include "mz_codec.h"
+#include "mine_pool.h"
+#include "extract.h"
+#include "sink.h"
+#include "arena.h"
 
 /* Paths */
 char tmp_path[MAX_ARG_LEN] = "/dev/shm";
 int min_file_size = MIN_FILE_SIZE;
 
 /**
- * @brief Return true if data is binary
+ * @brief Return true if data is binary, with the offset of its first NUL byte already known
  *
  * @param data data buffer
  * @param len data size
+ * @param nul offset of the first NUL byte
  * @return true if it is binary
  */
-bool is_binary(char *data, long len)
+static bool is_binary_nul(char *data, long len, uint64_t nul)
 {
 	/* Is it a zip? */
 	if (*data == 'P' && data[1] == 'K' && data[2] < 9)
 		return true;
 		
 	/* Does it contain a chr(0)? */
-	return (len != strlen(data));
+	return (len != nul);
+}
+
+/**
+ * @brief Return true if data is binary
+ *
+ * @param data data buffer
+ * @param len data size
+ * @return true if it is binary
+ */
+bool is_binary(char *data, long len)
+{
+	return is_binary_nul(data, len, strlen(data));
 }
 
 /**
@@ -201,54 +224,231 @@ uint32_t download_file(struct minr_job *job)
 }
 
 /**
- * @brief Download and process URL
+ * @brief Download (or copy) the URL of a job into job->tmp_dir. The urlid is calculated
+ * when the file is expanded (see load_urlid and extract_open)
  *
  * @param job pointer to minr job
- * @return true if succed
+ * @return char* path to the downloaded file (to be expanded with download_expand), or NULL
  */
-bool download(struct minr_job *job)
+char *download_fetch(struct minr_job *job)
 {
 	/* Download file */
 	uint32_t response = download_file(job);
 	if (response)
-		return false;
+		return NULL;
 
 	/* Get the name of the downloaded file inside tmp_dir */
 	char *tmp_file = downloaded_file(job->tmp_dir);
 	if (!*tmp_file)
 	{
 		free(tmp_file);
-		return false;
+		return NULL;
 	}
 
 	if (file_size(tmp_file) < min_file_size)
 	{
 		printf("Retrieved file is under min_file_size. Ignoring URL\n");
 		free(tmp_file);
-		return false;
+		return NULL;
 	}
 
-	/* Get urlid */
-	load_urlid(job, tmp_file);
+	return tmp_file;
+}
 
-	/* Expand file */
-	char *unzipcommand = decompress(tmp_file);
+/* External extractors able to skip unwanted files (see download_exclusions) */
+struct exclude_tool
+{
+	char *extractor;    // start of the extraction command
+	char *list;         // command listing the archive files
+	char *path_prefix;  // listed lines carrying a file name start with this prefix (NULL for all lines)
+	bool flat;          // files are extracted without their directories
+};
 
-	/* Assemble directory change and unzip command */
-	if (*unzipcommand)
+static const struct exclude_tool EXCLUDE_TOOLS[] = {
+	{"tar ", "tar --quoting-style=literal -tf", NULL, false},
+	{"unzip ", "unzip -Z1", NULL, false},
+	{"7z ", "7z l -ba -slt", "Path = ", true},
+	{"unrar ", "unrar lb", NULL, false}};
+
+/**
+ * @brief List the files of an archive with its external extractor and collect those that
+ * mine() would discard by name, so that they are never written to disk. License files are
+ * always extracted (see mine_license_exec). unzip takes the names as arguments (up to
+ * DOWNLOAD_MAX_EXCLUDE bytes, names with wildcard characters are kept), the other tools
+ * read them from list_path
+ *
+ * @param job pointer to minr job
+ * @param tmp_file path to the downloaded file
+ * @param tool extractor
+ * @param list_path file to write the excluded names to
+ * @param[out] args unzip arguments excluding the names
+ * @return number of files excluded
+ */
+static int download_exclusions(struct minr_job *job, char *tmp_file, const struct exclude_tool *tool, char *list_path, char *args)
+{
+	char command[MAX_PATH_LEN] = "\0";
+	sprintf(command, "%s \"%s\" 2> /dev/null", tool->list, tmp_file);
+
+	FILE *in = popen(command, "r");
+	if (!in)
+		return 0;
+
+	bool unzip = !strcmp(tool->extractor, "unzip ");
+	FILE *out = unzip ? NULL : fopen(list_path, "w");
+	if (!unzip && !out)
+	{
+		pclose(in);
+		return 0;
+	}
+
+	/* Directory the archive is named after (see download_expand) */
+	char stem[MAX_PATH_LEN] = "\0";
+	strcpy(stem, basename(tmp_file));
+	char *ext = strrchr(stem, '.');
+	if (ext)
+		*ext = '\0';
+	int stem_ln = strlen(stem);
+	bool stem_found = false;
+
+	int excluded = 0;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t ln;
+
+	while ((ln = getline(&line, &len, in)) != -1)
 	{
-		char command[MAX_PATH_LEN] = "\0";
+		if (ln && line[ln - 1] == '\n')
+			line[--ln] = '\0';
+
+		char *name = line;
+		if (tool->path_prefix)
+		{
+			if (strncmp(line, tool->path_prefix, strlen(tool->path_prefix)))
+				continue;
+			name += strlen(tool->path_prefix);
+			if (!strcmp(name, tmp_file))
+				continue;
+		}
+
+		/* Directories are always created */
+		char *normalized = extract_normalize(name);
+		if (!normalized || normalized[strlen(normalized) - 1] == '/')
+			continue;
+
+		if (stem_ln && !strncmp(normalized, stem, stem_ln) && normalized[stem_ln] == '/')
+			stem_found = true;
+
+		char path[MAX_PATH_LEN] = "\0";
+		if (strlen(job->tmp_dir) + strlen(normalized) + 2 > MAX_PATH_LEN)
+			continue;
+		sprintf(path, "%s/%s", job->tmp_dir, tool->flat ? basename(normalized) : normalized);
+
+		if (mine_wanted(job, path, UINT64_MAX) || license_file_name(path))
+			continue;
 
-		/* cd into tmp */
-		sprintf(command, "cd %s", job->tmp_dir);
+		if (out)
+		{
+			fprintf(out, "%s\n", name);
+			excluded++;
+		}
+
+		/* unzip patterns are wildcards, names containing any are not excluded */
+		else if (!strpbrk(name, "*?[]\\'") && strlen(args) + strlen(name) + 4 < DOWNLOAD_MAX_EXCLUDE)
+		{
+			sprintf(args + strlen(args), " '%s'", name);
+			excluded++;
+		}
+	}
+
+	/* Files under the stem directory could all be excluded, it is still created */
+	if (stem_found)
+	{
+		char dir[MAX_PATH_LEN] = "\0";
+		strcpy(dir, job->tmp_dir);
+		strcat(dir, "/");
+		strncat(dir, stem, MAX_PATH_LEN - strlen(dir) - 1);
+		mkdir(dir, 0755);
+	}
+
+	free(line);
+	if (out)
+		fclose(out);
+	pclose(in);
+	return excluded;
+}
+
+/**
+ * @brief Assemble the command expanding a downloaded file. Unless every file is mined (-A),
+ * the files discarded by name are excluded from the expansion (see download_exclusions)
+ *
+ * @param job pointer to minr job
+ * @param tmp_file path to the downloaded file
+ * @param unzipcommand extraction command (see decompress)
+ * @param list_path file to write the excluded names to
+ * @return command to be executed (to be freed)
+ */
+static char *download_command(struct minr_job *job, char *tmp_file, char *unzipcommand, char *list_path)
+{
+	char *command = calloc(MAX_PATH_LEN + DOWNLOAD_MAX_EXCLUDE, 1);
+	char *args = calloc(DOWNLOAD_MAX_EXCLUDE, 1);
+	char excludes[MAX_PATH_LEN] = "\0";
 
-		/* add the unzip command */
+	const struct exclude_tool *tool = NULL;
+	for (int i = 0; i < sizeof(EXCLUDE_TOOLS) / sizeof(EXCLUDE_TOOLS[0]); i++)
+		if (!strncmp(unzipcommand, EXCLUDE_TOOLS[i].extractor, strlen(EXCLUDE_TOOLS[i].extractor)))
+			tool = &EXCLUDE_TOOLS[i];
+
+	if (tool && !job->mine_all && download_exclusions(job, tmp_file, tool, list_path, args))
+	{
+		if (!strcmp(tool->extractor, "tar "))
+			sprintf(excludes, " --anchored --no-wildcards --exclude-from=\"%s\"", list_path);
+		else if (!strcmp(tool->extractor, "unzip "))
+			sprintf(excludes, " -x");
+		else
+			sprintf(excludes, "%s -x@\"%s\"", strcmp(tool->extractor, "7z ") ? "" : " -spd", list_path);
+	}
+
+	/* cd into tmp */
+	sprintf(command, "cd %s", job->tmp_dir);
+
+	/* add the unzip command, with the exclusions (unrar takes them before the file) */
+	if (tool && !strcmp(tool->extractor, "unrar "))
+		sprintf(command + strlen(command), " ; %s%s ", unzipcommand, excludes);
+	else
 		sprintf(command + strlen(command), " ; %s ", unzipcommand);
 
-		/* add the downloaded file name */
-		sprintf(command + strlen(command), " \"%s\" > /dev/null", tmp_file);
+	/* add the downloaded file name */
+	sprintf(command + strlen(command), " \"%s\"", tmp_file);
+	if (tool && strcmp(tool->extractor, "unrar "))
+		sprintf(command + strlen(command), "%s%s", excludes, *excludes ? args : "");
+	strcat(command, " > /dev/null");
+
+	free(args);
+	return command;
+}
+
+/**
+ * @brief Expand a downloaded file into job->tmp_dir
+ *
+ * @param job pointer to minr job
+ * @param tmp_file path to the downloaded file (freed)
+ */
+void download_expand(struct minr_job *job, char *tmp_file)
+{
+	/* Expand file */
+	char *unzipcommand = decompress(tmp_file);
 
+	/* Assemble directory change and unzip command */
+	if (*unzipcommand)
+	{
+		char list_path[MAX_PATH_LEN] = "\0";
+		sprintf(list_path, "%s.exclude", tmp_file);
+
+		char *command = download_command(job, tmp_file, unzipcommand, list_path);
 		execute_command(command);
+		free(command);
+
+		unlink(list_path);
 		remove(tmp_file);
 	}
 
@@ -262,6 +462,23 @@ bool download(struct minr_job *job)
 	if (is_dir(tmp_file))
 		strcpy(job->tmp_dir, tmp_file);
 	free(tmp_file);
+}
+
+/**
+ * @brief Download and process URL
+ *
+ * @param job pointer to minr job
+ * @return true if succed
+ */
+bool download(struct minr_job *job)
+{
+	char *tmp_file = download_fetch(job);
+	if (!tmp_file)
+		return false;
+
+	/* Get urlid */
+	load_urlid(job, tmp_file);
+	download_expand(job, tmp_file);
 	return true;
 }
 
@@ -271,8 +488,90 @@ enum
 	FILE_ACCEPTED,
 };
 
+/* Contents of the files loaded by each thread: a buffer reused across files, or a mapping */
+static __thread char *load_buf = NULL;
+static __thread uint64_t load_buf_size = 0;
+static __thread char *load_map = NULL;
+static __thread uint64_t load_map_size = 0;
+
+/**
+ * @brief Returns the load buffer of the calling thread, grown to hold ln bytes plus two NULs
+ *
+ * @param ln data size
+ * @return buffer, or NULL if it cannot be grown
+ */
+static char *load_reserve(uint64_t ln)
+{
+	if (ln + 2 > load_buf_size)
+	{
+		char *buf = realloc(load_buf, ln + 2);
+		if (!buf)
+			return NULL;
+		load_buf = buf;
+		load_buf_size = ln + 2;
+	}
+	load_buf[ln] = 0;
+	load_buf[ln + 1] = 0;
+	return load_buf;
+}
+
+/**
+ * @brief Map a file copy-on-write, followed by NUL bytes. The tail of the last page is zeroed
+ * by the kernel, and an anonymous page is reserved behind files ending on a page boundary
+ *
+ * @param fd file descriptor
+ * @param ln file size
+ * @return mapped contents, or NULL
+ */
+static char *load_mmap(int fd, uint64_t ln)
+{
+	char *base = mmap(NULL, ln + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if (mmap(base, ln, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, ln + 2);
+		return NULL;
+	}
+
+	madvise(base, ln, MADV_SEQUENTIAL);
+	load_map = base;
+	load_map_size = ln + 2;
+	return base;
+}
+
 /**
- * @brief Open a file and fullyfil the minr job structure
+ * @brief Release the contents loaded into job->src by load_file or load_buffer
+ *
+ * @param job pointer to minr job
+ */
+void unload_file(struct minr_job *job)
+{
+	if (job->src && job->src == load_map)
+	{
+		munmap(load_map, load_map_size);
+		load_map = NULL;
+	}
+	else if (job->src != load_buf)
+		free(job->src);
+	job->src = NULL;
+}
+
+/**
+ * @brief Release the load buffer of the calling thread. Called by worker threads before they exit
+ */
+void load_thread_free(void)
+{
+	free(load_buf);
+	load_buf = NULL;
+	load_buf_size = 0;
+}
+
+/**
+ * @brief Open a file and fullyfil the minr job structure. The file is read once, into a
+ * buffer reused by the calling thread, or mapped from LOAD_MMAP_SIZE on. Its MD5 is calculated
+ * from memory. The contents are followed by a NUL byte and released with unload_file
  *
  * @param job pointer to minr job
  * @param path path to file
@@ -284,58 +583,70 @@ int load_file(struct minr_job *job, char *path)
 	int result = FILE_ACCEPTED;
 	/* Open file and obtain file length */
 	job->src_ln = 0;
-	FILE *fp;
-
-	if (!is_file(path))
-		return FILE_IGNORED;
+	job->src = NULL;
 
-	if ((fp = fopen(path, "rb")) == NULL)
+	/* The file is opened once: its type and size come from the descriptor */
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
 	{
 		minr_log("Failed to open the file %s", path);
 		return FILE_IGNORED;
 	}
 
-	fseeko64(fp, 0, SEEK_END);
-	job->src_ln = ftello64(fp);
-	fseeko64(fp, 0, SEEK_SET);
-
-	if (job->src_ln <= 0)
-		return FILE_IGNORED;
-	
-	job->src = calloc(job->src_ln + 2, 1);
-
-	if (!job->src)
+	struct stat st;
+	if (fstat(fd, &st) || !is_file_mode(path, st.st_mode) || st.st_size <= 0)
 	{
-		fprintf(stderr,"Not memory available to mine this file %s\n. File trunked to %d", path, MAX_FILE_SIZE);
-		job->src_ln = MAX_FILE_SIZE;
-		job->src = calloc(job->src_ln + 1, 1);
-		if (!job->src)
-		{
-			fprintf(stderr, "Not memory available\n");
-			exit(EXIT_FAILURE);
-		}
+		close(fd);
+		return FILE_IGNORED;
 	}
+	job->src_ln = st.st_size;
 
 	/* File discrimination check #3: Is it under/over the threshold */
 	if (job->src_ln < min_file_size)
 	{
 		result = FILE_IGNORED;
 	}
-		
-	if (!fread(job->src, 1, job->src_ln, fp))
+
+	/* Large files are mapped rather than copied */
+	uint64_t done = 0;
+	if (job->src_ln >= LOAD_MMAP_SIZE && (job->src = load_mmap(fd, job->src_ln)))
+		done = job->src_ln;
+
+	else
 	{
-		fclose(fp);
-		return result;
+		job->src = load_reserve(job->src_ln);
+		if (!job->src)
+		{
+			fprintf(stderr,"Not memory available to mine this file %s\n. File trunked to %d", path, MAX_FILE_SIZE);
+			job->src_ln = MAX_FILE_SIZE;
+			job->src = load_reserve(job->src_ln);
+			if (!job->src)
+			{
+				fprintf(stderr, "Not memory available\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		/* Read file contents into src */
+		while (done < job->src_ln)
+		{
+			ssize_t r = read(fd, job->src + done, job->src_ln - done);
+			if (r <= 0)
+				break;
+			done += r;
+		}
 	}
+	close(fd);
 
-	/* Read file contents into src and close it */
+	if (!done)
+		return FILE_IGNORED;
+
+	/* A file that shrank while being read is mined as read */
+	job->src_ln = done;
 	job->src[job->src_ln] = 0;
-	fclose(fp);
 
 	/* Calculate file MD5 */
-	uint8_t * md5 = md5_file(path);
-	memcpy(job->md5, md5, sizeof(job->md5));
-	free(md5);
+	MD5((uint8_t *) job->src, job->src_ln, job->md5);
 	ldb_bin_to_hex(job->md5, MD5_LEN, job->fileid);
 
 	if (ignored_file(job->fileid))
@@ -346,6 +657,129 @@ int load_file(struct minr_job *job, char *path)
 	return result;
 }
 
+/**
+ * @brief Fullfil the minr job structure with file contents already in memory (see extract.c)
+ *
+ * @param job pointer to minr job
+ * @param data file contents, followed by a NUL byte
+ * @param ln file size
+ * @param copy true to load a copy of data (into the load buffer), false to take ownership of it
+ * @param md5 MD5 of data if already calculated (see md5_mb), or NULL
+ * @return FILE_IGNORED
+ * @return FILE_ACCEPTED
+ */
+int load_buffer(struct minr_job *job, char *data, uint64_t ln, bool copy, uint8_t *md5)
+{
+	job->src = NULL;
+	job->src_ln = ln;
+	if (!ln)
+	{
+		if (!copy)
+			free(data);
+		return FILE_IGNORED;
+	}
+
+	if (copy)
+	{
+		job->src = load_reserve(ln);
+		if (!job->src)
+		{
+			fprintf(stderr, "Not memory available\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(job->src, data, ln);
+	}
+	else
+		job->src = data;
+
+	/* Calculate file MD5 */
+	if (md5)
+		memcpy(job->md5, md5, MD5_LEN);
+	else
+		MD5((uint8_t *) job->src, ln, job->md5);
+	ldb_bin_to_hex(job->md5, MD5_LEN, job->fileid);
+
+	if (ignored_file(job->fileid))
+		return FILE_IGNORED;
+
+	/* File discrimination check #3: Is it under/over the threshold */
+	return ln < min_file_size ? FILE_IGNORED : FILE_ACCEPTED;
+}
+
+/**
+ * @brief Read a file below LOAD_MMAP_SIZE into a new buffer, so that it can be hashed along
+ * with others (see mine_pool.c). Files that load_file would not read are left out
+ *
+ * @param path path to file
+ * @param[out] ln file size
+ * @return file contents followed by a NUL byte (to be freed), or NULL
+ */
+char *load_contents(char *path, uint64_t *ln)
+{
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) || !is_file_mode(path, st.st_mode) || st.st_size <= 0 || st.st_size >= LOAD_MMAP_SIZE)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	char *data = malloc(st.st_size + 2);
+	uint64_t done = 0;
+	while (data && done < st.st_size)
+	{
+		ssize_t r = read(fd, data + done, st.st_size - done);
+		if (r <= 0)
+			break;
+		done += r;
+	}
+	close(fd);
+
+	if (data && !done)
+	{
+		free(data);
+		return NULL;
+	}
+
+	if (data)
+	{
+		data[done] = 0;
+		data[done + 1] = 0;
+	}
+	*ln = done;
+	return data;
+}
+
+/**
+ * @brief Returns false for files that mine() would discard without looking at their contents,
+ * so archive entries can be skipped before they are decompressed
+ *
+ * @param job pointer to minr job
+ * @param path file path
+ * @param size file size
+ * @return true if the file has to be loaded
+ */
+bool mine_wanted(struct minr_job *job, char *path, uint64_t size)
+{
+	if (!size)
+		return false;
+
+	/* Discarded files go to the extra tables */
+	if (job->mine_all || is_attribution_notice(path))
+		return true;
+
+	if (!job->all_extensions && ignored_extension(path))
+		return false;
+
+	if (unwanted_path(path))
+		return false;
+
+	return size >= min_file_size;
+}
+
 /**
  * @brief Extracts the "n"th value from the comma separated "in" string
  *
@@ -390,20 +824,40 @@ void extract_csv(char *out, char *in, int n, long limit)
  * @param path path to be mined
  */
 void mine(struct minr_job *job, char *path)
+{
+	mine_entry(job, path, NULL, 0, NULL);
+}
+
+/**
+ * @brief Mine a file, read from path or already in memory
+ *
+ * @param job ponter to minr job
+ * @param path path to be mined (for archive entries, the path they would be extracted to)
+ * @param data file contents followed by a NUL byte (freed here), or NULL to read path
+ * @param ln file size
+ * @param md5 MD5 of data if already calculated, or NULL
+ */
+void mine_entry(struct minr_job *job, char *path, char *data, uint64_t ln, uint8_t *md5)
 {
 	bool extra_table = false;
 	bool exclude_detection = job->exclude_detection;
 
+	/* Scratch memory of the previous file is no longer used */
+	arena_reset();
+
 	/* Mine attribution notice */
 	job->is_attribution_notice = is_attribution_notice(path);
 	if (job->is_attribution_notice)
 	{
-		mine_attribution_notice(job, path);
+		mine_attribution_notice(job, path, data, ln);
 		minr_log("file %s processed as attribution notice\n", path);
 		if (job->mine_all)
 				extra_table = true;
 		else
+		{
+			free(data);
 			return;
+		}
 	}
 	/* File discrimination check #2: Is the extension ignored or path not wanted? */
 	if (!job->all_extensions)
@@ -413,7 +867,10 @@ void mine(struct minr_job *job, char *path)
 			if (job->mine_all)
 				extra_table = true;
 			else
+			{
+				free(data);
 				return;
+			}
 		}
 
 
@@ -423,15 +880,20 @@ void mine(struct minr_job *job, char *path)
 		if (job->mine_all)
 			extra_table = true;
 		else
+		{
+			free(data);
 			return;
+		}
 	}
 	/* Load file contents and calculate md5 */
-	int result = load_file(job, path);
+	int result = data ? load_buffer(job, data, ln, false, md5) : load_file(job, path);
 	if (result == FILE_IGNORED)
 	{
 		minr_log("Ignoring empty file %s\n", path);
 		if (job->src_ln <= 0 || !job->mine_all)
 		{
+			/* Loaded contents are not used */
+			unload_file(job);
 			return;
 		}
 		else
@@ -442,20 +904,26 @@ void mine(struct minr_job *job, char *path)
 	if (comma)
 		*comma = '-';
 
+	/* Single pass over the contents for the binary check, quality and crypto */
+	struct content_stats stats = {0};
+	if (job->src && (!job->exclude_mz || !exclude_detection))
+		content_scan(&stats, job->src, job->src_ln, true);
+
 	/* Add to .mz */
 	if (!job->exclude_mz)
 	{
 		/* File discrimination check: Binary? */
-		if (is_binary(job->src, job->src_ln))
+		if (is_binary_nul(job->src, job->src_ln, stats.nul))
 		{
 			exclude_detection = true;
 			minr_log("Binary detected, excluded from sources\n");
 		}
-		else if ((job->zsrc = calloc(compressBound(job->src_ln +1) + MZ_HEAD, 1)) != NULL && job->src_ln > 0 && job->src)
+		else if ((job->zsrc = arena_alloc(mz_record_bound(job->src_ln) + MZ_HEAD)) != NULL && job->src_ln > 0 && job->src)
 		{
+			mine_sector_lock(*job->md5);
 			if (extra_table)
 			{	
-				mz_add(job->mined_extra_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache_extra);
+				mz_codec_add(job->mined_extra_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache_extra);
 			}
 			else
 			{
@@ -470,16 +938,16 @@ void mine(struct minr_job *job, char *path)
 						
 				if (!skip)
 				{
-					mz_add(job->mined_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache);
+					mz_codec_add(job->mined_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache);
 				}
 				else if (job->mine_all)
 				{
 					minr_log("Por las dudas %s\n", path);
 					extra_table = true;
-					mz_add(job->mined_extra_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache_extra);
+					mz_codec_add(job->mined_extra_path, job->md5, job->src, job->src_ln, true, job->zsrc, job->mz_cache_extra);
 				}
 			}
-			free(job->zsrc);
+			mine_sector_unlock(*job->md5);
 		}
 		else
 		{
@@ -490,10 +958,11 @@ void mine(struct minr_job *job, char *path)
 	/* Mine more */
 	if (!exclude_detection && job->src)
 	{
-		mine_crypto(job->mined_path, job->fileid, job->src, job->src_ln);
+		mine_crypto_scanned(job->out_crypto, job->fileid, &stats, job->src, job->src_ln);
 		mine_license(job, job->fileid, false);
-		mine_quality(job->mined_path, job->fileid, job->src, job->src_ln);
-		mine_copyright(job->mined_path, job->fileid, job->src, job->src_ln, false);
+		content_header_cut(&stats, job->src, job->src_ln);
+		mine_quality_scanned(job->out_quality, job->fileid, &stats, job->src_ln);
+		mine_copyright(job->out_copyright, job->fileid, job->src, job->src_ln, false);
 	}
 
 	/* Output file information */
@@ -501,24 +970,22 @@ void mine(struct minr_job *job, char *path)
 	if (extra_table)
 	{
 		minr_log("File %s proceesed as \"Extra\"\n", path);
-		fprintf(job->out_file_extra[*job->md5], "%s,%s,%s\n", job->fileid + 2, job->urlid, path + strlen(job->tmp_dir) + 1);
-		fflush(job->out_file_extra[*job->md5]);
+		sink_printf(job->out_file_extra[*job->md5], "%s,%s,%s\n", job->fileid + 2, job->urlid, path + strlen(job->tmp_dir) + 1);
 		if (job->out_pivot_extra)
-			fprintf(job->out_pivot_extra, "%s,%s\n", job->urlid + 2, job->fileid);
+			sink_printf(job->out_pivot_extra, "%s,%s\n", job->urlid + 2, job->fileid);
 	}
 	else
 	{
 		minr_log("File %s accepted\n", path);
 		uint8_t url_md5_byte;
 		ldb_hex_to_bin(job->urlid, 2, &url_md5_byte);
-		fprintf(job->out_file[*job->md5], "%s,%s,%s\n", job->fileid + 2, job->urlid, path + strlen(job->tmp_dir) + 1);
-		fflush(job->out_file[*job->md5]);
+		sink_printf(job->out_file[*job->md5], "%s,%s,%s\n", job->fileid + 2, job->urlid, path + strlen(job->tmp_dir) + 1);
 		ldb_hex_to_bin(job->urlid, 2, &url_md5_byte);
 		if (job->out_pivot)
-			fprintf(job->out_pivot, "%s,%s\n", job->urlid + 2, job->fileid);
+			sink_printf(job->out_pivot, "%s,%s\n", job->urlid + 2, job->fileid);
 	}
 
-	free(job->src);
+	unload_file(job);
 }
 
 /**
@@ -531,6 +998,7 @@ void mine_local_file(struct minr_job *job, char *path)
 {
 	//job->src = calloc(MAX_FILE_SIZE + 1, 1);
 	bool skip = false;
+	arena_reset();
 
 	/* Load file contents and calculate md5 */
 	if (!load_file(job, path))
@@ -573,8 +1041,13 @@ void mine_local_file(struct minr_job *job, char *path)
 			break;
 		}
 	}
-	free(job->src);
-	job->src = NULL;
+	unload_file(job);
+}
+
+/* File found by mine_local_directory() */
+static void mine_local_found(void *ptr, char *path)
+{
+	mine_local_file((struct minr_job *) ptr, path);
 }
 
 /**
@@ -587,31 +1060,15 @@ void mine_local_file(struct minr_job *job, char *path)
  */
 void mine_local_directory(struct minr_job *job, char *root)
 {
+	walk_tree(root, mine_local_found, job);
+}
 
-	DIR *dir;
-	struct dirent *entry;
-
-	if (!(dir = opendir(root)))
-		return;
-
-	while ((entry = readdir(dir)) != NULL)
-	{
-		char path[1024];
-		if (entry->d_type == DT_DIR)
-		{
-
-			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-				continue;
-			snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
-			mine_local_directory(job, path);
-		}
-		else
-		{
-			sprintf(path, "%s/%s", root, entry->d_name);
-			mine_local_file(job, path);
-		}
-	}
-	closedir(dir);
+/* File found by recurse(), to be mined (mine_entry may modify the path) */
+static void recurse_found(void *ptr, char *path)
+{
+	char file[MAX_PATH_LEN];
+	strcpy(file, path);
+	mine_submit((struct minr_job *) ptr, file, NULL, 0);
 }
 
 /**
@@ -622,32 +1079,7 @@ void mine_local_directory(struct minr_job *job, char *root)
  */
 void recurse(struct minr_job *job, char *path)
 {
-	DIR *dp;
-	struct dirent *entry;
-
-	if (!(dp = opendir(path)))
-		return;
-
-	while ((entry = readdir(dp)))
-	{
-		if (valid_path(path, entry->d_name))
-		{
-			/* Assemble path */
-			char tmp_path[MAX_PATH_LEN] = "\0";
-			sprintf(tmp_path, "%s/%s", path, entry->d_name);
-
-			/* Recurse if dir */
-			if (entry->d_type == DT_DIR && not_a_dot(entry->d_name))
-				recurse(job, tmp_path);
-
-			/* File discrimination check #1: Is this an actual file? */
-			else if (is_file(tmp_path))
-				mine(job, tmp_path);
-		}
-	}
-
-	if (dp)
-		closedir(dp);
+	walk_tree(path, recurse_found, job);
 }
 
 /**
@@ -0,0 +1,822 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mz_codec.c
+ *
+ * mz record compression codecs
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mz_codec.c
+  * @date 18 Oct 2026
+  * @brief mz records are compressed with zlib by default. Builds with ZSTD=1 can also
+  * write zstd records, optionally with trained dictionaries. Both kinds of records can
+  * live in the same archive: zstd records are recognised by their frame magic number
+  * and name their dictionary by id, so reading is transparent
+  */
+
+#include <pthread.h>
+#include <zlib.h>
+#ifdef MZ_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "minr.h"
+#include <ldb.h>
+#include "hex.h"
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_codec.h"
+
+/* Codec used to write new records */
+static mz_codec_t mz_codec = MZ_CODEC_ZLIB;
+static int mz_level = MZ_ZSTD_LEVEL;
+
+#ifdef MZ_ZSTD
+/* Loaded dictionaries. The first one is used to write new records */
+struct mz_dict
+{
+	unsigned id;
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict;
+};
+
+static struct mz_dict mz_dicts[MZ_DICT_MAX];
+static int mz_dict_count = 0;
+
+/* zstd contexts are reused by each thread */
+static __thread ZSTD_CCtx *mz_cctx = NULL;
+static __thread ZSTD_DCtx *mz_dctx = NULL;
+#endif
+
+/* Inflate state reused by each thread: a zlib stream and a buffer grown as needed */
+static __thread z_stream *mz_zstream = NULL;
+static __thread char *mz_buffer = NULL;
+static __thread uint64_t mz_buffer_size = 0;
+
+/**
+ * @brief Select the codec used to write new records
+ *
+ * @param name codec name (zlib or zstd)
+ * @return false if the codec is not supported
+ */
+bool mz_codec_set(char *name)
+{
+	if (!strcmp(name, "zlib"))
+	{
+		mz_codec = MZ_CODEC_ZLIB;
+		return true;
+	}
+
+	if (!strcmp(name, "zstd"))
+	{
+#ifdef MZ_ZSTD
+		mz_codec = MZ_CODEC_ZSTD;
+		return true;
+#else
+		printf("zstd support requires building with ZSTD=1\n");
+		return false;
+#endif
+	}
+
+	printf("Unsupported codec: %s\n", name);
+	return false;
+}
+
+/**
+ * @brief Set the zstd compression level. Dictionaries take the level in use when they are loaded
+ *
+ * @param level compression level
+ */
+void mz_codec_level(int level)
+{
+	mz_level = level;
+}
+
+/**
+ * @brief Load a zstd dictionary (see mz_dict_train)
+ *
+ * @param path dictionary path
+ * @return false if it cannot be loaded
+ */
+bool mz_dict_load(char *path)
+{
+#ifdef MZ_ZSTD
+	if (mz_dict_count == MZ_DICT_MAX)
+	{
+		printf("Too many dictionaries\n");
+		return false;
+	}
+
+	if (!is_file(path))
+	{
+		printf("Cannot open %s\n", path);
+		return false;
+	}
+
+	uint64_t dict_ln = 0;
+	uint8_t *dict = file_read(path, &dict_ln);
+	unsigned id = ZSTD_getDictID_fromDict(dict, dict_ln);
+	if (!id)
+	{
+		printf("%s is not a zstd dictionary\n", path);
+		free(dict);
+		return false;
+	}
+
+	struct mz_dict *d = &mz_dicts[mz_dict_count++];
+	d->id = id;
+	d->cdict = ZSTD_createCDict(dict, dict_ln, mz_level);
+	d->ddict = ZSTD_createDDict(dict, dict_ln);
+	free(dict);
+
+	return d->cdict && d->ddict;
+#else
+	printf("zstd dictionaries require building with ZSTD=1\n");
+	return false;
+#endif
+}
+
+void mz_codec_free(void)
+{
+#ifdef MZ_ZSTD
+	for (int i = 0; i < mz_dict_count; i++)
+	{
+		ZSTD_freeCDict(mz_dicts[i].cdict);
+		ZSTD_freeDDict(mz_dicts[i].ddict);
+	}
+	mz_dict_count = 0;
+#endif
+}
+
+/**
+ * @brief Maximum compressed size of a file, for any codec (without the record header)
+ *
+ * @param src_ln file size
+ * @return bound
+ */
+uint64_t mz_record_bound(uint64_t src_ln)
+{
+	uint64_t bound = compressBound(src_ln + 1);
+#ifdef MZ_ZSTD
+	uint64_t zstd_bound = ZSTD_compressBound(src_ln + 1);
+	if (zstd_bound > bound)
+		bound = zstd_bound;
+#endif
+	return bound;
+}
+
+/**
+ * @brief Compress a file into an mz record with the selected codec. As with mz_add(),
+ * the trailing zero is stored too
+ *
+ * @param id MZ_MD5-byte record id
+ * @param src file contents
+ * @param src_ln file size
+ * @param out output buffer, MZ_HEAD + mz_record_bound(src_ln) bytes
+ * @return record length (header included), 0 on error
+ */
+uint64_t mz_record_compress(uint8_t *id, char *src, uint64_t src_ln, uint8_t *out)
+{
+	uLongf zdata_ln = mz_record_bound(src_ln);
+
+#ifdef MZ_ZSTD
+	if (mz_codec == MZ_CODEC_ZSTD)
+	{
+		if (!mz_cctx)
+			mz_cctx = ZSTD_createCCtx();
+
+		size_t ln;
+		if (mz_dict_count)
+			ln = ZSTD_compress_usingCDict(mz_cctx, out + MZ_HEAD, zdata_ln, src, src_ln + 1, mz_dicts[0].cdict);
+		else
+			ln = ZSTD_compressCCtx(mz_cctx, out + MZ_HEAD, zdata_ln, src, src_ln + 1, mz_level);
+
+		if (ZSTD_isError(ln))
+			return 0;
+		zdata_ln = ln;
+	}
+	else
+#endif
+	if (Z_OK != compress(out + MZ_HEAD, &zdata_ln, (uint8_t *) src, src_ln + 1))
+		return 0;
+
+	uint32_t zln = zdata_ln;
+	memcpy(out, id, MZ_MD5);
+	memcpy(out + MZ_MD5, &zln, MZ_SIZE);
+	return MZ_HEAD + (uint64_t) zdata_ln;
+}
+
+/**
+ * @brief Make sure the thread inflate buffer holds at least ln bytes, growing it geometrically
+ *
+ * @param ln required size (capped at MZ_MAX_FILE + 1)
+ * @return buffer size
+ */
+static uint64_t mz_buffer_reserve(uint64_t ln)
+{
+	if (ln > MZ_MAX_FILE + 1)
+		ln = MZ_MAX_FILE + 1;
+	if (ln <= mz_buffer_size)
+		return mz_buffer_size;
+
+	uint64_t size = mz_buffer_size ? mz_buffer_size : MZ_INFLATE_MIN_LN;
+	while (size < ln)
+		size *= 2;
+	if (size > MZ_MAX_FILE + 1)
+		size = MZ_MAX_FILE + 1;
+
+	mz_buffer = realloc(mz_buffer, size);
+	mz_buffer_size = size;
+	return size;
+}
+
+/**
+ * @brief Decompress a zlib record with the thread z_stream, reset for every record.
+ * When data points to the thread buffer, it grows as needed
+ *
+ * @param zdata compressed data
+ * @param zdata_ln compressed length
+ * @param data output buffer
+ * @param size output buffer size
+ * @param[out] data_ln decompressed length
+ * @return false if the record cannot be decompressed into MZ_MAX_FILE + 1 bytes
+ */
+static bool mz_zlib_inflate(uint8_t *zdata, uint32_t zdata_ln, char **data, uint64_t size, uint64_t *data_ln)
+{
+	if (!mz_zstream)
+	{
+		mz_zstream = calloc(1, sizeof(z_stream));
+		if (inflateInit(mz_zstream) != Z_OK)
+		{
+			printf("Cannot initialise zlib\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else
+		inflateReset(mz_zstream);
+
+	bool grow = (*data == mz_buffer);
+	mz_zstream->next_in = zdata;
+	mz_zstream->avail_in = zdata_ln;
+	uint64_t out = 0;
+
+	while (true)
+	{
+		mz_zstream->next_out = (uint8_t *) *data + out;
+		mz_zstream->avail_out = size - out;
+
+		int ret = inflate(mz_zstream, Z_FINISH);
+		out = size - mz_zstream->avail_out;
+
+		if (ret == Z_STREAM_END)
+			break;
+
+		/* Only a full output buffer is worth another round */
+		if (ret != Z_BUF_ERROR || mz_zstream->avail_out || !grow || size == MZ_MAX_FILE + 1)
+			return false;
+
+		size = mz_buffer_reserve(2 * size);
+		*data = mz_buffer;
+	}
+
+	*data_ln = out;
+	return true;
+}
+
+/**
+ * @brief Decompress an mz record, whatever its codec
+ *
+ * @param zdata compressed data
+ * @param zdata_ln compressed length
+ * @param data output buffer (the thread buffer grows as needed)
+ * @param size output buffer size
+ * @param[out] data_ln decompressed length, trailing zero included
+ * @return false if the record cannot be decompressed
+ */
+static bool mz_inflate(uint8_t *zdata, uint32_t zdata_ln, char **data, uint64_t size, uint64_t *data_ln)
+{
+	if (zdata_ln >= 4 && !memcmp(zdata, MZ_ZSTD_MAGIC, 4))
+	{
+#ifdef MZ_ZSTD
+		if (!mz_dctx)
+			mz_dctx = ZSTD_createDCtx();
+
+		/* Frames written by mz_record_compress() carry their content size */
+		if (*data == mz_buffer)
+		{
+			unsigned long long content_ln = ZSTD_getFrameContentSize(zdata, zdata_ln);
+			if (content_ln == ZSTD_CONTENTSIZE_UNKNOWN || content_ln == ZSTD_CONTENTSIZE_ERROR)
+				content_ln = MZ_MAX_FILE + 1;
+			size = mz_buffer_reserve(content_ln);
+			*data = mz_buffer;
+		}
+
+		size_t ln;
+		unsigned dict_id = ZSTD_getDictID_fromFrame(zdata, zdata_ln);
+		if (dict_id)
+		{
+			ZSTD_DDict *ddict = NULL;
+			for (int i = 0; i < mz_dict_count; i++)
+				if (mz_dicts[i].id == dict_id)
+					ddict = mz_dicts[i].ddict;
+
+			if (!ddict)
+			{
+				static bool warned = false;
+				if (!warned)
+					printf("[MISSING_DICTIONARY] %u (see --dict)\n", dict_id);
+				warned = true;
+				return false;
+			}
+			ln = ZSTD_decompress_usingDDict(mz_dctx, *data, size, zdata, zdata_ln, ddict);
+		}
+		else
+			ln = ZSTD_decompressDCtx(mz_dctx, *data, size, zdata, zdata_ln);
+
+		if (ZSTD_isError(ln))
+			return false;
+		*data_ln = ln;
+		return true;
+#else
+		static bool warned = false;
+		if (!warned)
+			printf("zstd records found, reading them requires building with ZSTD=1\n");
+		warned = true;
+		return false;
+#endif
+	}
+
+	/* zlib output is about four times its input */
+	if (*data == mz_buffer)
+	{
+		size = mz_buffer_reserve(4 * (uint64_t) zdata_ln);
+		*data = mz_buffer;
+	}
+	return mz_zlib_inflate(zdata, zdata_ln, data, size, data_ln);
+}
+
+/**
+ * @brief Decompress an mz record, whatever its codec. The stored trailing zero
+ * is not counted in the returned length
+ *
+ * @param zdata compressed data
+ * @param zdata_ln compressed length
+ * @param data output buffer
+ * @param[in,out] data_ln output buffer size (MZ_MAX_FILE + 1), then file length
+ * @return false if the record cannot be decompressed
+ */
+bool mz_record_inflate(uint8_t *zdata, uint32_t zdata_ln, char *data, uint64_t *data_ln)
+{
+	uint64_t size = *data_ln;
+	if (!mz_inflate(zdata, zdata_ln, &data, size, data_ln) || !*data_ln)
+		return false;
+
+	/* Stored data includes a trailing zero */
+	(*data_ln)--;
+	data[*data_ln] = 0;
+	return true;
+}
+
+/**
+ * @brief Decompress an mz record into the inflate buffer of the calling thread,
+ * which is reused (and grown as needed) by every call, avoiding an allocation per record
+ *
+ * @param zdata compressed data
+ * @param zdata_ln compressed length
+ * @param[out] data_ln file length (without the stored trailing zero)
+ * @return file contents, valid until the next call from the same thread. NULL on error
+ */
+char *mz_inflate_buffer(uint8_t *zdata, uint32_t zdata_ln, uint64_t *data_ln)
+{
+	mz_buffer_reserve(MZ_INFLATE_MIN_LN);
+	char *data = mz_buffer;
+	if (!mz_inflate(zdata, zdata_ln, &data, mz_buffer_size, data_ln) || !*data_ln)
+		return NULL;
+
+	(*data_ln)--;
+	data[*data_ln] = 0;
+	return data;
+}
+
+/**
+ * @brief Release the inflate state of the calling thread (buffer, z_stream and zstd contexts).
+ * Called by worker threads before they exit
+ */
+void mz_codec_thread_free(void)
+{
+	free(mz_buffer);
+	mz_buffer = NULL;
+	mz_buffer_size = 0;
+
+	if (mz_zstream)
+	{
+		inflateEnd(mz_zstream);
+		free(mz_zstream);
+		mz_zstream = NULL;
+	}
+
+#ifdef MZ_ZSTD
+	ZSTD_freeCCtx(mz_cctx);
+	ZSTD_freeDCtx(mz_dctx);
+	mz_cctx = NULL;
+	mz_dctx = NULL;
+#endif
+}
+
+/**
+ * @brief Decompress the current record of an mz_parse() walk into job->data,
+ * as mz_deflate() does for zlib records. job->data is the thread inflate buffer,
+ * so it must not be freed
+ *
+ * @param job pointer to mz job
+ */
+void mz_job_inflate(struct mz_job *job)
+{
+	job->data = mz_inflate_buffer(job->zdata, job->zdata_ln, &job->data_ln);
+	if (!job->data)
+	{
+		printf("[CORRUPTED]\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Append a cached sector to mined_path/sources/NNNN.mz
+ */
+static void mz_cache_write(char *mined_path, int mzid, uint8_t *data, uint64_t ln)
+{
+	char path[LDB_MAX_PATH * 2];
+	sprintf(path, "%s/sources", mined_path);
+	ldb_prepare_dir(path);
+
+	sprintf(path, "%s/sources/%04x.mz", mined_path, mzid);
+	FILE *f = fopen(path, "a");
+	if (!f || fwrite(data, ln, 1, f) != 1)
+	{
+		printf("Error writing %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(f);
+}
+
+static bool mz_cache_id_handler(struct mz_record *record, void *ptr)
+{
+	uint8_t **id = ptr;
+	if (!memcmp(record->id, *id, MZ_MD5))
+	{
+		*id = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Add a file to the mz cache, as mz_add() does, compressing it with the selected codec.
+ * Cached records are written by mz_flush()
+ *
+ * @param mined_path mined/ directory
+ * @param md5 file MD5
+ * @param src file contents
+ * @param src_ln file size
+ * @param check true to skip files already in the cache
+ * @param zsrc compression buffer, MZ_HEAD + mz_record_bound(src_ln) bytes
+ * @param mz_cache mz cache
+ */
+void mz_codec_add(char *mined_path, uint8_t *md5, char *src, int src_ln, bool check, uint8_t *zsrc, struct mz_cache_item *mz_cache)
+{
+	if (mz_codec == MZ_CODEC_ZLIB)
+	{
+		mz_add(mined_path, md5, src, src_ln, check, zsrc, mz_cache);
+		return;
+	}
+
+	int mzid = uint16(md5);
+	struct mz_cache_item *item = &mz_cache[mzid];
+
+	if (check)
+	{
+		uint8_t *id = md5 + 2;
+		mz_walk(item->data, item->length, mz_cache_id_handler, &id);
+		if (!id)
+			return;
+	}
+
+	uint64_t mzlen = mz_record_compress(md5 + 2, src, src_ln, zsrc);
+	if (!mzlen)
+	{
+		printf("Cannot compress file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (item->length && item->length + mzlen > MZ_CACHE_SIZE)
+	{
+		mz_cache_write(mined_path, mzid, item->data, item->length);
+		item->length = 0;
+	}
+
+	if (mzlen > MZ_CACHE_SIZE)
+		mz_cache_write(mined_path, mzid, zsrc, mzlen);
+	else
+	{
+		memcpy(item->data + item->length, zsrc, mzlen);
+		item->length += mzlen;
+	}
+}
+
+#ifdef MZ_ZSTD
+/* Samples collected to train a dictionary */
+struct mz_dict_samples
+{
+	uint8_t *samples;
+	uint64_t samples_ln;
+	uint64_t quota;     // bytes left for the current archive
+	size_t *sizes;
+	unsigned count;
+};
+
+static bool mz_dict_sample_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_dict_samples *s = ptr;
+
+	uint64_t data_ln = 0;
+	char *data = mz_inflate_buffer(record->zdata, record->zdata_ln, &data_ln);
+	if (!data)
+		return true;
+
+	if (data_ln > MZ_DICT_SAMPLE_LN)
+		data_ln = MZ_DICT_SAMPLE_LN;
+	if (data_ln > s->quota)
+		return false;
+
+	memcpy(s->samples + s->samples_ln, data, data_ln);
+	s->samples_ln += data_ln;
+	s->quota -= data_ln;
+	s->sizes = realloc(s->sizes, (s->count + 1) * sizeof(size_t));
+	s->sizes[s->count++] = data_ln;
+	return true;
+}
+#endif
+
+/**
+ * @brief Train a zstd dictionary from a sample of the files in an mz archive, or in a
+ * directory of archives (up to 256 archives are sampled, evenly spread)
+ *
+ * @param path mz file or directory
+ * @param dict_path output dictionary
+ * @return false on error
+ */
+bool mz_dict_train(char *path, char *dict_path)
+{
+#ifdef MZ_ZSTD
+	char **names = NULL;
+	int count = 0;
+	char *dir = NULL;
+	if (is_dir(path))
+	{
+		dir = path;
+		names = mz_dir_list(path, &count);
+	}
+	else
+	{
+		names = malloc(sizeof(char *));
+		names[count++] = strdup(path);
+	}
+
+	int step = count / 256 + 1;
+	int sampled = (count + step - 1) / step;
+
+	struct mz_dict_samples s;
+	memset(&s, 0, sizeof(s));
+	s.samples = malloc(MZ_DICT_SAMPLES_LN);
+
+	char mz_path[MAX_PATH_LEN + 16] = "\0";
+	for (int i = 0; i < count; i += step)
+	{
+		if (dir)
+			sprintf(mz_path, "%s/%s", dir, names[i]);
+		else
+			strcpy(mz_path, names[i]);
+
+		uint64_t mz_ln = 0;
+		uint8_t *mz = mz_map(mz_path, &mz_ln);
+		s.quota = MZ_DICT_SAMPLES_LN / sampled;
+		if (mz)
+			mz_walk(mz, mz_ln, mz_dict_sample_handler, &s);
+		mz_unmap(mz, mz_ln);
+	}
+
+	bool ok = false;
+	uint8_t *dict = malloc(MZ_DICT_SIZE);
+	size_t dict_ln = ZDICT_trainFromBuffer(dict, MZ_DICT_SIZE, s.samples, s.sizes, s.count);
+	if (ZDICT_isError(dict_ln))
+		printf("Cannot train dictionary: %s\n", ZDICT_getErrorName(dict_ln));
+	else
+	{
+		file_write(dict_path, dict, dict_ln);
+		printf("%u files sampled, %lu byte dictionary written to %s\n", s.count, dict_ln, dict_path);
+		ok = true;
+	}
+
+	free(dict);
+	free(s.samples);
+	free(s.sizes);
+	mz_dir_list_free(names, count);
+	return ok;
+#else
+	printf("zstd dictionaries require building with ZSTD=1\n");
+	return false;
+#endif
+}
+
+/* Archives being recompressed by a pool of workers */
+struct mz_recompress_pool
+{
+	char *dir;         // directory holding the archives (NULL for a single archive)
+	char **names;
+	int name_count;
+	int next;          // next archive to be recompressed
+	uint64_t in_ln;
+	uint64_t out_ln;
+	uint32_t files;
+	uint32_t corrupted;
+	pthread_mutex_t lock;
+};
+
+/* State of a recompression worker */
+struct mz_recompress_state
+{
+	uint8_t *out;      // recompressed archive
+	uint64_t out_ln;
+	uint64_t out_size;
+	uint32_t files;
+	uint32_t corrupted;
+};
+
+static void mz_recompress_reserve(struct mz_recompress_state *state, uint64_t ln)
+{
+	if (state->out_ln + ln <= state->out_size)
+		return;
+	state->out_size = 2 * (state->out_ln + ln);
+	state->out = realloc(state->out, state->out_size);
+}
+
+static bool mz_recompress_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_recompress_state *state = ptr;
+
+	/* Records which cannot be decompressed are kept as they are */
+	uint64_t data_ln = 0;
+	char *data = mz_inflate_buffer(record->zdata, record->zdata_ln, &data_ln);
+	if (data)
+	{
+		mz_recompress_reserve(state, MZ_HEAD + mz_record_bound(data_ln));
+		uint64_t ln = mz_record_compress(record->id, data, data_ln, state->out + state->out_ln);
+		if (ln)
+		{
+			state->out_ln += ln;
+			state->files++;
+			return true;
+		}
+	}
+
+	state->corrupted++;
+	mz_recompress_reserve(state, record->ln);
+	memcpy(state->out + state->out_ln, record->id, record->ln);
+	state->out_ln += record->ln;
+	return true;
+}
+
+/**
+ * @brief Worker thread recompressing archives until none is left
+ *
+ * @param ptr pointer to the pool
+ * @return NULL
+ */
+static void *mz_recompress_worker(void *ptr)
+{
+	struct mz_recompress_pool *pool = ptr;
+	struct mz_recompress_state state;
+	memset(&state, 0, sizeof(state));
+
+	char path[MAX_PATH_LEN + 16] = "\0";
+	uint64_t in_ln = 0;
+	uint64_t out_ln = 0;
+
+	while (true)
+	{
+		pthread_mutex_lock(&pool->lock);
+		int i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->name_count)
+			break;
+
+		if (pool->dir)
+			sprintf(path, "%s/%s", pool->dir, pool->names[i]);
+		else
+			strcpy(path, pool->names[i]);
+
+		uint64_t mz_ln = 0;
+		uint8_t *mz = mz_map(path, &mz_ln);
+		if (!mz)
+		{
+			/* Never replace an archive that could not be read */
+			printf("Cannot read %s\n", path);
+			continue;
+		}
+		state.out_ln = 0;
+		uint32_t files = state.files;
+		if (!mz_walk(mz, mz_ln, mz_recompress_handler, &state))
+		{
+			printf("[CORRUPTED] %s\n", path);
+			mz_unmap(mz, mz_ln);
+			continue;
+		}
+		mz_unmap(mz, mz_ln);
+
+		/* Replace the archive only once complete, it is kept if it cannot be written */
+		if (!file_replace(path, state.out, state.out_ln))
+		{
+			printf("Cannot replace %s\n", path);
+			state.files = files;
+			continue;
+		}
+		if (!mz_index_write(path, state.out, state.out_ln))
+			printf("Cannot index %s\n", path);
+
+		in_ln += mz_ln;
+		out_ln += state.out_ln;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->in_ln += in_ln;
+	pool->out_ln += out_ln;
+	pool->files += state.files;
+	pool->corrupted += state.corrupted;
+	pthread_mutex_unlock(&pool->lock);
+
+	free(state.out);
+	mz_codec_thread_free();
+	return NULL;
+}
+
+/**
+ * @brief Rewrite the records of an mz archive, or of all the archives in a directory,
+ * with the selected codec (and dictionary)
+ *
+ * @param path mz file or directory
+ * @param threads number of worker threads
+ */
+void mz_recompress(char *path, int threads)
+{
+	struct mz_recompress_pool pool;
+	memset(&pool, 0, sizeof(pool));
+
+	if (is_dir(path))
+	{
+		pool.dir = path;
+		pool.names = mz_dir_list(path, &pool.name_count);
+	}
+	else
+	{
+		pool.names = malloc(sizeof(char *));
+		pool.names[pool.name_count++] = strdup(path);
+	}
+
+	if (threads > pool.name_count)
+		threads = pool.name_count;
+	if (threads < 1)
+		threads = 1;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_t *tids = calloc(threads, sizeof(pthread_t));
+	for (int t = 1; t < threads; t++)
+		pthread_create(&tids[t], NULL, mz_recompress_worker, &pool);
+	mz_recompress_worker(&pool);
+	for (int t = 1; t < threads; t++)
+		pthread_join(tids[t], NULL);
+
+	printf("%d archives, %u files recompressed, %lu -> %lu bytes\n", pool.name_count, pool.files, pool.in_ln, pool.out_ln);
+	if (pool.corrupted)
+		printf("%u files could not be decompressed and were kept as they were\n", pool.corrupted);
+
+	pthread_mutex_destroy(&pool.lock);
+	free(tids);
+	mz_dir_list_free(pool.names, pool.name_count);
+}
@@ -0,0 +1,409 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mz_index.c
+ *
+ * Sidecar indexes for single file lookup in mz archives
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mz_index.c
+  * @date 18 Oct 2026
+  * @brief An .mzi file next to an mz archive lists its record ids, sorted, with
+  * their offsets and lengths. A file is then extracted with a binary search, one
+  * read and one inflate. Indexes are checked against the archive size and mtime,
+  * so archives appended to afterwards (i.e. by mz_flush) fall back to a full scan
+  */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "minr.h"
+#include <ldb.h>
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_codec.h"
+
+/* Index entries being collected */
+struct mz_index_state
+{
+	uint8_t *entries;
+	uint32_t count;
+	uint32_t size;
+	uint64_t base; // archive offset of the walked buffer
+};
+
+static void mz_index_path(char *mz_path, char *index_path)
+{
+	sprintf(index_path, "%s"MZ_INDEX_EXT, mz_path);
+}
+
+static bool mz_index_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_index_state *state = ptr;
+
+	if (state->count == state->size)
+	{
+		state->size = state->size ? state->size * 2 : 4096;
+		state->entries = realloc(state->entries, (uint64_t) state->size * MZ_INDEX_ENTRY_LN);
+	}
+
+	uint8_t *entry = state->entries + (uint64_t) state->count++ * MZ_INDEX_ENTRY_LN;
+	uint64_t offset = state->base + record->offset;
+	memcpy(entry, record->id, MZ_MD5);
+	memcpy(entry + MZ_MD5, &offset, sizeof(offset));
+	memcpy(entry + MZ_MD5 + sizeof(offset), &record->zdata_ln, MZ_SIZE);
+	return true;
+}
+
+/**
+ * @brief Order entries by id. Repeated ids keep archive order, so lookups return the first one
+ */
+static int mz_index_entry_cmp(const void *a, const void *b)
+{
+	int cmp = memcmp(a, b, MZ_MD5);
+	if (cmp)
+		return cmp;
+
+	uint64_t a_offset, b_offset;
+	memcpy(&a_offset, (uint8_t *) a + MZ_MD5, sizeof(a_offset));
+	memcpy(&b_offset, (uint8_t *) b + MZ_MD5, sizeof(b_offset));
+	return (a_offset > b_offset) - (a_offset < b_offset);
+}
+
+/**
+ * @brief Sort the collected entries and write the index of an archive (into a temporary file renamed over it)
+ *
+ * @param mz_path archive path
+ * @param state collected entries
+ * @return true on success
+ */
+static bool mz_index_save(char *mz_path, struct mz_index_state *state)
+{
+	struct stat st;
+	if (stat(mz_path, &st))
+		return false;
+
+	qsort(state->entries, state->count, MZ_INDEX_ENTRY_LN, mz_index_entry_cmp);
+
+	struct mz_index_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MZ_INDEX_MAGIC, sizeof(header.magic));
+	header.count = state->count;
+	header.mz_ln = st.st_size;
+	header.mtime_sec = st.st_mtim.tv_sec;
+	header.mtime_nsec = st.st_mtim.tv_nsec;
+
+	char index_path[MAX_PATH_LEN + 8] = "\0";
+	char tmp[MAX_PATH_LEN + 16] = "\0";
+	mz_index_path(mz_path, index_path);
+	sprintf(tmp, "%s.tmp", index_path);
+
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (state->count)
+		ok &= fwrite(state->entries, MZ_INDEX_ENTRY_LN, state->count, fp) == state->count;
+	ok &= !fclose(fp);
+
+	if (!ok || rename(tmp, index_path))
+	{
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Write the index of an archive which is already in memory
+ *
+ * @param mz_path archive path
+ * @param mz archive contents, as written to mz_path
+ * @param mz_ln archive size
+ * @return false if the archive framing is broken or the index cannot be written
+ */
+bool mz_index_write(char *mz_path, uint8_t *mz, uint64_t mz_ln)
+{
+	struct mz_index_state state;
+	memset(&state, 0, sizeof(state));
+
+	bool ok = mz_walk(mz, mz_ln, mz_index_handler, &state);
+	if (ok)
+		ok = mz_index_save(mz_path, &state);
+
+	free(state.entries);
+	return ok;
+}
+
+/**
+ * @brief Rebuild the index of an archive
+ *
+ * @param mz_path archive path
+ * @return false if the archive cannot be read, its framing is broken or the index cannot be written
+ */
+bool mz_index_build(char *mz_path)
+{
+	uint64_t mz_ln = 0;
+	uint8_t *mz = mz_map(mz_path, &mz_ln);
+	if (!mz)
+		return false;
+
+	bool ok = mz_index_write(mz_path, mz, mz_ln);
+	mz_unmap(mz, mz_ln);
+	return ok;
+}
+
+/**
+ * @brief Read an index header, checking it against its archive
+ *
+ * @param fd open index
+ * @param mz_path archive path
+ * @param[out] header index header
+ * @return true if the index is valid for the archive
+ */
+static bool mz_index_header_read(int fd, char *mz_path, struct mz_index_header *header)
+{
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header))
+		return false;
+	if (memcmp(header->magic, MZ_INDEX_MAGIC, sizeof(header->magic)))
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size != sizeof(*header) + (uint64_t) header->count * MZ_INDEX_ENTRY_LN)
+		return false;
+
+	if (stat(mz_path, &st) || st.st_size != header->mz_ln)
+		return false;
+
+	if (st.st_mtim.tv_sec != header->mtime_sec || st.st_mtim.tv_nsec != header->mtime_nsec)
+		return false;
+
+	return true;
+}
+
+/**
+ * @brief Check if an archive has an up to date index
+ *
+ * @param mz_path archive path
+ * @return true if it does
+ */
+bool mz_index_valid(char *mz_path)
+{
+	char index_path[MAX_PATH_LEN + 8] = "\0";
+	mz_index_path(mz_path, index_path);
+
+	int fd = open(index_path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct mz_index_header header;
+	bool ok = mz_index_header_read(fd, mz_path, &header);
+	close(fd);
+	return ok;
+}
+
+/**
+ * @brief Update the index of an archive which has been appended to. Only the appended
+ * records are read. If the index did not match the archive before the append
+ * (or old_ln is zero) the index is rebuilt
+ *
+ * @param mz_path archive path
+ * @param old_ln archive size before the append
+ * @return true on success
+ */
+bool mz_index_extend(char *mz_path, uint64_t old_ln)
+{
+	if (!old_ln)
+		return mz_index_build(mz_path);
+
+	char index_path[MAX_PATH_LEN + 8] = "\0";
+	mz_index_path(mz_path, index_path);
+
+	/* The index was valid before the append, so its size is checked against old_ln only */
+	int fd = open(index_path, O_RDONLY);
+	if (fd < 0)
+		return mz_index_build(mz_path);
+
+	struct mz_index_header header;
+	bool ok = (pread(fd, &header, sizeof(header), 0) == sizeof(header));
+	ok = ok && !memcmp(header.magic, MZ_INDEX_MAGIC, sizeof(header.magic)) && header.mz_ln == old_ln;
+
+	struct mz_index_state state;
+	memset(&state, 0, sizeof(state));
+	if (ok)
+	{
+		uint64_t entries_ln = (uint64_t) header.count * MZ_INDEX_ENTRY_LN;
+		state.size = state.count = header.count;
+		state.entries = malloc(entries_ln + 1);
+		ok = (pread(fd, state.entries, entries_ln, sizeof(header)) == entries_ln);
+	}
+	close(fd);
+
+	if (!ok)
+	{
+		free(state.entries);
+		return mz_index_build(mz_path);
+	}
+
+	/* Read the appended records */
+	uint64_t mz_ln = file_size(mz_path);
+	uint8_t *tail = NULL;
+	if (mz_ln > old_ln)
+	{
+		fd = open(mz_path, O_RDONLY);
+		tail = malloc(mz_ln - old_ln);
+		ok = (fd >= 0 && pread(fd, tail, mz_ln - old_ln, old_ln) == mz_ln - old_ln);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	state.base = old_ln;
+	if (ok && tail)
+		ok = mz_walk(tail, mz_ln - old_ln, mz_index_handler, &state);
+	if (ok)
+		ok = mz_index_save(mz_path, &state);
+
+	free(tail);
+	free(state.entries);
+	return ok;
+}
+
+/**
+ * @brief Remove the index of an archive, if any
+ *
+ * @param mz_path archive path
+ */
+void mz_index_remove(char *mz_path)
+{
+	char index_path[MAX_PATH_LEN + 8] = "\0";
+	mz_index_path(mz_path, index_path);
+	unlink(index_path);
+}
+
+/**
+ * @brief Find a record in an archive using its index
+ *
+ * @param mz_path archive path
+ * @param id MZ_MD5-byte record id
+ * @param[out] offset record offset
+ * @param[out] zdata_ln record compressed length
+ * @return 1 if found, 0 if not found, -1 if there is no valid index
+ */
+int mz_index_lookup(char *mz_path, uint8_t *id, uint64_t *offset, uint32_t *zdata_ln)
+{
+	char index_path[MAX_PATH_LEN + 8] = "\0";
+	mz_index_path(mz_path, index_path);
+
+	int fd = open(index_path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct mz_index_header header;
+	if (!mz_index_header_read(fd, mz_path, &header))
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (!header.count)
+	{
+		close(fd);
+		return 0;
+	}
+
+	uint64_t map_ln = sizeof(header) + (uint64_t) header.count * MZ_INDEX_ENTRY_LN;
+	uint8_t *map = mmap(NULL, map_ln, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	/* Find the first entry with the id */
+	uint8_t *entries = map + sizeof(header);
+	uint64_t lo = 0;
+	uint64_t hi = header.count;
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (memcmp(entries + mid * MZ_INDEX_ENTRY_LN, id, MZ_MD5) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	int found = 0;
+	uint8_t *entry = entries + lo * MZ_INDEX_ENTRY_LN;
+	if (lo < header.count && !memcmp(entry, id, MZ_MD5))
+	{
+		memcpy(offset, entry + MZ_MD5, sizeof(*offset));
+		memcpy(zdata_ln, entry + MZ_MD5 + sizeof(*offset), MZ_SIZE);
+		found = 1;
+	}
+
+	munmap(map, map_ln);
+	return found;
+}
+
+/**
+ * @brief Extract a file to STDOUT using the index of its archive (job->path/NNNN.mz)
+ *
+ * @param job pointer to mz job
+ * @param key file MD5 (hex)
+ * @return false if there is no valid index, so the archive has to be scanned instead
+ */
+bool mz_index_cat(struct mz_job *job, char *key)
+{
+	char mz_path[MAX_PATH_LEN + 16] = "\0";
+	sprintf(mz_path, "%s/%.4s.mz", job->path, key);
+
+	uint8_t md5[MD5_LEN];
+	ldb_hex_to_bin(key, MD5_LEN * 2, md5);
+	uint8_t *id = md5 + 2;
+
+	uint64_t offset = 0;
+	uint32_t zdata_ln = 0;
+	int found = mz_index_lookup(mz_path, id, &offset, &zdata_ln);
+	if (found <= 0)
+		return !found;
+
+	/* Read the record, checking it against the index */
+	uint64_t record_ln = MZ_HEAD + (uint64_t) zdata_ln;
+	uint8_t *record = malloc(record_ln);
+	int fd = open(mz_path, O_RDONLY);
+	bool ok = (fd >= 0 && pread(fd, record, record_ln, offset) == record_ln);
+	if (fd >= 0)
+		close(fd);
+
+	uint32_t ln = 0;
+	if (ok)
+		memcpy(&ln, record + MZ_MD5, MZ_SIZE);
+	ok = ok && ln == zdata_ln && !memcmp(record, id, MZ_MD5);
+
+	char *data = NULL;
+	uint64_t data_ln = 0;
+	if (ok)
+		ok = (data = mz_inflate_buffer(record + MZ_HEAD, zdata_ln, &data_ln)) != NULL;
+
+	if (ok)
+		fwrite(data, 1, data_ln, stdout);
+
+	free(record);
+	return ok;
+}
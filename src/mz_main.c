@@ -30,6 +30,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -45,6 +46,25 @@
 #include "mz_mine.h"
 #include "crypto.h"
 #include "mz.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_codec.h"
+#include "mz_pack.h"
+#include "mz_verify.h"
+
+/* Long options without a short equivalent */
+enum
+{
+	OPTION_RECOMPRESS = 256,
+	OPTION_CODEC,
+	OPTION_DICT,
+	OPTION_LEVEL,
+	OPTION_TRAIN_DICT,
+	OPTION_PACK,
+	OPTION_UNPACK,
+	OPTION_REPORT
+};
+#include "file.h"
 
 void help()
 {
@@ -58,15 +78,25 @@ void help()
 	printf("-x MZ   extract all files from MZ file\n");
 	printf("-l MZ   list directory of MZ file, validating integrity\n");
 	printf("-c MZ   check MZ file integrity\n");
+	printf("-c DIR  verify all records (framing, decompression and MD5) of the .mz files in DIR\n");
+	printf("        with -j N worker threads. Corrupted records are listed in mz_check.csv\n");
+	printf("        (archive,offset,key,error) and their keys in mz_check.keys, to be used with -X\n");
+	printf("--report NAME  write the -c DIR report to NAME.csv and NAME.keys\n");
 	printf("-o MZ   optimise MZ (eliminate duplicates and unwanted content)\n");
 	printf("-O MZ   optimise MZ, eliminating also orphan files (not found in local KB)\n");
 	printf("-D MZ   optimise MZ (eliminate only duplicates)\n");
+	printf("        -o, -O and -D also accept a directory, optimising all the .mz files in it\n");
+	printf("-j N    optimise a directory using N worker threads (default: 1)\n");
 	printf("-K MZ   extract a list of unique file keys to STDOUT (binary)\n");
 	printf("-X KEYS exclude list of KEYS (see -K) when running optimize (-O and -o)\n");
+	printf("-d DB   LDB database where -O looks for orphan files (default: oss)\n");
+	printf("-I MZ   rebuild the .mzi index of MZ (or of all the .mz files in a directory)\n");
+	printf("        indexes are also written by -o, -O, -D and minr joins\n");
 	printf("\n");
 
 	printf("Single file extraction to STDOUT:\n");
 	printf("-k MD5  extracts file with id MD5 and display contents via STDOUT\n");
+	printf("        (using the .mzi index of the archive when it is up to date)\n");
 	printf("-p PATH specify mined/ directory (default: mined/)\n");
 	printf("\n");
 
@@ -75,6 +105,27 @@ void help()
 	printf("-Y MZ   detect cryptographic algorithms usage\n");
 	printf("-C MZ   detect copyright declarations\n");
 	printf("-Q MZ   extract code quality (best practices) information\n");
+	printf("-M LCQY MZ|DIR  run several detectors (L, C, Q, Y) with a single decompression\n");
+	printf("        of each file, writing CSV tables to the -p directory (default: mined/)\n");
+	printf("        -j N mines the .mz files of a directory using N worker threads\n");
+	printf("\n");
+
+	printf("Record compression:\n");
+	printf("--recompress MZ|DIR  rewrite all files with the --codec codec (default: zstd)\n");
+	printf("                     -j N recompresses the .mz files of a directory using N worker threads\n");
+	printf("--codec zlib|zstd    codec used by --recompress\n");
+	printf("--level N            zstd compression level (default: %d), given before --dict\n", MZ_ZSTD_LEVEL);
+	printf("--dict FILE          load a zstd dictionary, used to write new records and to read\n");
+	printf("                     records compressed with it. Can be repeated (the first one writes)\n");
+	printf("--train-dict FILE MZ|DIR  train a zstd dictionary from a sample of the files in MZ|DIR\n");
+	printf("zstd support requires building with ZSTD=1\n");
+	printf("\n");
+
+	printf("Packed tables:\n");
+	printf("--pack DIR    move the .mz files of a table directory (i.e. mined/sources) into a pack\n");
+	printf("              of a few large segment files. -k, -M, minr -z and minr joins read packs\n");
+	printf("--unpack DIR  write a packed table directory back as .mz files\n");
+	printf("              (-o, -O, -D, -I and --recompress require an unpacked directory)\n");
 	printf("\n");
 
 	printf("Help and version:\n");
@@ -83,6 +134,20 @@ void help()
 	exit(EXIT_SUCCESS);
 }
 
+/**
+ * @brief Exit if a directory is packed. Tools rewriting .mz files in place need loose files
+ * 
+ * @param path mz file or directory
+ */
+static void mz_check_unpacked(char *path)
+{
+	if (is_dir(path) && mz_pack_exists(path))
+	{
+		printf("%s is packed, unpack it first (--unpack)\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
 /**
  * @brief Check the characters are in the range of a hexadecimal number
  * 
@@ -122,6 +187,39 @@ void argcpy(char *str, char *arg)
 	strcpy(str, arg);
 }
 
+/**
+ * @brief Rebuild the index of an archive, or of all the archives in a directory
+ * 
+ * @param path mz file or directory
+ * @return false if any archive could not be indexed
+ */
+bool mz_index_path_build(char *path)
+{
+	if (!is_dir(path))
+	{
+		if (mz_index_build(path))
+			return true;
+		printf("Cannot index %s\n", path);
+		return false;
+	}
+
+	int count = 0;
+	char **names = mz_dir_list(path, &count);
+	bool ok = true;
+	char mz_path[MAX_PATH_LEN + 16] = "\0";
+	for (int i = 0; i < count; i++)
+	{
+		sprintf(mz_path, "%s/%s", path, names[i]);
+		if (!mz_index_build(mz_path))
+		{
+			printf("Cannot index %s\n", mz_path);
+			ok = false;
+		}
+	}
+	mz_dir_list_free(names, count);
+	return ok;
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status = EXIT_SUCCESS;
@@ -132,6 +230,27 @@ int main(int argc, char *argv[])
 	char key[33] = "\0";
 	bool key_provided = false;
 	bool run_optimise = false;
+	mz_optimise_mode_t optimise_mode = MZ_OPTIMISE_ALL;
+	int threads = 1;
+	char detectors[MAX_ARG_LEN] = "\0";
+	char recompress_path[MAX_ARG_LEN] = "\0";
+	char dict_train_path[MAX_ARG_LEN] = "\0";
+	char *codec = "zstd";
+	char verify_path[MAX_ARG_LEN] = "\0";
+	char verify_report[MAX_ARG_LEN] = MZ_VERIFY_REPORT;
+
+	static struct option long_options[] =
+	{
+		{"recompress", required_argument, NULL, OPTION_RECOMPRESS},
+		{"codec", required_argument, NULL, OPTION_CODEC},
+		{"dict", required_argument, NULL, OPTION_DICT},
+		{"level", required_argument, NULL, OPTION_LEVEL},
+		{"train-dict", required_argument, NULL, OPTION_TRAIN_DICT},
+		{"pack", required_argument, NULL, OPTION_PACK},
+		{"unpack", required_argument, NULL, OPTION_UNPACK},
+		{"report", required_argument, NULL, OPTION_REPORT},
+		{NULL, 0, NULL, 0}
+	};
 
 	/* Check if parameters are present */
 	if (argc < 2)
@@ -157,6 +276,7 @@ int main(int argc, char *argv[])
 	job.igl_c = 0;
 	job.orp_c = 0;
 	job.min_c = 0;
+	job.exc_c = 0;
 	job.md5[32] = 0;
 	job.check_only = false;
 	job.dump_keys = false;
@@ -167,7 +287,7 @@ int main(int argc, char *argv[])
 	job.licenses = NULL;
 	job.license_count = 0;
 	
-	while ((option = getopt(argc, argv, ":p:k:c:x:K:l:C:Q:L:o:D:O:Y:X:hv")) != -1)
+	while ((option = getopt_long(argc, argv, ":p:k:c:x:K:l:C:Q:L:o:D:O:Y:X:d:j:M:I:hv", long_options, NULL)) != -1)
 	{
 		/* Check valid alpha is entered */
 		if (optarg)
@@ -202,7 +322,17 @@ int main(int argc, char *argv[])
 				job.xkeys = file_read(optarg, &job.xkeys_ln);
 				break;
 
+			case 'd':
+				argcpy(mz_dbname, optarg);
+				break;
+
 			case 'c':
+				/* Directories are verified once all options are parsed (see -j) */
+				if (is_dir(optarg))
+				{
+					argcpy(verify_path, optarg);
+					break;
+				}
 				job.check_only = true;
 				argcpy(job.path, optarg);
 				mz_list_check(&job);
@@ -214,9 +344,20 @@ int main(int argc, char *argv[])
 				break;
 
 			case 'K':
-				job.dump_keys = true;
+				/* Keys are read from the record headers, without decompressing */
 				argcpy(job.path, optarg);
-				mz_list_check(&job);
+				if (!mz_dump_keys(job.path))
+				{
+					printf("[CORRUPTED] %s\n", job.path);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'I':
+				argcpy(job.path, optarg);
+				mz_check_unpacked(job.path);
+				if (!mz_index_path_build(job.path))
+					exit(EXIT_FAILURE);
 				break;
 
 			case 'l':
@@ -245,8 +386,27 @@ int main(int argc, char *argv[])
 				argcpy(job.path, optarg);
 				break;
 			case 'D':
+				run_optimise = true;
+				optimise_mode = MZ_OPTIMISE_DUP;
 				argcpy(job.path, optarg);
-				mz_optimise(&job, MZ_OPTIMISE_DUP);
+				break;
+
+			case 'M':
+				for (char *d = optarg; *d; d++) if (!strchr("LCQY", *d))
+				{
+					printf("Invalid detector: %c\n", *d);
+					exit(EXIT_FAILURE);
+				}
+				argcpy(detectors, optarg);
+				break;
+
+			case 'j':
+				threads = atoi(optarg);
+				if (threads < 1)
+				{
+					printf("Invalid number of threads: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
 				break;
 
 			case 'L':
@@ -262,6 +422,46 @@ int main(int argc, char *argv[])
 				clean_crypto_definitions();
 				break;
 
+			case OPTION_RECOMPRESS:
+				argcpy(recompress_path, optarg);
+				break;
+
+			case OPTION_CODEC:
+				codec = optarg;
+				break;
+
+			case OPTION_DICT:
+				if (!mz_dict_load(optarg))
+					exit(EXIT_FAILURE);
+				break;
+
+			case OPTION_LEVEL:
+				mz_codec_level(atoi(optarg));
+				break;
+
+			case OPTION_TRAIN_DICT:
+				argcpy(dict_train_path, optarg);
+				break;
+
+			case OPTION_PACK:
+				argcpy(job.path, optarg);
+				if (!is_dir(job.path) || !mz_pack_convert(job.path))
+				{
+					printf("Cannot pack %s\n", job.path);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case OPTION_REPORT:
+				argcpy(verify_report, optarg);
+				break;
+
+			case OPTION_UNPACK:
+				argcpy(job.path, optarg);
+				if (!mz_unpack_convert(job.path))
+					exit(EXIT_FAILURE);
+				break;
+
 			case 'h':
 				help();
 				break;
@@ -295,16 +495,82 @@ int main(int argc, char *argv[])
 		invalid_argument = true;
 	}
 
-	/* Process -O and -o requests */
-	if (run_optimise) mz_optimise(&job, MZ_OPTIMISE_ALL);
+	/* Process -c DIR request */
+	if (*verify_path)
+	{
+		if (!mz_verify(verify_path, verify_report, threads))
+			exit_status = EXIT_FAILURE;
+	}
+
+	/* Process --train-dict request */
+	else if (*dict_train_path)
+	{
+		if (optind >= argc || invalid_argument)
+		{
+			printf("Missing MZ file or directory for --train-dict\n");
+			exit(EXIT_FAILURE);
+		}
+		if (!mz_dict_train(argv[optind], dict_train_path))
+			exit_status = EXIT_FAILURE;
+	}
+
+	/* Process --recompress request */
+	else if (*recompress_path)
+	{
+		if (!mz_codec_set(codec))
+			exit(EXIT_FAILURE);
+		mz_check_unpacked(recompress_path);
+		mz_recompress(recompress_path, threads);
+	}
+
+	/* Process -M request */
+	else if (*detectors)
+	{
+		if (optind >= argc || invalid_argument)
+		{
+			printf("Missing MZ file or directory for -M\n");
+			exit(EXIT_FAILURE);
+		}
+
+		char out_path[MAX_PATH_LEN] = "mined";
+		if (*job.path) strcpy(out_path, job.path);
+		argcpy(job.path, argv[optind]);
+
+		if (strchr(detectors, 'L')) job.licenses = load_licenses(&job.license_count);
+		if (strchr(detectors, 'Y')) load_crypto_definitions();
+
+		mz_mine_multi(&job, job.path, detectors, out_path, threads);
+
+		if (strchr(detectors, 'Y')) clean_crypto_definitions();
+		free(job.licenses);
+	}
+
+	/* Process -O, -o and -D requests */
+	else if (run_optimise)
+	{
+		mz_check_unpacked(job.path);
+		if (is_dir(job.path))
+			mz_optimise_dir(&job, optimise_mode, threads);
+		else
+			mz_optimise(&job, optimise_mode);
+	}
 
 	/* Process -k request */
-	else if (key_provided) mz_cat(&job, key);
+	else if (key_provided)
+	{
+		if (mz_pack_exists(job.path))
+		{
+			if (!mz_pack_cat(job.path, key))
+				exit_status = EXIT_FAILURE;
+		}
+		else if (!mz_index_cat(&job, key)) mz_cat(&job, key);
+	}
 
 	if (invalid_argument)
 	{
 		printf("Error parsing arguments\n");
 	}
 
+	mz_codec_free();
 	return exit_status;
 }
@@ -27,13 +27,21 @@
   */
 
 #include <libgen.h>
+#include <pthread.h>
 #include "minr.h"
 #include "ldb.h"
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_codec.h"
+#include "mz_pack.h"
 #include "copyright.h"
 #include "quality.h"
 #include "license.h"
 #include "mz_mine.h"
 #include "crypto.h"
+#include "content.h"
+#include "sink.h"
+#include "arena.h"
 
 /**
  * @brief 
@@ -44,8 +52,10 @@
  */
 bool mz_quality_handler(struct mz_job *job)
 {
+	arena_reset();
+
 	/* Decompress */
-	mz_deflate(job);
+	mz_job_inflate(job);
 
 	/* Fill MD5 with item id */
 	mz_id_fill(job->md5, job->id);
@@ -67,12 +77,12 @@ void mz_mine_quality(struct mz_job *job)
 	memcpy(job->md5, basename(job->path), 4);
 
 	/* Read source mz file into memory */
-	job->mz = file_read(job->path, &job->mz_ln);
+	job->mz = mz_map(job->path, &job->mz_ln);
 
 	/* Launch quality mining */
 	mz_parse(job, mz_quality_handler);
 
-	free(job->mz);
+	mz_unmap(job->mz, job->mz_ln);
 }
 
 
@@ -89,8 +99,10 @@ void mz_mine_quality(struct mz_job *job)
  */
 bool mz_license_handler(struct mz_job *job)
 {
+	arena_reset();
+
 	/* Decompress */
-	mz_deflate(job);
+	mz_job_inflate(job);
 
 	/* Fill MD5 with item id */
 	mz_id_fill(job->md5, job->id);
@@ -118,12 +130,12 @@ void mz_mine_license(struct mz_job *job)
 	memcpy(job->md5, basename(job->path), 4);
 
 	/* Read source mz file into memory */
-	job->mz = file_read(job->path, &job->mz_ln);
+	job->mz = mz_map(job->path, &job->mz_ln);
 
 	/* Launch license mining */
 	mz_parse(job, mz_license_handler);
 
-	free(job->mz);
+	mz_unmap(job->mz, job->mz_ln);
 }
 
 /**
@@ -135,8 +147,10 @@ void mz_mine_license(struct mz_job *job)
  */
 bool mz_copyright_handler(struct mz_job *job)
 {
+	arena_reset();
+
 	/* Decompress */
-	mz_deflate(job);
+	mz_job_inflate(job);
 
 	/* Fill MD5 with item id */
 	mz_id_fill(job->md5, job->id);
@@ -158,12 +172,12 @@ void mz_mine_copyright(struct mz_job *job)
 	memcpy(job->md5, basename(job->path), 4);
 
 	/* Read source mz file into memory */
-	job->mz = file_read(job->path, &job->mz_ln);
+	job->mz = mz_map(job->path, &job->mz_ln);
 
 	/* Launch copyright mining */
 	mz_parse(job, mz_copyright_handler);
 
-	free(job->mz);
+	mz_unmap(job->mz, job->mz_ln);
 }
 
 /**
@@ -174,8 +188,10 @@ void mz_mine_copyright(struct mz_job *job)
  */
 bool mz_crypto_handler(struct mz_job *job)
 {
+	arena_reset();
+
 	/* Decompress */
-	mz_deflate(job);
+	mz_job_inflate(job);
 
 	/* Fill MD5 with item id */
 	mz_id_fill(job->md5, job->id);
@@ -197,11 +213,262 @@ void mz_mine_crypto(struct mz_job *job)
 	memcpy(job->md5, basename(job->path), 4);
 
 	/* Read source mz file into memory */
-	job->mz = file_read(job->path, &job->mz_ln);
+	job->mz = mz_map(job->path, &job->mz_ln);
 
 	/* Launch crypto mining */
 	mz_parse(job, mz_crypto_handler);
 
-	free(job->mz);
+	mz_unmap(job->mz, job->mz_ln);
 }
 
+
+/* Tables written by the multi-miner, in detector order */
+static const char *mz_mine_tables[] = {TABLE_NAME_QUALITY, TABLE_NAME_COPYRIGHT, TABLE_NAME_CRYPTOGRAPHY, TABLE_NAME_LICENSE};
+
+/* Archives being mined by a pool of workers (-M) */
+struct mz_mine_pool
+{
+	struct mz_job *job; // template job
+	char *dir;          // directory holding the archives (NULL for a single archive)
+	struct mz_pack *pack; // pack of the directory, if packed (read-only while mining)
+	char **names;       // archive names (or paths)
+	int name_count;
+	int next;           // next archive to be mined
+	char *detectors;    // selected detectors (L, C, Q, Y)
+	char *out_path;     // output mined/ directory
+	int workers;        // number of workers started
+	uint32_t files;
+	uint32_t corrupted;
+	pthread_mutex_t lock;
+};
+
+/* State of a worker walking an archive */
+struct mz_mine_worker
+{
+	struct mz_mine_pool *pool;
+	char mined_path[MAX_PATH_LEN]; // worker output directory
+	char md5[MD5_LEN * 2 + 1];
+	struct minr_job *license_job;
+	struct sink *out_quality;      // csv sinks of the worker output directory
+	struct sink *out_copyright;
+	struct sink *out_crypto;
+	uint32_t files;
+	uint32_t corrupted;
+};
+
+/**
+ * @brief Header walk handler: inflate the record once and run the selected detectors on it.
+ * License detection runs last, since it truncates the buffer at the end of the header
+ * 
+ * @param record mz record
+ * @param ptr pointer to the worker state
+ * @return true
+ */
+static bool mz_mine_multi_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_mine_worker *w = ptr;
+	char *detectors = w->pool->detectors;
+	arena_reset();
+
+	uint64_t data_ln = 0;
+	char *data = mz_inflate_buffer(record->zdata, record->zdata_ln, &data_ln);
+	if (!data)
+	{
+		w->corrupted++;
+		return true;
+	}
+	w->files++;
+
+	/* Fill MD5 with item id */
+	mz_id_fill(w->md5, record->id);
+
+	/* Quality and crypto detection share a single pass over the data */
+	bool quality = strchr(detectors, 'Q');
+	bool crypto = strchr(detectors, 'Y');
+	struct content_stats stats = {0};
+	if ((quality && data_ln >= MIN_FILE_SIZE) || crypto)
+		content_scan(&stats, data, data_ln, crypto);
+
+	if (quality)
+		mine_quality_scanned(w->out_quality, w->md5, &stats, data_ln);
+
+	if (strchr(detectors, 'C'))
+		mine_copyright(w->out_copyright, w->md5, data, data_ln, false);
+
+	if (crypto)
+		mine_crypto_scanned(w->out_crypto, w->md5, &stats, data, data_ln);
+
+	if (strchr(detectors, 'L'))
+	{
+		w->license_job->src = data;
+		w->license_job->src_ln = data_ln;
+		mine_license(w->license_job, w->md5, false);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Worker thread mining archives until none is left
+ * 
+ * @param ptr pointer to the worker state
+ * @return NULL
+ */
+static void *mz_mine_multi_worker(void *ptr)
+{
+	struct mz_mine_worker *w = ptr;
+	struct mz_mine_pool *pool = w->pool;
+	char path[MAX_PATH_LEN] = "\0";
+
+	w->license_job = calloc(1, sizeof(struct minr_job));
+	w->license_job->local_mining = false;
+	w->license_job->licenses = pool->job->licenses;
+	w->license_job->license_count = pool->job->license_count;
+	strcpy(w->license_job->mined_path, w->mined_path);
+	w->license_job->out_license = sink_table(w->mined_path, TABLE_NAME_LICENSE);
+	w->out_quality = sink_table(w->mined_path, TABLE_NAME_QUALITY);
+	w->out_copyright = sink_table(w->mined_path, TABLE_NAME_COPYRIGHT);
+	w->out_crypto = sink_table(w->mined_path, TABLE_NAME_CRYPTOGRAPHY);
+
+	while (true)
+	{
+		pthread_mutex_lock(&pool->lock);
+		int i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->name_count)
+			break;
+
+		if (pool->dir)
+			sprintf(path, "%s/%s", pool->dir, pool->names[i]);
+		else
+			strcpy(path, pool->names[i]);
+
+		/* Extract first two MD5 bytes from the file name */
+		memcpy(w->md5, basename(path), 4);
+
+		uint64_t mz_ln = 0;
+		uint8_t *mz = NULL;
+		if (pool->pack)
+		{
+			uint8_t mz_id[2];
+			ldb_hex_to_bin(w->md5, 4, mz_id);
+			mz = mz_sector_read(pool->dir, pool->pack, mz_id[0] * 256 + mz_id[1], &mz_ln);
+		}
+		else
+			mz = mz_map(path, &mz_ln);
+		if (!mz_walk(mz, mz_ln, mz_mine_multi_handler, w))
+		{
+			printf("[CORRUPTED] %s\n", path);
+			w->corrupted++;
+		}
+		if (pool->pack)
+			free(mz);
+		else
+			mz_unmap(mz, mz_ln);
+	}
+
+	free(w->license_job);
+	mz_codec_thread_free();
+	arena_thread_free();
+	return NULL;
+}
+
+/**
+ * @brief Mine an mz archive, or all archives in a directory, running several detectors
+ * (L = license, C = copyright, Q = quality, Y = cryptography) on each file with a single
+ * decompression. Results are written to the CSV tables in out_path, as in a mined/ directory
+ * 
+ * @param job pointer to mz job (job->licenses must be loaded for L)
+ * @param path mz archive or directory
+ * @param detectors selected detectors
+ * @param out_path output directory
+ * @param threads number of worker threads
+ */
+void mz_mine_multi(struct mz_job *job, char *path, char *detectors, char *out_path, int threads)
+{
+	struct mz_mine_pool pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.job = job;
+	pool.detectors = detectors;
+	pool.out_path = out_path;
+
+	if (is_dir(path))
+	{
+		pool.dir = path;
+		if (mz_pack_exists(path))
+		{
+			pool.pack = mz_pack_open(path);
+			if (!pool.pack)
+				exit(EXIT_FAILURE);
+			pool.names = mz_pack_list(pool.pack, &pool.name_count);
+		}
+		else
+			pool.names = mz_dir_list(path, &pool.name_count);
+	}
+	else
+	{
+		pool.names = malloc(sizeof(char *));
+		pool.names[0] = strdup(path);
+		pool.name_count = 1;
+	}
+
+	if (!create_dir(out_path))
+	{
+		printf("Cannot create output directory %s\n", out_path);
+		exit(EXIT_FAILURE);
+	}
+
+	if (threads > pool.name_count)
+		threads = pool.name_count;
+	if (threads < 1)
+		threads = 1;
+
+	/* Each worker writes to its own directory, joined at the end */
+	struct mz_mine_worker *workers = calloc(threads, sizeof(struct mz_mine_worker));
+	pthread_t *tids = calloc(threads, sizeof(pthread_t));
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].pool = &pool;
+		sprintf(workers[t].mined_path, "%s/.mz_mine.%d", out_path, t);
+		if (is_dir(workers[t].mined_path))
+			rm_dir(workers[t].mined_path);
+		create_dir(workers[t].mined_path);
+		if (t)
+			pthread_create(&tids[t], NULL, mz_mine_multi_worker, &workers[t]);
+	}
+	mz_mine_multi_worker(&workers[0]);
+	for (int t = 1; t < threads; t++)
+		pthread_join(tids[t], NULL);
+	sink_close_all();
+
+	char src[MAX_PATH_LEN + 64] = "\0";
+	char dst[MAX_PATH_LEN + 64] = "\0";
+	for (int t = 0; t < threads; t++)
+	{
+		pool.files += workers[t].files;
+		pool.corrupted += workers[t].corrupted;
+
+		for (int i = 0; i < sizeof(mz_mine_tables) / sizeof(mz_mine_tables[0]); i++)
+		{
+			sprintf(src, "%s/%s.csv", workers[t].mined_path, mz_mine_tables[i]);
+			sprintf(dst, "%s/%s.csv", out_path, mz_mine_tables[i]);
+			if (is_file(src))
+				file_append(src, dst);
+		}
+		rm_dir(workers[t].mined_path);
+	}
+
+	printf("%d archives, %u files mined", pool.name_count, pool.files);
+	if (pool.corrupted)
+		printf(", %u corrupted", pool.corrupted);
+	printf("\n");
+
+	pthread_mutex_destroy(&pool.lock);
+	if (pool.pack)
+		mz_pack_close(pool.pack);
+	free(tids);
+	free(workers);
+	mz_dir_list_free(pool.names, pool.name_count);
+}
@@ -28,13 +28,125 @@
 
 #include <zlib.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "minr.h"
 #include <ldb.h>
 #include "hex.h"
 #include "ignorelist.h"
 #include "mz.h"
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_codec.h"
+#include "md5_mb.h"
 
+/* -X keys are mz_id(2) + id(14) */
+#define XKEY_LN MD5_LEN
+
+/**
+ * Sorted -X keys, with the position of each mz_id (first two bytes) in the list
+ */
+struct mz_xkeys_index
+{
+	uint8_t *source; // job->xkeys the index was built from
+	uint8_t *keys;
+	uint64_t count;
+	uint64_t *bucket; // bucket[n] to bucket[n + 1] hold the keys of mz_id n
+};
+
+/**
+ * Ids of the current archive found in the LDB file table (-O), sorted
+ */
+struct mz_known_ids
+{
+	uint8_t *ids;
+	uint64_t count;
+};
+
+/**
+ * Last file table sector loaded for orphan detection. With -O, workers take all the
+ * archives sharing a sector (first byte of the mz id) at once, so each sector is loaded once
+ */
+struct mz_file_sector
+{
+	char db[MAX_ARG_LEN];
+	int key;
+	uint8_t *data;
+};
+
+/* LDB database used for orphan detection (-O) */
+char mz_dbname[MAX_ARG_LEN] = "oss";
+
+/* Archives of a directory being optimised by a pool of workers (-j) */
+struct mz_optimise_pool
+{
+	struct mz_job *job; // template job, copied by each worker
+	mz_optimise_mode_t mode;
+	char **names; // archive names, sorted
+	int name_count;
+	int next; // next archive to be optimised
+	uint32_t archives;
+	uint32_t dup_c, orp_c, igl_c, min_c, exc_c;
+	pthread_mutex_t lock;
+};
+
+/* Per-worker state, the xkeys index is built once before workers start */
+static __thread struct mz_id_set *mz_ids = NULL;
+static struct mz_xkeys_index xkeys_index = {NULL, NULL, 0, NULL};
+static __thread struct mz_known_ids known_ids = {NULL, 0};
+static __thread struct mz_file_sector file_sector = {"", -1, NULL};
+
+/* Inflated records waiting for their MD5 (see mz_optimise_batch) */
+static __thread struct md5_batch batch;
+static __thread uint8_t *batch_id[MD5_MB_LANES];
+static __thread uint64_t batch_ln[MD5_MB_LANES];
+
+static int xkey_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, XKEY_LN);
+}
+
+static int mz_md5_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, MZ_MD5);
+}
+
+/* Keys within a bucket share the mz_id, so only the id is compared */
+static int xkey_id_cmp(const void *a, const void *b)
+{
+	return memcmp((uint8_t *) a + 2, (uint8_t *) b + 2, XKEY_LN - 2);
+}
+
+/**
+ * @brief Sort the -X keys and index them by mz_id. This is done once per key list
+ * 
+ * @param job pointer to mz job
+ */
+static void mz_xkeys_index_load(struct mz_job *job)
+{
+	if (xkeys_index.source == job->xkeys)
+		return;
+
+	free(xkeys_index.keys);
+	free(xkeys_index.bucket);
+
+	xkeys_index.source = job->xkeys;
+	xkeys_index.count = job->xkeys_ln / XKEY_LN;
+	xkeys_index.keys = malloc(xkeys_index.count * XKEY_LN);
+	memcpy(xkeys_index.keys, job->xkeys, xkeys_index.count * XKEY_LN);
+	qsort(xkeys_index.keys, xkeys_index.count, XKEY_LN, xkey_cmp);
+
+	xkeys_index.bucket = calloc(MZ_FILES + 1, sizeof(uint64_t));
+	uint64_t k = 0;
+	for (uint32_t n = 0; n < MZ_FILES; n++)
+	{
+		xkeys_index.bucket[n] = k;
+		while (k < xkeys_index.count && xkeys_index.keys[k * XKEY_LN] * 256 + xkeys_index.keys[k * XKEY_LN + 1] == n)
+			k++;
+	}
+	xkeys_index.bucket[MZ_FILES] = k;
+}
 
 /**
  * @brief Check if job->id is found in job->xkeys (see -X)
@@ -46,17 +158,18 @@ bool mz_id_excluded(struct mz_job *job)
 {
 	if (!job->xkeys_ln) return false;
 
-	for (uint64_t i = 0; i < job->xkeys_ln; i += MD5_LEN)
-	{
-		/* Compare job id (bytes 3-16) */
-		if (!memcmp(job->xkeys + i + 2, job->id, MD5_LEN - 2))
-		{
-			/* Compare mz id (bytes 1-2) */
-			if (!memcmp(job->xkeys + i, job->mz_id, 2)) return true;
-		}
-	}
+	mz_xkeys_index_load(job);
+
+	uint8_t key[XKEY_LN];
+	memcpy(key, job->mz_id, 2);
+	memcpy(key + 2, job->id, XKEY_LN - 2);
 
-	return false;
+	/* Binary search within the keys of this mz_id */
+	uint32_t n = job->mz_id[0] * 256 + job->mz_id[1];
+	uint8_t *found = bsearch(key, xkeys_index.keys + xkeys_index.bucket[n] * XKEY_LN,
+		xkeys_index.bucket[n + 1] - xkeys_index.bucket[n], XKEY_LN, xkey_id_cmp);
+
+	return found != NULL;
 }
 
 /**
@@ -69,21 +182,109 @@ bool mz_id_exists_in_ldb(struct mz_job *job)
 {
 	if (!job->orphan_rm) return true;
 
+	/* Ids were resolved in advance by mz_orphan_scan() */
+	return bsearch(job->id, known_ids.ids, known_ids.count, MZ_MD5, mz_md5_cmp) != NULL;
+}
+
+/**
+ * @brief Record handler for ldb_fetch_recordset(), stops at the first record found
+ */
+static bool mz_file_record_found(uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t datalen, int iteration, void *ptr)
+{
+	return true;
+}
+
+/**
+ * @brief Load the file table sector holding the ids of an mz archive,
+ * reusing the last one loaded when possible
+ * 
+ * @param table file table
+ * @param mz_id archive mz id
+ * @return sector data, NULL if the sector does not exist
+ */
+static uint8_t *mz_file_sector_load(struct ldb_table table, uint8_t *mz_id)
+{
+	if (file_sector.key == *mz_id && !strcmp(file_sector.db, table.db))
+		return file_sector.data;
+
+	free(file_sector.data);
+
+	uint8_t key[MD5_LEN] = {0};
+	memcpy(key, mz_id, 2);
+	file_sector.data = ldb_load_sector(table, key);
+	file_sector.key = *mz_id;
+	strcpy(file_sector.db, table.db);
+
+	return file_sector.data;
+}
+
+/**
+ * @brief Release the file table sector loaded by the calling thread
+ */
+static void mz_file_sector_free(void)
+{
+	free(file_sector.data);
+	file_sector.data = NULL;
+	file_sector.key = -1;
+}
+
+/**
+ * @brief Header walk handler collecting record ids
+ */
+static bool mz_collect_id(struct mz_record *record, void *ptr)
+{
+	struct mz_known_ids *ids = ptr;
+	memcpy(ids->ids + ids->count++ * MZ_MD5, record->id, MZ_MD5);
+	return true;
+}
+
+/**
+ * @brief Find which ids of the archive are present in the LDB file table (-O).
+ * Ids are collected from the record headers (no decompression), sorted and
+ * looked up in the file table sector, which is read only once
+ * 
+ * @param job pointer to mz job
+ */
+static void mz_orphan_scan(struct mz_job *job)
+{
+	/* Collect ids */
+	struct mz_known_ids all;
+	all.ids = malloc(job->mz_ln / MZ_HEAD * MZ_MD5 + MZ_MD5);
+	all.count = 0;
+	mz_walk(job->mz, job->mz_ln, mz_collect_id, &all);
+
+	uint8_t *ids = all.ids;
+	uint64_t count = all.count;
+	qsort(ids, count, MZ_MD5, mz_md5_cmp);
+
 	struct ldb_table oss_file;
-	strcpy(oss_file.db, "oss");
+	strcpy(oss_file.db, mz_dbname);
 	strcpy(oss_file.table, TABLE_NAME_FILE);
 	oss_file.key_ln = 16;
 	oss_file.rec_ln = 0;
 	oss_file.ts_ln = 2;
 	oss_file.tmp = false;
 
-	uint8_t file_id[16];
-	ldb_hex_to_bin(job->md5, 4, file_id);
-	memcpy(file_id + 2, job->id, MZ_MD5);
+	uint8_t *sector = mz_file_sector_load(oss_file, job->mz_id);
 
-	if (!ldb_key_exists(oss_file, file_id)) return false;
+	/* Keep the ids found, dropping duplicates */
+	known_ids.ids = malloc(count * MZ_MD5 + MZ_MD5);
+	known_ids.count = 0;
+	uint8_t file_id[MD5_LEN];
+	memcpy(file_id, job->mz_id, 2);
 
-	return true;
+	for (uint64_t i = 0; i < count && sector; i++)
+	{
+		uint8_t *id = ids + i * MZ_MD5;
+		if (i && !memcmp(id, id - MZ_MD5, MZ_MD5))
+			continue;
+
+		memcpy(file_id + 2, id, MZ_MD5);
+		if (ldb_fetch_recordset(sector, oss_file, file_id, false, mz_file_record_found, NULL))
+			memcpy(known_ids.ids + known_ids.count++ * MZ_MD5, id, MZ_MD5);
+	}
+
+	free(ids);
 }
 
 /**
@@ -102,139 +303,329 @@ bool mz_md5_match(uint8_t *mz1, uint8_t *mz2)
 }
 
 /**
- * @brief Handler function to be passed to mz_parse()
- *		Eliminates duplicated data, unwanted content and (optionally) orphan files (not found in the KB)
+ * @brief Decide on the records waiting in the batch, in archive order, once their MD5 is
+ *		calculated. Eliminates duplicated data, unwanted content and (optionally) orphan files (not found in the KB)
  * 
  * @param job pointer to mz job
- * @return true 
  */
-static bool mz_optimise_handler(struct mz_job *job)
+static void mz_optimise_batch(struct mz_job *job)
 {
-	/* Uncompress */
-	MZ_DEFLATE(job);
-	job->data[job->data_ln] = 0;
-
-	uint8_t md5[16];
-	MD5((uint8_t *)job->data, job->data_ln, md5);
+	md5_batch_run(&batch);
 
-	/* Skip if corrupted file */
-	if (!mz_md5_match(job->id, md5 + 2))
+	for (int i = 0; i < batch.count; i++)
 	{
-		job->igl_c++;
-	}
+		job->id = batch_id[i];
+		job->ln = batch_ln[i];
+		job->data = batch.data[i];
+		job->data_ln = batch.ln[i];
+		uint8_t *md5 = batch.md5[i];
+
+		/* Skip if corrupted file */
+		if (!mz_md5_match(job->id, md5 + 2))
+		{
+			job->igl_c++;
+		}
 
-	/* Check if data contains unwanted header */
-	else if (job->data_ln < MIN_FILE_SIZE)
-	{
-		job->min_c++;
-	}
+		/* Check if data contains unwanted header */
+		else if (job->data_ln < MIN_FILE_SIZE)
+		{
+			job->min_c++;
+		}
 
-	/* Check if data is too square */
-	else if (too_much_squareness(job->data))
-	{
-		job->igl_c++;
-	}
+		/* Check if data is too square */
+		else if (too_much_squareness(job->data))
+		{
+			job->igl_c++;
+		}
 
-	/* Check if data contains unwanted header */
-	else if (unwanted_header(job->data))
-	{
-		job->igl_c++;
-	}
+		/* Check if data contains unwanted header */
+		else if (unwanted_header(job->data))
+		{
+			job->igl_c++;
+		}
 
-	/* Check if file is not duplicated */
-	else if (mz_id_exists(job->ptr, job->ptr_ln, job->id))
-	{
-		job->dup_c++;
+		/* Check if file is not duplicated */
+		else if (mz_id_set_contains(mz_ids, job->id))
+		{
+			job->dup_c++;
+		}
+
+		/* Check if file exists in the LDB */
+		else if (!mz_id_exists_in_ldb(job))
+		{
+			job->orp_c++;
+		}
+
+		else
+		{
+			memcpy(job->ptr + job->ptr_ln, job->id, job->ln);
+			job->ptr_ln += job->ln;
+			mz_id_set_add(mz_ids, job->id);
+		}
 	}
+	batch.count = 0;
+}
 
-	/* Check if mz_id is to be excluded (see -X) */
-	else if (mz_id_excluded(job))
+/**
+ * @brief Handler function to be passed to mz_parse(). Records are inflated into a batch,
+ *		whose MD5s are calculated together (see md5_mb)
+ * 
+ * @param job pointer to mz job
+ * @return true 
+ */
+static bool mz_optimise_handler(struct mz_job *job)
+{
+	/* Excluded records (see -X) are dropped before decompression, so records reported
+	   by mz -c as impossible to decompress can be removed */
+	if (mz_id_excluded(job))
 	{
 		job->exc_c++;
+		return true;
 	}
 
-	/* Check if file exists in the LDB */
-	else if (!mz_id_exists_in_ldb(job))
-	{
-		job->orp_c++;
-	}
+	/* Uncompress */
+	mz_job_inflate(job);
+
+	batch_id[batch.count] = job->id;
+	batch_ln[batch.count] = job->ln;
+	md5_batch_add(&batch, job->data, job->data_ln);
+	if (batch.count == MD5_MB_LANES)
+		mz_optimise_batch(job);
 
-	else
-	{
-		memcpy(job->ptr + job->ptr_ln, job->id, job->ln);
-		job->ptr_ln += job->ln;
-	}
-	free(job->data);
 	return true;
 }
 
-static bool mz_optimise_dup_handler(struct mz_job *job)
+/**
+ * @brief Header walk handler for MZ_OPTIMISE_DUP. Records are copied without decompression,
+ * unless excluded (-X) or already written
+ * 
+ * @param record mz record
+ * @param ptr pointer to mz job
+ * @return true
+ */
+static bool mz_optimise_dup_handler(struct mz_record *record, void *ptr)
 {
-	/* Uncompress */
-	MZ_DEFLATE(job);
-	job->data[job->data_ln] = 0;
-
-	uint8_t md5[16];
-	MD5((uint8_t *)job->data, job->data_ln, md5);
+	struct mz_job *job = ptr;
 
-	/* Check if file is not duplicated */
-	if (mz_id_exists(job->ptr, job->ptr_ln, job->id))
+	job->id = record->id;
+	if (mz_id_excluded(job))
 	{
-		job->dup_c++;
+		job->exc_c++;
+		return true;
 	}
-	else
+
+	if (!mz_id_set_add(mz_ids, record->id))
 	{
-		memcpy(job->ptr + job->ptr_ln, job->id, job->ln);
-		job->ptr_ln += job->ln;
+		job->dup_c++;
+		return true;
 	}
 
-	free(job->data);
-
+	memcpy(job->ptr + job->ptr_ln, record->id, record->ln);
+	job->ptr_ln += record->ln;
 	return true;
 }
 
-
 /**
- * @brief Optimise an mz file removing duplicated data
+ * @brief Optimise an mz archive, without reporting. The archive is rewritten
+ * into a temporary file which then replaces it
  * 
- * @param job pointer to mz job
+ * @param job pointer to mz job (job->path is the archive)
+ * @param mode optimisation mode
+ * @return false if the archive cannot be read or replaced (it is left untouched)
  */
-void mz_optimise(struct mz_job *job, mz_optimise_mode_t mode)
+static bool mz_optimise_archive(struct mz_job *job, mz_optimise_mode_t mode)
 {
 	/* Extract first two MD5 bytes from the file name */
 	memcpy(job->md5, basename(job->path), 4);
 	ldb_hex_to_bin(job->md5, 4, job->mz_id);
 
 	/* Read source mz file into memory */
-	job->mz = file_read(job->path, &job->mz_ln);
+	job->mz = mz_map(job->path, &job->mz_ln);
+	if (!job->mz)
+	{
+		printf("Cannot read %s\n", job->path);
+		return false;
+	}
 
 	/* Reserve memory for destination mz */
-	job->ptr = calloc(job->mz_ln, 1);
+	job->ptr = calloc(job->mz_ln + 1, 1);
+	job->ptr_ln = 0;
+
+	/* Ids written to the destination mz, to detect duplicates */
+	mz_ids = mz_id_set_new(MZ_ID_SET_INITIAL);
+
+	/* Resolve all ids against the LDB at once */
+	if (job->orphan_rm && mode == MZ_OPTIMISE_ALL)
+		mz_orphan_scan(job);
 
 	/* Launch optimisation */
 	switch (mode)
 	{
 	case MZ_OPTIMISE_ALL:
 		mz_parse(job, mz_optimise_handler);
+		mz_optimise_batch(job);
+		md5_batch_free(&batch);
 		break;
 	case MZ_OPTIMISE_DUP:
-		mz_parse(job, mz_optimise_dup_handler);
+		/* Duplicates are found by id, records are copied without decompression */
+		if (!mz_walk(job->mz, job->mz_ln, mz_optimise_dup_handler, job))
+		{
+			printf("[CORRUPTED] %s\n", job->path);
+			exit(EXIT_FAILURE);
+		}
 		break;
 	
 	default:
 		break;
 	}
 	
-	/* Write updated mz file */
-	file_write(job->path, job->ptr, job->ptr_ln);
+	/* Write updated mz file, replacing the original only once complete */
+	bool replaced = file_replace(job->path, job->ptr, job->ptr_ln);
+	if (!replaced)
+	{
+		printf("Cannot replace %s\n", job->path);
+		job->dup_c = job->orp_c = job->igl_c = job->min_c = job->exc_c = 0;
+	}
+
+	/* Index the new archive while it is still in memory */
+	else if (!mz_index_write(job->path, job->ptr, job->ptr_ln))
+		printf("Cannot index %s\n", job->path);
+
+	mz_id_set_free(mz_ids);
+	mz_ids = NULL;
+	free(known_ids.ids);
+	known_ids.ids = NULL;
+	known_ids.count = 0;
+
+	mz_unmap(job->mz, job->mz_ln);
+	free(job->ptr);
+	job->mz = NULL;
+	job->ptr = NULL;
+	return replaced;
+}
+
+/**
+ * @brief Print optimisation counters
+ */
+static void mz_optimise_report(uint32_t dup_c, uint32_t orp_c, uint32_t igl_c, uint32_t min_c, uint32_t exc_c)
+{
+	if (dup_c) printf("%u duplicated files eliminated\n", dup_c);
+	if (orp_c) printf("%u orphan files eliminated\n", orp_c);
+	if (igl_c) printf("%u ignored files eliminated\n", igl_c);
+	if (min_c) printf("%u small files eliminated\n", min_c);
+	if (exc_c) printf("%u keys excluded\n", exc_c);
+}
+
+/**
+ * @brief Optimise an mz file removing duplicated data
+ * 
+ * @param job pointer to mz job
+ * @param mode optimisation mode
+ */
+void mz_optimise(struct mz_job *job, mz_optimise_mode_t mode)
+{
+	if (!mz_optimise_archive(job, mode))
+		exit(EXIT_FAILURE);
+	mz_optimise_report(job->dup_c, job->orp_c, job->igl_c, job->min_c, job->exc_c);
+}
+
+/**
+ * @brief Worker thread optimising archives of a directory until none is left.
+ * With -O, archives are taken by file table sector: all those sharing the first byte of
+ * their mz id go to the same worker, so no two workers hold a copy of the same sector
+ * 
+ * @param ptr pointer to the pool
+ * @return NULL
+ */
+static void *mz_optimise_worker(void *ptr)
+{
+	struct mz_optimise_pool *pool = ptr;
+	struct mz_job job = *pool->job;
+	char *dir = strdup(pool->job->path);
+	bool sectors = job.orphan_rm && pool->mode == MZ_OPTIMISE_ALL;
+
+	while (true)
+	{
+		pthread_mutex_lock(&pool->lock);
+		int first = pool->next;
+		int last = first + 1;
+		if (sectors)
+			while (last < pool->name_count && !strncmp(pool->names[last], pool->names[first], 2))
+				last++;
+		pool->next = last;
+		pthread_mutex_unlock(&pool->lock);
+		if (first >= pool->name_count)
+			break;
+
+		for (int i = first; i < last; i++)
+		{
+			job.dup_c = job.orp_c = job.igl_c = job.min_c = job.exc_c = 0;
+			sprintf(job.path, "%s/%s", dir, pool->names[i]);
+			bool done = mz_optimise_archive(&job, pool->mode);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->archives += done;
+			pool->dup_c += job.dup_c;
+			pool->orp_c += job.orp_c;
+			pool->igl_c += job.igl_c;
+			pool->min_c += job.min_c;
+			pool->exc_c += job.exc_c;
+			pthread_mutex_unlock(&pool->lock);
+		}
 
-	if (job->dup_c) printf("%u duplicated files eliminated\n", job->dup_c);
-	if (job->orp_c) printf("%u orphan files eliminated\n", job->orp_c);
-	if (job->igl_c) printf("%u ignored files eliminated\n", job->igl_c);
-	if (job->min_c) printf("%u small files eliminated\n", job->min_c);
-	if (job->exc_c) printf("%u keys excluded\n", job->exc_c);
+		/* No other archive of this sector is left */
+		mz_file_sector_free();
+	}
 
-	free(job->mz);
+	mz_file_sector_free();
+	free(dir);
+	mz_codec_thread_free();
+	return NULL;
 }
 
+/**
+ * @brief Optimise all mz archives in a directory (i.e. sources/) using a pool of workers
+ * 
+ * @param job pointer to mz job (job->path is the directory)
+ * @param mode optimisation mode
+ * @param threads number of worker threads
+ */
+void mz_optimise_dir(struct mz_job *job, mz_optimise_mode_t mode, int threads)
+{
+	struct mz_optimise_pool pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.job = job;
+	pool.mode = mode;
+
+	/* List archives */
+	pool.names = mz_dir_list(job->path, &pool.name_count);
+	if (!pool.names)
+	{
+		printf("Cannot open directory %s\n", job->path);
+		exit(EXIT_FAILURE);
+	}
 
+	/* Shared read-only data is prepared before workers start */
+	if (job->xkeys_ln)
+		mz_xkeys_index_load(job);
+
+	if (threads > pool.name_count)
+		threads = pool.name_count;
+	if (threads < 1)
+		threads = 1;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_t *workers = calloc(threads, sizeof(pthread_t));
+	for (int t = 1; t < threads; t++)
+		pthread_create(&workers[t], NULL, mz_optimise_worker, &pool);
+	mz_optimise_worker(&pool);
+	for (int t = 1; t < threads; t++)
+		pthread_join(workers[t], NULL);
+	free(workers);
+	pthread_mutex_destroy(&pool.lock);
+
+	printf("%u archives optimised\n", pool.archives);
+	mz_optimise_report(pool.dup_c, pool.orp_c, pool.igl_c, pool.min_c, pool.exc_c);
+
+	mz_dir_list_free(pool.names, pool.name_count);
+}
@@ -0,0 +1,554 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mz_pack.c
+ *
+ * Packed mz table directories
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mz_pack.c
+  * @date 18 Oct 2026
+  * @brief An mz table (i.e. mined/sources) is normally 65536 NNNN.mz files. A packed
+  * table keeps the same sectors in a few large segment files, with an index mapping each
+  * sector to its extents. Loose NNNN.mz files next to a pack are appended to their
+  * sectors, so a packed table can still receive mz_flush() output
+  */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "minr.h"
+#include <ldb.h>
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_index.h"
+#include "mz_codec.h"
+#include "mz_pack.h"
+
+/* Index header, followed by the extents */
+struct mz_pack_header
+{
+	char magic[4];
+	uint32_t count;
+};
+
+/**
+ * @brief Check if a table directory is packed
+ *
+ * @param dir table directory
+ * @return true if it holds a pack index
+ */
+bool mz_pack_exists(char *dir)
+{
+	char path[MAX_PATH_LEN + 16] = "\0";
+	sprintf(path, "%s/"MZ_PACK_INDEX, dir);
+	return is_file(path);
+}
+
+static void mz_pack_segment_path(struct mz_pack *pack, uint16_t segment, char *path)
+{
+	sprintf(path, "%s/"MZ_PACK_NAME".%03d", pack->path, segment);
+}
+
+static int mz_pack_extent_cmp(const void *a, const void *b)
+{
+	const struct mz_pack_extent *x = a;
+	const struct mz_pack_extent *y = b;
+
+	if (x->mz_id != y->mz_id)
+		return x->mz_id - y->mz_id;
+	if (x->segment != y->segment)
+		return x->segment - y->segment;
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/**
+ * @brief Sort the extents by sector (keeping the append order within a sector) and index them
+ *
+ * @param pack open pack
+ */
+static void mz_pack_sort(struct mz_pack *pack)
+{
+	qsort(pack->extents, pack->count, sizeof(struct mz_pack_extent), mz_pack_extent_cmp);
+	pack->sorted = true;
+
+	uint32_t e = 0;
+	for (int i = 0; i <= MZ_FILES; i++)
+	{
+		while (e < pack->count && pack->extents[e].mz_id < i)
+			e++;
+		pack->first[i] = e;
+	}
+}
+
+/**
+ * @brief Open the pack of a table directory. A new pack is created on the first append
+ *
+ * @param dir table directory
+ * @return open pack (close with mz_pack_close), NULL if its index is not valid
+ */
+struct mz_pack *mz_pack_open(char *dir)
+{
+	struct mz_pack *pack = calloc(1, sizeof(struct mz_pack));
+	strcpy(pack->path, dir);
+	pack->first = calloc(MZ_FILES + 1, sizeof(uint32_t));
+
+	char path[MAX_PATH_LEN + 16] = "\0";
+	sprintf(path, "%s/"MZ_PACK_INDEX, dir);
+
+	if (is_file(path))
+	{
+		uint64_t index_ln = 0;
+		uint8_t *index = file_read(path, &index_ln);
+
+		struct mz_pack_header header;
+		memcpy(&header, index, index_ln < sizeof(header) ? index_ln : sizeof(header));
+		if (index_ln < sizeof(header) || memcmp(header.magic, MZ_PACK_MAGIC, sizeof(header.magic)) ||
+			index_ln != sizeof(header) + (uint64_t) header.count * sizeof(struct mz_pack_extent))
+		{
+			printf("Invalid pack index %s\n", path);
+			free(index);
+			free(pack->first);
+			free(pack);
+			return NULL;
+		}
+
+		pack->count = pack->size = header.count;
+		pack->extents = malloc(pack->count * sizeof(struct mz_pack_extent) + 1);
+		memcpy(pack->extents, index + sizeof(header), pack->count * sizeof(struct mz_pack_extent));
+		free(index);
+	}
+
+	/* Appends go to the last segment */
+	for (uint32_t i = 0; i < pack->count; i++)
+		if (pack->extents[i].segment > pack->segment)
+			pack->segment = pack->extents[i].segment;
+	mz_pack_segment_path(pack, pack->segment, path);
+	pack->segment_ln = is_file(path) ? file_size(path) : 0;
+
+	mz_pack_sort(pack);
+	return pack;
+}
+
+/**
+ * @brief Close a pack, saving its index if it changed (into a temporary file renamed over it)
+ *
+ * @param pack open pack
+ * @return false if the index cannot be saved
+ */
+bool mz_pack_close(struct mz_pack *pack)
+{
+	bool ok = true;
+
+	if (pack->changed)
+	{
+		char path[MAX_PATH_LEN + 16] = "\0";
+		char tmp[MAX_PATH_LEN + 32] = "\0";
+		sprintf(path, "%s/"MZ_PACK_INDEX, pack->path);
+		sprintf(tmp, "%s.tmp", path);
+
+		struct mz_pack_header header;
+		memcpy(header.magic, MZ_PACK_MAGIC, sizeof(header.magic));
+		header.count = pack->count;
+
+		FILE *fp = fopen(tmp, "wb");
+		ok = (fp != NULL);
+		if (ok)
+		{
+			ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+			if (pack->count)
+				ok &= fwrite(pack->extents, sizeof(struct mz_pack_extent), pack->count, fp) == pack->count;
+			ok &= !fclose(fp);
+			ok = ok && !rename(tmp, path);
+		}
+
+		if (!ok)
+			printf("Cannot write pack index %s\n", path);
+	}
+
+	free(pack->extents);
+	free(pack->first);
+	free(pack);
+	return ok;
+}
+
+/**
+ * @brief Read a sector from a pack
+ *
+ * @param pack open pack
+ * @param mz_id sector
+ * @param[out] ln sector size
+ * @return sector contents (to be freed), NULL if the pack has no data for it
+ */
+uint8_t *mz_pack_read(struct mz_pack *pack, uint16_t mz_id, uint64_t *ln)
+{
+	*ln = 0;
+	if (!pack->sorted)
+		mz_pack_sort(pack);
+
+	uint32_t first = pack->first[mz_id];
+	uint32_t last = pack->first[mz_id + 1];
+	if (first == last)
+		return NULL;
+
+	for (uint32_t e = first; e < last; e++)
+		*ln += pack->extents[e].ln;
+
+	uint8_t *data = malloc(*ln + 1);
+	uint64_t ptr = 0;
+	char path[MAX_PATH_LEN + 16] = "\0";
+
+	for (uint32_t e = first; e < last; e++)
+	{
+		struct mz_pack_extent *extent = &pack->extents[e];
+		mz_pack_segment_path(pack, extent->segment, path);
+
+		int fd = open(path, O_RDONLY);
+		bool ok = (fd >= 0 && pread(fd, data + ptr, extent->ln, extent->offset) == extent->ln);
+		if (fd >= 0)
+			close(fd);
+
+		if (!ok)
+		{
+			printf("Cannot read %s\n", path);
+			exit(EXIT_FAILURE);
+		}
+		ptr += extent->ln;
+	}
+
+	return data;
+}
+
+/**
+ * @brief Append data to a sector of a pack. The index is saved by mz_pack_close()
+ *
+ * @param pack open pack
+ * @param mz_id sector
+ * @param data mz records
+ * @param ln data size
+ * @return false if the segment cannot be written
+ */
+bool mz_pack_append(struct mz_pack *pack, uint16_t mz_id, uint8_t *data, uint64_t ln)
+{
+	if (!ln)
+		return true;
+
+	/* Start a new segment when the current one is full */
+	if (pack->segment_ln && pack->segment_ln + ln > MZ_PACK_SEGMENT_LN)
+	{
+		pack->segment++;
+		pack->segment_ln = 0;
+	}
+
+	char path[MAX_PATH_LEN + 16] = "\0";
+	mz_pack_segment_path(pack, pack->segment, path);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = (write(fd, data, ln) == ln);
+	close(fd);
+	if (!ok)
+		return false;
+
+	if (pack->count == pack->size)
+	{
+		pack->size = pack->size ? 2 * pack->size : 4096;
+		pack->extents = realloc(pack->extents, pack->size * sizeof(struct mz_pack_extent));
+	}
+
+	struct mz_pack_extent *extent = &pack->extents[pack->count++];
+	memset(extent, 0, sizeof(*extent));
+	extent->offset = pack->segment_ln;
+	extent->ln = ln;
+	extent->mz_id = mz_id;
+	extent->segment = pack->segment;
+
+	pack->segment_ln += ln;
+	pack->changed = true;
+	pack->sorted = false;
+	return true;
+}
+
+/**
+ * @brief Read a sector of a table directory: pack extents first, then the loose NNNN.mz file
+ *
+ * @param dir table directory
+ * @param pack open pack of the directory, or NULL
+ * @param mz_id sector
+ * @param[out] ln sector size
+ * @return sector contents (to be freed), NULL if empty
+ */
+uint8_t *mz_sector_read(char *dir, struct mz_pack *pack, uint16_t mz_id, uint64_t *ln)
+{
+	uint64_t packed_ln = 0;
+	uint8_t *data = pack ? mz_pack_read(pack, mz_id, &packed_ln) : NULL;
+
+	char path[MAX_PATH_LEN + 16] = "\0";
+	sprintf(path, "%s/%04x.mz", dir, mz_id);
+	uint64_t loose_ln = is_file(path) ? file_size(path) : 0;
+
+	*ln = packed_ln + loose_ln;
+	if (!loose_ln)
+		return data;
+
+	data = realloc(data, *ln + 1);
+	int fd = open(path, O_RDONLY);
+	bool ok = (fd >= 0 && pread(fd, data + packed_ln, loose_ln, 0) == loose_ln);
+	if (fd >= 0)
+		close(fd);
+
+	if (!ok)
+	{
+		printf("Cannot read %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+/**
+ * @brief List the sectors of a packed table directory holding data, packed or loose
+ *
+ * @param pack open pack
+ * @param[out] count number of sectors
+ * @return sector names as NNNN.mz (free with mz_dir_list_free)
+ */
+char **mz_pack_list(struct mz_pack *pack, int *count)
+{
+	if (!pack->sorted)
+		mz_pack_sort(pack);
+
+	char **names = malloc(MZ_FILES * sizeof(char *));
+	char path[MAX_PATH_LEN + 16] = "\0";
+	*count = 0;
+
+	for (int i = 0; i < MZ_FILES; i++)
+	{
+		sprintf(path, "%s/%04x.mz", pack->path, i);
+		if (pack->first[i] == pack->first[i + 1] && !(is_file(path) && file_size(path)))
+			continue;
+		names[*count] = malloc(8);
+		sprintf(names[(*count)++], "%04x.mz", i);
+	}
+	return names;
+}
+
+/**
+ * @brief Remove the pack of a table directory (index and segments), leaving loose files
+ *
+ * @param dir table directory
+ */
+void mz_pack_remove(char *dir)
+{
+	DIR *dp = opendir(dir);
+	if (!dp)
+		return;
+
+	char path[MAX_PATH_LEN + 256] = "\0";
+	struct dirent *entry;
+	while ((entry = readdir(dp)))
+	{
+		if (strncmp(entry->d_name, MZ_PACK_NAME".", strlen(MZ_PACK_NAME) + 1))
+			continue;
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		unlink(path);
+	}
+	closedir(dp);
+}
+
+/**
+ * @brief Move the loose NNNN.mz files of a table directory into its pack
+ *
+ * @param dir table directory
+ * @return false on error (loose files are only removed once the pack index is saved)
+ */
+bool mz_pack_convert(char *dir)
+{
+	struct mz_pack *pack = mz_pack_open(dir);
+	if (!pack)
+		return false;
+
+	int count = 0;
+	char **names = mz_dir_list(dir, &count);
+	char path[MAX_PATH_LEN + 16] = "\0";
+	bool ok = true;
+
+	for (int i = 0; i < count && ok; i++)
+	{
+		sprintf(path, "%s/%s", dir, names[i]);
+		uint64_t ln = 0;
+		uint8_t *data = file_read(path, &ln);
+		uint8_t mz_id[2];
+		ldb_hex_to_bin(names[i], 4, mz_id);
+
+		ok = mz_pack_append(pack, mz_id[0] * 256 + mz_id[1], data, ln);
+		if (!ok)
+			printf("Cannot pack %s\n", path);
+		free(data);
+	}
+
+	ok &= mz_pack_close(pack);
+
+	if (ok)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			sprintf(path, "%s/%s", dir, names[i]);
+			unlink(path);
+			mz_index_remove(path);
+		}
+		printf("%d files packed into %s\n", count, dir);
+	}
+
+	mz_dir_list_free(names, count);
+	return ok;
+}
+
+/**
+ * @brief Write the sectors of a pack back as NNNN.mz files and remove the pack
+ *
+ * @param dir table directory
+ * @return false on error (the pack is only removed once all files are written)
+ */
+bool mz_unpack_convert(char *dir)
+{
+	if (!mz_pack_exists(dir))
+	{
+		printf("%s is not packed\n", dir);
+		return false;
+	}
+
+	struct mz_pack *pack = mz_pack_open(dir);
+	if (!pack)
+		return false;
+
+	char path[MAX_PATH_LEN + 16] = "\0";
+	char tmp[MAX_PATH_LEN + 32] = "\0";
+	int count = 0;
+
+	/* Every sector is written (and synced) to NNNN.mz.tmp before any file is replaced,
+	   since a sector found both loose and packed would be read twice */
+	int failed = -1;
+	for (int i = 0; i < MZ_FILES && failed < 0; i++)
+	{
+		if (pack->first[i] == pack->first[i + 1])
+			continue;
+
+		/* Loose data goes after the packed data */
+		uint64_t ln = 0;
+		uint8_t *data = mz_sector_read(dir, pack, i, &ln);
+		sprintf(tmp, "%s/%04x.mz.tmp", dir, i);
+		if (!file_write_synced(tmp, data, ln))
+			failed = i;
+		free(data);
+	}
+
+	if (failed >= 0)
+	{
+		printf("Cannot write %s\n", tmp);
+		for (int i = 0; i < failed; i++)
+			if (pack->first[i] != pack->first[i + 1])
+			{
+				sprintf(tmp, "%s/%04x.mz.tmp", dir, i);
+				unlink(tmp);
+			}
+		mz_pack_close(pack);
+		return false;
+	}
+
+	for (int i = 0; i < MZ_FILES; i++)
+	{
+		if (pack->first[i] == pack->first[i + 1])
+			continue;
+
+		sprintf(path, "%s/%04x.mz", dir, i);
+		sprintf(tmp, "%s.tmp", path);
+		if (rename(tmp, path))
+		{
+			printf("Cannot write %s\n", path);
+			mz_pack_close(pack);
+			return false;
+		}
+		count++;
+	}
+	if (count)
+		sync_parent(path);
+
+	mz_pack_close(pack);
+	mz_pack_remove(dir);
+	printf("%d files unpacked into %s\n", count, dir);
+	return true;
+}
+
+/* State of an mz_pack_cat() walk */
+struct mz_pack_cat_state
+{
+	uint8_t *id;
+	struct mz_record record;
+	bool found;
+};
+
+static bool mz_pack_cat_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_pack_cat_state *state = ptr;
+	if (memcmp(record->id, state->id, MZ_MD5))
+		return true;
+
+	state->record = *record;
+	state->found = true;
+	return false;
+}
+
+/**
+ * @brief Extract a file from a packed table directory to STDOUT
+ *
+ * @param dir table directory
+ * @param key file MD5 (hex)
+ * @return false if the sector cannot be walked or the file cannot be decompressed
+ */
+bool mz_pack_cat(char *dir, char *key)
+{
+	uint8_t md5[MD5_LEN];
+	ldb_hex_to_bin(key, MD5_LEN * 2, md5);
+
+	struct mz_pack *pack = mz_pack_open(dir);
+	if (!pack)
+		return false;
+
+	uint64_t mz_ln = 0;
+	uint8_t *mz = mz_sector_read(dir, pack, md5[0] * 256 + md5[1], &mz_ln);
+	mz_pack_close(pack);
+
+	struct mz_pack_cat_state state;
+	memset(&state, 0, sizeof(state));
+	state.id = md5 + 2;
+
+	bool ok = !mz || mz_walk(mz, mz_ln, mz_pack_cat_handler, &state);
+	if (ok && state.found)
+	{
+		uint64_t data_ln = 0;
+		char *data = mz_inflate_buffer(state.record.zdata, state.record.zdata_ln, &data_ln);
+		ok = (data != NULL);
+		if (ok)
+			fwrite(data, 1, data_ln, stdout);
+	}
+
+	free(mz);
+	return ok;
+}
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mz_verify.c
+ *
+ * Parallel integrity verification of mz table directories
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mz_verify.c
+  * @date 18 Oct 2026
+  * @brief Verify every record of the archives in a directory (framing, decompression and
+  * MD5 against the archive name and record id) with a pool of workers. Corrupted records
+  * are reported in a CSV file with their archive offsets, and their keys are written
+  * in the format read by mz -X, so they can be dropped with mz -o
+  */
+
+#include <libgen.h>
+#include <pthread.h>
+
+#include "minr.h"
+#include <ldb.h>
+#include "file.h"
+#include "mz_walk.h"
+#include "mz_codec.h"
+#include "mz_pack.h"
+#include "mz_verify.h"
+#include "md5_mb.h"
+
+static const char *mz_verify_errors[] = {"framing", "inflate", "md5"};
+
+/* A corrupted record */
+struct mz_verify_entry
+{
+	int archive;                // index in the archive names
+	uint64_t offset;            // record offset in the archive (or packed sector)
+	uint8_t key[MD5_LEN];       // archive mz_id (2 bytes) followed by the record id
+	mz_verify_error_t error;
+};
+
+/* Archives being verified by a pool of workers */
+struct mz_verify_pool
+{
+	char *dir;
+	struct mz_pack *pack;       // pack of the directory, if packed (read-only while verifying)
+	char **names;
+	int name_count;
+	int next;                   // next archive to be verified
+	pthread_mutex_t lock;
+};
+
+/* State of a verification worker */
+struct mz_verify_worker
+{
+	struct mz_verify_pool *pool;
+	int archive;                // archive being walked
+	uint8_t mz_id[2];
+	struct mz_verify_entry *entries;
+	uint32_t entry_count;
+	uint64_t records;
+	uint32_t errors[3];
+	struct md5_batch batch;     // inflated records waiting for their MD5
+	uint64_t batch_offset[MD5_MB_LANES];
+	uint8_t *batch_id[MD5_MB_LANES];
+};
+
+static void mz_verify_add(struct mz_verify_worker *w, uint64_t offset, uint8_t *id, mz_verify_error_t error)
+{
+	w->entries = realloc(w->entries, (w->entry_count + 1) * sizeof(struct mz_verify_entry));
+	struct mz_verify_entry *entry = &w->entries[w->entry_count++];
+	memset(entry, 0, sizeof(*entry));
+	entry->archive = w->archive;
+	entry->offset = offset;
+	entry->error = error;
+	memcpy(entry->key, w->mz_id, 2);
+	if (id)
+		memcpy(entry->key + 2, id, MZ_MD5);
+	w->errors[error]++;
+}
+
+/* Check the MD5 of the inflated records waiting in the batch */
+static void mz_verify_batch(struct mz_verify_worker *w)
+{
+	md5_batch_run(&w->batch);
+	for (int i = 0; i < w->batch.count; i++)
+	{
+		uint8_t *md5 = w->batch.md5[i];
+		if (memcmp(md5, w->mz_id, 2) || memcmp(md5 + 2, w->batch_id[i], MZ_MD5))
+			mz_verify_add(w, w->batch_offset[i], w->batch_id[i], MZ_VERIFY_MD5);
+	}
+	w->batch.count = 0;
+}
+
+/**
+ * @brief Header walk handler: inflate the record, its MD5 is checked along with the
+ * next ones (see md5_mb)
+ *
+ * @param record mz record
+ * @param ptr pointer to the worker state
+ * @return true
+ */
+static bool mz_verify_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_verify_worker *w = ptr;
+	w->records++;
+
+	uint64_t data_ln = 0;
+	char *data = mz_inflate_buffer(record->zdata, record->zdata_ln, &data_ln);
+	if (!data)
+	{
+		mz_verify_add(w, record->offset, record->id, MZ_VERIFY_INFLATE);
+		return true;
+	}
+
+	w->batch_offset[w->batch.count] = record->offset;
+	w->batch_id[w->batch.count] = record->id;
+	md5_batch_add(&w->batch, data, data_ln);
+	if (w->batch.count == MD5_MB_LANES)
+		mz_verify_batch(w);
+
+	return true;
+}
+
+/* Keeps the offset where a header walk stops, to report framing errors */
+static bool mz_verify_last_handler(struct mz_record *record, void *ptr)
+{
+	uint64_t *end = ptr;
+	*end = record->offset + record->ln;
+	return true;
+}
+
+/**
+ * @brief Worker thread verifying archives until none is left
+ *
+ * @param ptr pointer to the worker state
+ * @return NULL
+ */
+static void *mz_verify_worker(void *ptr)
+{
+	struct mz_verify_worker *w = ptr;
+	struct mz_verify_pool *pool = w->pool;
+	char path[MAX_PATH_LEN + 16] = "\0";
+
+	while (true)
+	{
+		pthread_mutex_lock(&pool->lock);
+		int i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->name_count)
+			break;
+
+		if (pool->dir)
+			sprintf(path, "%s/%s", pool->dir, pool->names[i]);
+		else
+			strcpy(path, pool->names[i]);
+
+		w->archive = i;
+		ldb_hex_to_bin(basename(path), 4, w->mz_id);
+
+		uint64_t mz_ln = 0;
+		uint8_t *mz = NULL;
+		if (pool->pack)
+			mz = mz_sector_read(pool->dir, pool->pack, w->mz_id[0] * 256 + w->mz_id[1], &mz_ln);
+		else
+			mz = mz_map(path, &mz_ln);
+
+		if (!mz && !pool->pack)
+		{
+			printf("Cannot read %s\n", path);
+			mz_verify_add(w, 0, NULL, MZ_VERIFY_FRAMING);
+			continue;
+		}
+
+		/* Records after a framing error cannot be located */
+		bool framed = mz_walk(mz, mz_ln, mz_verify_handler, w);
+		mz_verify_batch(w);
+		if (!framed)
+		{
+			uint64_t end = 0;
+			mz_walk(mz, mz_ln, mz_verify_last_handler, &end);
+			mz_verify_add(w, end, NULL, MZ_VERIFY_FRAMING);
+		}
+
+		if (pool->pack)
+			free(mz);
+		else
+			mz_unmap(mz, mz_ln);
+	}
+
+	md5_batch_free(&w->batch);
+	mz_codec_thread_free();
+	return NULL;
+}
+
+static int mz_verify_entry_cmp(const void *a, const void *b)
+{
+	const struct mz_verify_entry *x = a;
+	const struct mz_verify_entry *y = b;
+	if (x->archive != y->archive)
+		return x->archive - y->archive;
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/**
+ * @brief Write the corrupted records found: report.csv lists archive, offset, key and error,
+ * and report.keys holds the keys of the records with a readable header (see mz -X)
+ *
+ * @param pool verification pool
+ * @param entries corrupted records, sorted
+ * @param count number of corrupted records
+ * @param report report path, without extension
+ * @return false if the files cannot be written
+ */
+static bool mz_verify_report(struct mz_verify_pool *pool, struct mz_verify_entry *entries, uint32_t count, char *report)
+{
+	char path[MAX_PATH_LEN + 16] = "\0";
+	sprintf(path, "%s.csv", report);
+	FILE *csv = fopen(path, "w");
+	sprintf(path, "%s.keys", report);
+	FILE *keys = fopen(path, "wb");
+
+	bool ok = (csv && keys);
+	char hex[MD5_LEN * 2 + 1] = "\0";
+	char archive[MAX_PATH_LEN + 16] = "\0";
+
+	for (uint32_t i = 0; ok && i < count; i++)
+	{
+		struct mz_verify_entry *entry = &entries[i];
+		if (pool->dir)
+			sprintf(archive, "%s/%s", pool->dir, pool->names[entry->archive]);
+		else
+			strcpy(archive, pool->names[entry->archive]);
+
+		if (entry->error == MZ_VERIFY_FRAMING)
+			*hex = 0;
+		else
+		{
+			ldb_bin_to_hex(entry->key, MD5_LEN, hex);
+			ok &= fwrite(entry->key, MD5_LEN, 1, keys) == 1;
+		}
+		ok &= fprintf(csv, "%s,%lu,%s,%s\n", archive, entry->offset, hex, mz_verify_errors[entry->error]) > 0;
+	}
+
+	if (csv)
+		ok &= !fclose(csv);
+	if (keys)
+		ok &= !fclose(keys);
+	if (!ok)
+		printf("Cannot write report %s.csv\n", report);
+	return ok;
+}
+
+/**
+ * @brief Verify every record of an mz archive, or of all the archives in a directory
+ * (which may be packed). A summary is printed and corrupted records are reported
+ * in report.csv and report.keys
+ *
+ * @param path mz archive or directory
+ * @param report report path, without extension
+ * @param threads number of worker threads
+ * @return true if no corrupted records were found
+ */
+bool mz_verify(char *path, char *report, int threads)
+{
+	struct mz_verify_pool pool;
+	memset(&pool, 0, sizeof(pool));
+
+	if (is_dir(path))
+	{
+		pool.dir = path;
+		if (mz_pack_exists(path))
+		{
+			pool.pack = mz_pack_open(path);
+			if (!pool.pack)
+				return false;
+			pool.names = mz_pack_list(pool.pack, &pool.name_count);
+		}
+		else
+			pool.names = mz_dir_list(path, &pool.name_count);
+	}
+	else
+	{
+		pool.names = malloc(sizeof(char *));
+		pool.names[0] = strdup(path);
+		pool.name_count = 1;
+	}
+
+	if (threads > pool.name_count)
+		threads = pool.name_count;
+	if (threads < 1)
+		threads = 1;
+
+	struct mz_verify_worker *workers = calloc(threads, sizeof(struct mz_verify_worker));
+	pthread_t *tids = calloc(threads, sizeof(pthread_t));
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].pool = &pool;
+		if (t)
+			pthread_create(&tids[t], NULL, mz_verify_worker, &workers[t]);
+	}
+	mz_verify_worker(&workers[0]);
+	for (int t = 1; t < threads; t++)
+		pthread_join(tids[t], NULL);
+
+	/* Gather the corrupted records of all workers */
+	uint64_t records = 0;
+	uint32_t errors[3] = {0, 0, 0};
+	uint32_t count = 0;
+	struct mz_verify_entry *entries = NULL;
+
+	for (int t = 0; t < threads; t++)
+	{
+		records += workers[t].records;
+		for (int e = 0; e < 3; e++)
+			errors[e] += workers[t].errors[e];
+
+		entries = realloc(entries, (count + workers[t].entry_count) * sizeof(struct mz_verify_entry) + 1);
+		memcpy(entries + count, workers[t].entries, workers[t].entry_count * sizeof(struct mz_verify_entry));
+		count += workers[t].entry_count;
+		free(workers[t].entries);
+	}
+	qsort(entries, count, sizeof(struct mz_verify_entry), mz_verify_entry_cmp);
+
+	printf("%d archives, %lu records verified", pool.name_count, records);
+	printf(", %u framing errors, %u inflate errors, %u MD5 mismatches\n", errors[0], errors[1], errors[2]);
+
+	bool ok = !count;
+	if (count && mz_verify_report(&pool, entries, count, report))
+		printf("Corrupted records listed in %s.csv, keys in %s.keys (see -X)\n", report, report);
+
+	pthread_mutex_destroy(&pool.lock);
+	if (pool.pack)
+		mz_pack_close(pool.pack);
+	free(entries);
+	free(tids);
+	free(workers);
+	mz_dir_list_free(pool.names, pool.name_count);
+	return ok;
+}
@@ -0,0 +1,418 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/mz_walk.c
+ *
+ * Header-only access to mz archives
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file mz_walk.c
+  * @date 18 Oct 2026
+  * @brief Walk mz archives through their record headers (id and compressed length),
+  * skipping payloads by offset. Used where records are kept or dropped by id only
+  */
+
+#include <libgen.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "minr.h"
+#include "file.h"
+#include <ldb.h>
+#include "mz_walk.h"
+
+/* Returned by mz_map() for empty archives */
+static uint8_t mz_empty[1];
+
+/**
+ * @brief Map an mz archive into memory for a sequential pass, instead of reading it
+ * into the heap. The mapping is private, so the archive can be replaced (renamed over)
+ * while mapped, and records can be modified in place without touching the file
+ * 
+ * @param path mz file path
+ * @param[out] mz_ln archive size
+ * @return archive contents (release with mz_unmap), NULL if it cannot be read
+ */
+uint8_t *mz_map(char *path, uint64_t *mz_ln)
+{
+	*mz_ln = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if (!st.st_size)
+	{
+		close(fd);
+		return mz_empty;
+	}
+
+	uint8_t *mz = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mz == MAP_FAILED)
+		return NULL;
+
+	madvise(mz, st.st_size, MADV_SEQUENTIAL);
+	*mz_ln = st.st_size;
+	return mz;
+}
+
+/**
+ * @brief Release an archive mapped by mz_map()
+ * 
+ * @param mz archive contents
+ * @param mz_ln archive size
+ */
+void mz_unmap(uint8_t *mz, uint64_t mz_ln)
+{
+	if (mz && mz_ln)
+		munmap(mz, mz_ln);
+}
+
+/**
+ * @brief Hash an mz id. Ids are MD5 fragments, so their first bytes are already well distributed
+ * 
+ * @param id pointer to the id
+ * @return hash value
+ */
+static inline uint64_t mz_id_hash(uint8_t *id)
+{
+	uint64_t hash;
+	memcpy(&hash, id, sizeof(hash));
+	return hash;
+}
+
+/**
+ * @brief Create an id set
+ * 
+ * @param size initial number of slots (power of two)
+ * @return new id set
+ */
+struct mz_id_set *mz_id_set_new(uint64_t size)
+{
+	struct mz_id_set *set = calloc(1, sizeof(struct mz_id_set));
+	set->size = size;
+	set->ids = malloc(size * MZ_MD5);
+	set->used = calloc(size, sizeof(bool));
+	return set;
+}
+
+void mz_id_set_free(struct mz_id_set *set)
+{
+	if (!set)
+		return;
+	free(set->ids);
+	free(set->used);
+	free(set);
+}
+
+/**
+ * @brief Find the slot holding an id, or the empty slot where it would go
+ * 
+ * @param set id set
+ * @param id id to look for
+ * @return slot number
+ */
+static uint64_t mz_id_set_slot(struct mz_id_set *set, uint8_t *id)
+{
+	uint64_t mask = set->size - 1;
+	uint64_t slot = mz_id_hash(id) & mask;
+
+	while (set->used[slot] && memcmp(set->ids + slot * MZ_MD5, id, MZ_MD5))
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+/**
+ * @brief Check if an id is in the set
+ * 
+ * @param set id set
+ * @param id id to look for
+ * @return true if found
+ */
+bool mz_id_set_contains(struct mz_id_set *set, uint8_t *id)
+{
+	return set->used[mz_id_set_slot(set, id)];
+}
+
+/**
+ * @brief Add an id to the set, doubling its size when half full
+ * 
+ * @param set id set
+ * @param id id to be added
+ * @return false if the id was already in the set
+ */
+bool mz_id_set_add(struct mz_id_set *set, uint8_t *id)
+{
+	if (2 * (set->count + 1) > set->size)
+	{
+		struct mz_id_set *grown = mz_id_set_new(set->size * 2);
+		for (uint64_t i = 0; i < set->size; i++)
+			if (set->used[i])
+				mz_id_set_add(grown, set->ids + i * MZ_MD5);
+
+		free(set->ids);
+		free(set->used);
+		*set = *grown;
+		free(grown);
+	}
+
+	uint64_t slot = mz_id_set_slot(set, id);
+	if (set->used[slot])
+		return false;
+
+	memcpy(set->ids + slot * MZ_MD5, id, MZ_MD5);
+	set->used[slot] = true;
+	set->count++;
+	return true;
+}
+
+/**
+ * @brief Walk the records of an mz archive without decompressing them
+ * 
+ * @param mz archive contents
+ * @param mz_ln archive size
+ * @param handler function called for each record, returning false to stop
+ * @param ptr pointer passed to the handler
+ * @return false if the archive framing is broken
+ */
+bool mz_walk(uint8_t *mz, uint64_t mz_ln, mz_walk_handler handler, void *ptr)
+{
+	struct mz_record record;
+	uint64_t offset = 0;
+
+	while (offset < mz_ln)
+	{
+		if (offset + MZ_HEAD > mz_ln)
+			return false;
+
+		record.id = mz + offset;
+		memcpy(&record.zdata_ln, mz + offset + MZ_MD5, MZ_SIZE);
+		record.zdata = mz + offset + MZ_HEAD;
+		record.offset = offset;
+		record.ln = MZ_HEAD + (uint64_t) record.zdata_ln;
+
+		if (offset + record.ln > mz_ln)
+			return false;
+
+		if (!handler(&record, ptr))
+			break;
+
+		offset += record.ln;
+	}
+
+	return true;
+}
+
+/* State of an mz_dedup() walk */
+struct mz_dedup_state
+{
+	struct mz_id_set *ids;
+	uint8_t *out;
+	uint64_t out_ln;
+	uint32_t dup_c;
+};
+
+static bool mz_dedup_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_dedup_state *state = ptr;
+
+	if (!mz_id_set_add(state->ids, record->id))
+	{
+		state->dup_c++;
+		return true;
+	}
+
+	memcpy(state->out + state->out_ln, record->id, record->ln);
+	state->out_ln += record->ln;
+	return true;
+}
+
+/**
+ * @brief Copy the records of an mz archive verbatim, dropping repeated ids
+ * 
+ * @param mz archive contents
+ * @param mz_ln archive size
+ * @param out output buffer (mz_ln bytes at most are written)
+ * @param[out] dup_c incremented with the number of duplicates removed
+ * @return output size
+ */
+uint64_t mz_dedup(uint8_t *mz, uint64_t mz_ln, uint8_t *out, uint32_t *dup_c)
+{
+	struct mz_dedup_state state;
+	state.ids = mz_id_set_new(MZ_ID_SET_INITIAL);
+	state.out = out;
+	state.out_ln = 0;
+	state.dup_c = 0;
+
+	if (!mz_walk(mz, mz_ln, mz_dedup_handler, &state))
+	{
+		printf("[CORRUPTED]\n");
+		exit(EXIT_FAILURE);
+	}
+
+	mz_id_set_free(state.ids);
+	*dup_c += state.dup_c;
+	return state.out_ln;
+}
+
+/**
+ * @brief Remove duplicated records from an mz file. The file is only
+ * rewritten (into a temporary file renamed over it) if duplicates are found
+ * 
+ * @param path mz file path
+ * @param[out] dup_c incremented with the number of duplicates removed
+ * @return true on success
+ */
+bool mz_dedup_file(char *path, uint32_t *dup_c)
+{
+	uint64_t mz_ln = 0;
+	uint8_t *mz = mz_map(path, &mz_ln);
+	if (!mz)
+		return false;
+
+	uint8_t *out = malloc(mz_ln + 1);
+	uint32_t found = 0;
+	uint64_t out_ln = mz_dedup(mz, mz_ln, out, &found);
+
+	bool ok = true;
+	if (found)
+		ok = file_replace(path, out, out_ln);
+
+	*dup_c += found;
+	mz_unmap(mz, mz_ln);
+	free(out);
+	return ok;
+}
+
+/* State of an mz_dump_keys() walk */
+struct mz_keys_state
+{
+	struct mz_id_set *ids;
+	uint8_t mz_id[2];
+};
+
+static bool mz_keys_handler(struct mz_record *record, void *ptr)
+{
+	struct mz_keys_state *state = ptr;
+
+	if (mz_id_set_add(state->ids, record->id))
+	{
+		fwrite(state->mz_id, 2, 1, stdout);
+		fwrite(record->id, MZ_MD5, 1, stdout);
+	}
+	return true;
+}
+
+/**
+ * @brief Write the unique keys of an mz file to STDOUT (binary). Each key is
+ * the mz id (2 bytes, from the file name) followed by the record id, as used by -X
+ * 
+ * @param path mz file path
+ * @return false if the archive cannot be read or its framing is broken
+ */
+bool mz_dump_keys(char *path)
+{
+	uint64_t mz_ln = 0;
+	uint8_t *mz = mz_map(path, &mz_ln);
+	if (!mz)
+		return false;
+
+	struct mz_keys_state state;
+	state.ids = mz_id_set_new(MZ_ID_SET_INITIAL);
+	ldb_hex_to_bin(basename(path), 4, state.mz_id);
+
+	bool ok = mz_walk(mz, mz_ln, mz_keys_handler, &state);
+
+	mz_id_set_free(state.ids);
+	mz_unmap(mz, mz_ln);
+	return ok;
+}
+
+/**
+ * @brief Check if a file name is an mz archive name (i.e. 0a1f.mz)
+ * 
+ * @param name file name
+ * @return true if it is
+ */
+static bool mz_archive_name(char *name)
+{
+	if (strlen(name) != 7 || strcmp(name + 4, ".mz"))
+		return false;
+	for (int i = 0; i < 4; i++)
+		if (!isxdigit(name[i]))
+			return false;
+	return true;
+}
+
+static int mz_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+/**
+ * @brief List the mz archives in a directory, sorted by name
+ * 
+ * @param path directory path
+ * @param[out] count number of archives
+ * @return archive names (free with mz_dir_list_free), NULL if the directory cannot be open
+ */
+char **mz_dir_list(char *path, int *count)
+{
+	*count = 0;
+	DIR *dp = opendir(path);
+	if (!dp)
+		return NULL;
+
+	int size = 1024;
+	char **names = malloc(size * sizeof(char *));
+	struct dirent *entry;
+	while ((entry = readdir(dp)))
+	{
+		if (!mz_archive_name(entry->d_name))
+			continue;
+		if (*count == size)
+		{
+			size *= 2;
+			names = realloc(names, size * sizeof(char *));
+		}
+		names[(*count)++] = strdup(entry->d_name);
+	}
+	closedir(dp);
+
+	qsort(names, *count, sizeof(char *), mz_name_cmp);
+	return names;
+}
+
+void mz_dir_list_free(char **names, int count)
+{
+	for (int i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+}
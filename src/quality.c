@@ -31,103 +31,54 @@
 #include "minr.h"
 #include "license.h"
 #include "quality.h"
+#include "content.h"
+#include "sink.h"
 
 /**
- * @brief Mine quality statistics from the code
+ * @brief Output the quality score of the code, from the statistics collected by content_scan
  * 
- * @param mined_path path to mine
+ * @param out quality csv sink (NULL prints to stdout)
  * @param md5 file mdz
- * @param src pointer to data source
+ * @param stats content statistics
  * @param size data size
  */
-void mine_quality(char *mined_path, char *md5, char *src, long size)
+void mine_quality_scanned(struct sink *out, char *md5, struct content_stats *stats, long size)
 {
 	/* Skip files below MIN_FILE_SIZE */
 	if (size < MIN_FILE_SIZE) return;
 
-	char *s = src;
-	int bytes = 0;
-	int lines = 0;
-	int comments = 0;
-	int longest_line = 0;
-	int line_length = 0;
-	int relevant_bytes = 0;
-	bool line_start = true;
-	bool tab_start = false;
-	bool space_start = false;
-	bool spdx_tag = false;
-
-	/* Ready byte by byte */
-	while (*s)
-	{
-		if (line_start)
-		{
-			/* Deal with leading spaces and tabs */
-			if (*s == ' ') space_start = true;
-			else if (*s == '\t') tab_start = true;
-			
-			/* Deal with slash star or double slash */
-			else if (*s == '/')
-			{
-				char *next = s + 1;
-				if (*next == '/' || *next == '*') comments++;
-				line_start = false;
-			}
-
-			/* Deal with "#" */
-			else if (*s == '#')
-			{
-				comments++;
-				line_start = false;
-			}
-
-			else line_start = false;
-		}
-
-		/* Deal with new line */
-		if (*s == '\n')
-		{
-			if (line_length > longest_line) longest_line = line_length;
-			if (line_length > 2) relevant_bytes += line_length;
-			lines++;
-			line_start = true;
-			line_length = 0;
-		}
-		else line_length++;
-
-		/* Search for SPDX-License-Identifier */
-		if (!spdx_tag) if (bytes < MAX_FILE_HEADER) spdx_tag = is_spdx_license_identifier(s);
-
-		bytes++;
-		s++;
-	}
-
 	/* Skip binaries */
-	if (size == bytes && lines)
+	if (size == stats->nul && stats->lines)
 	{
-		int average_line = relevant_bytes / lines;
+		int average_line = stats->relevant_bytes / stats->lines;
 		int score = 0;
-		if (lines <= BEST_PRACTICES_MAX_LINES) score++;
+		if (stats->lines <= BEST_PRACTICES_MAX_LINES) score++;
 		if (average_line <= BEST_PRACTICES_MAX_LINE_LN) score++;
-		if (comments <= BEST_PRACTICES_MAX_LINES_PER_COMMENT) score++;
-		if (!(tab_start && space_start)) score++;
-		if (spdx_tag) score++;
-
-		/* Assemble csv path */
-		char csv_path[MAX_PATH_LEN] = "\0";
-		if (mined_path)
-		{
-			strcpy(csv_path, mined_path);
-			strcat(csv_path, "/"TABLE_NAME_QUALITY".csv");
-		}
+		if (stats->comments <= BEST_PRACTICES_MAX_LINES_PER_COMMENT) score++;
+		if (!(stats->tab_start && stats->space_start)) score++;
+		if (stats->spdx_tag) score++;
 
 		/* Output quality score */
-		if (*csv_path)
-		{
-			FILE *fp = fopen(csv_path, "a");
-			fprintf(fp, "%s,0,%d\n", md5, score);
-			fclose(fp);
-		}
+		if (out)
+			sink_printf(out, "%s,0,%d\n", md5, score);
 		else printf("%s,0,%d\n", md5, score);
 	}
 }
+
+/**
+ * @brief Mine quality statistics from the code
+ * 
+ * @param out quality csv sink (NULL prints to stdout)
+ * @param md5 file mdz
+ * @param src pointer to data source
+ * @param size data size
+ */
+void mine_quality(struct sink *out, char *md5, char *src, long size)
+{
+	/* Skip files below MIN_FILE_SIZE */
+	if (size < MIN_FILE_SIZE) return;
+
+	struct content_stats stats;
+	content_scan(&stats, src, size, false);
+	mine_quality_scanned(out, md5, &stats, size);
+}
@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/sink.c
+ *
+ * Buffered output to the mined/ csv files
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file sink.c
+  * @date 18 Oct 2026
+  * @brief Detectors used to open, append one line to and close their .csv for every file mined,
+  * and file/ sectors were flushed after every line. A sink is kept per output file (looked up
+  * by path) and buffers complete lines, which are appended with a single write when the buffer
+  * is full, when SINK_FLUSH_SECONDS passed since the last write out, at the end of each
+  * component (sink_flush_all) and at exit. The file is opened (O_APPEND) only to write out a
+  * buffer, so no descriptors are held. On SIGINT, SIGTERM and SIGHUP the buffers are written
+  * out before the process ends, skipping a sink another thread is writing to at that instant.
+  * On a crash the output not yet written out is lost, but files never end in a partial line
+  */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "minr.h"
+#include "sink.h"
+
+static struct sink *sinks[SINK_BUCKETS];
+static pthread_mutex_t sink_registry = PTHREAD_MUTEX_INITIALIZER;
+static bool sink_handlers = false;
+
+/**
+ * @brief Bucket of a path in the sink registry (FNV-1a)
+ *
+ * @param path file path
+ * @return bucket number
+ */
+static uint32_t sink_bucket(char *path)
+{
+	uint32_t hash = 2166136261u;
+	for (uint8_t *p = (uint8_t *) path; *p; p++)
+		hash = (hash ^ *p) * 16777619u;
+	return hash % SINK_BUCKETS;
+}
+
+/**
+ * @brief Append data to path with as few writes as possible. Only async-signal-safe
+ * calls are used, since this is also called from sink_signal
+ *
+ * @param path file path
+ * @param data data to append
+ * @param ln data size
+ * @return true if succeed
+ */
+static bool sink_append(char *path, char *data, uint64_t ln)
+{
+	if (!ln)
+		return true;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd < 0)
+		return false;
+
+	uint64_t done = 0;
+	while (done < ln)
+	{
+		ssize_t written = write(fd, data + done, ln - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			break;
+		done += written;
+	}
+	close(fd);
+	return done == ln;
+}
+
+/**
+ * @brief Take a sink for writing. The busy flag keeps sink_signal off the buffer
+ *
+ * @param sink output sink
+ */
+static void sink_enter(struct sink *sink)
+{
+	pthread_mutex_lock(&sink->lock);
+	while (__atomic_exchange_n(&sink->busy, true, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+/**
+ * @brief Release a sink taken with sink_enter
+ *
+ * @param sink output sink
+ */
+static void sink_leave(struct sink *sink)
+{
+	__atomic_store_n(&sink->busy, false, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sink->lock);
+}
+
+/**
+ * @brief Write out the buffer of a sink taken with sink_enter
+ *
+ * @param sink output sink
+ * @return true if succeed
+ */
+static bool sink_write_out(struct sink *sink)
+{
+	if (!sink_append(sink->path, sink->buf, sink->ln))
+		return false;
+	sink->ln = 0;
+	sink->flushed = time(NULL);
+	return true;
+}
+
+/**
+ * @brief Write out the buffer of a sink taken with sink_enter, exiting on errors
+ *
+ * @param sink output sink
+ */
+static void sink_flush(struct sink *sink)
+{
+	if (sink_write_out(sink))
+		return;
+
+	sink_leave(sink);
+	printf("Error writing %s\n", sink->path);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Write out the buffers of all the sinks
+ *
+ * @return true if succeed
+ */
+static bool sink_write_all(void)
+{
+	bool ok = true;
+	pthread_mutex_lock(&sink_registry);
+	for (int i = 0; i < SINK_BUCKETS; i++)
+		for (struct sink *sink = sinks[i]; sink; sink = sink->next)
+		{
+			sink_enter(sink);
+			if (!sink_write_out(sink))
+			{
+				printf("Error writing %s\n", sink->path);
+				ok = false;
+			}
+			sink_leave(sink);
+		}
+	pthread_mutex_unlock(&sink_registry);
+	return ok;
+}
+
+/**
+ * @brief Signal handler writing out the buffers before the process ends. Sinks being
+ * written to are skipped, the others are left busy so that no thread touches them again
+ *
+ * @param sig signal number
+ */
+static void sink_signal(int sig)
+{
+	int saved_errno = errno;
+	for (int i = 0; i < SINK_BUCKETS; i++)
+		for (struct sink *sink = __atomic_load_n(&sinks[i], __ATOMIC_ACQUIRE); sink; sink = sink->next)
+			if (!__atomic_exchange_n(&sink->busy, true, __ATOMIC_ACQUIRE))
+				sink_append(sink->path, sink->buf, sink->ln);
+	errno = saved_errno;
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/**
+ * @brief Exit handler writing out the buffers
+ */
+static void sink_exit(void)
+{
+	sink_write_all();
+}
+
+/**
+ * @brief Install the signal and exit handlers (signals being ignored are left alone)
+ */
+static void sink_install(void)
+{
+	int signals[] = {SIGINT, SIGTERM, SIGHUP};
+	struct sigaction action, old;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sink_signal;
+	sigemptyset(&action.sa_mask);
+
+	for (int i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		if (!sigaction(signals[i], NULL, &old) && old.sa_handler == SIG_DFL)
+			sigaction(signals[i], &action, NULL);
+
+	atexit(sink_exit);
+	sink_handlers = true;
+}
+
+/**
+ * @brief Return the sink of path, registering it the first time
+ *
+ * @param path file path
+ * @param create create the file (like fopen with "a") when the sink is registered,
+ * otherwise it is created by the first write out
+ * @return output sink, or NULL if the file cannot be created
+ */
+static struct sink *sink_get(char *path, bool create)
+{
+	uint32_t bucket = sink_bucket(path);
+	struct sink *sink;
+
+	pthread_mutex_lock(&sink_registry);
+	for (sink = sinks[bucket]; sink; sink = sink->next)
+		if (!strcmp(sink->path, path))
+			break;
+
+	if (!sink)
+	{
+		int fd = create ? open(path, O_WRONLY | O_CREAT | O_APPEND, 0666) : -1;
+		if (fd >= 0 || !create)
+		{
+			if (fd >= 0)
+				close(fd);
+			if (!sink_handlers)
+				sink_install();
+
+			sink = calloc(1, sizeof(struct sink));
+			sink->path = strdup(path);
+			sink->flushed = time(NULL);
+			pthread_mutex_init(&sink->lock, NULL);
+			sink->next = sinks[bucket];
+			__atomic_store_n(&sinks[bucket], sink, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&sink_registry);
+	return sink;
+}
+
+/**
+ * @brief Return the sink of path, creating the file (like fopen with "a") the first time
+ *
+ * @param path file path
+ * @return output sink, or NULL if the file cannot be created
+ */
+struct sink *sink_open(char *path)
+{
+	return sink_get(path, true);
+}
+
+/**
+ * @brief Return the sink of a mined/ table (mined_path/table.csv). Tables are resolved
+ * once per job, so their file is only created with the first line written to it
+ *
+ * @param mined_path mined/ directory
+ * @param table table name
+ * @return output sink
+ */
+struct sink *sink_table(char *mined_path, char *table)
+{
+	char path[MAX_PATH_LEN];
+	snprintf(path, sizeof(path), "%s/%s.csv", mined_path, table);
+	return sink_get(path, false);
+}
+
+/**
+ * @brief Append complete lines to a sink
+ *
+ * @param sink output sink
+ * @param data lines
+ * @param ln data size
+ */
+void sink_write(struct sink *sink, char *data, uint64_t ln)
+{
+	sink_enter(sink);
+
+	if (!sink->buf)
+		sink->buf = malloc(SINK_BUFFER_SIZE);
+
+	if (sink->ln + ln > SINK_BUFFER_SIZE)
+		sink_flush(sink);
+
+	/* Lines larger than the buffer are written right away */
+	if (ln > SINK_BUFFER_SIZE)
+	{
+		if (!sink_append(sink->path, data, ln))
+		{
+			sink_leave(sink);
+			printf("Error writing %s\n", sink->path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	else
+	{
+		memcpy(sink->buf + sink->ln, data, ln);
+		sink->ln += ln;
+	}
+
+	if (time(NULL) - sink->flushed >= SINK_FLUSH_SECONDS)
+		sink_flush(sink);
+
+	sink_leave(sink);
+}
+
+/**
+ * @brief Append a formatted line to a sink
+ *
+ * @param sink output sink
+ * @param fmt printf format
+ */
+void sink_printf(struct sink *sink, const char *fmt, ...)
+{
+	char line[SINK_LINE_SIZE];
+	va_list args;
+
+	va_start(args, fmt);
+	int ln = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	if (ln < 0)
+		return;
+
+	if (ln < sizeof(line))
+	{
+		sink_write(sink, line, ln);
+		return;
+	}
+
+	char *long_line = malloc(ln + 1);
+	va_start(args, fmt);
+	vsnprintf(long_line, ln + 1, fmt, args);
+	va_end(args);
+	sink_write(sink, long_line, ln);
+	free(long_line);
+}
+
+/**
+ * @brief Write out the buffers of all the sinks (end of a component)
+ */
+void sink_flush_all(void)
+{
+	if (!sink_write_all())
+		exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Write out and release all the sinks. No other thread may be using them
+ */
+void sink_close_all(void)
+{
+	sink_flush_all();
+
+	pthread_mutex_lock(&sink_registry);
+	for (int i = 0; i < SINK_BUCKETS; i++)
+	{
+		struct sink *sink = sinks[i];
+		__atomic_store_n(&sinks[i], NULL, __ATOMIC_RELEASE);
+		while (sink)
+		{
+			struct sink *next = sink->next;
+			pthread_mutex_destroy(&sink->lock);
+			free(sink->path);
+			free(sink->buf);
+			free(sink);
+			sink = next;
+		}
+	}
+	pthread_mutex_unlock(&sink_registry);
+}
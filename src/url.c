@@ -37,6 +37,10 @@
 #include "ldb.h"
 #include "wfp.h"
 #include "minr_log.h"
+#include "mine_pool.h"
+#include "url.h"
+#include "extract.h"
+#include "sink.h"
 #include <sys/time.h>
 /**
  * @brief Calculate purl md5
@@ -76,17 +80,7 @@ void get_purl_id(struct minr_job *job)
  */
 void url_add(struct minr_job *job)
 {
-	char path[MAX_PATH_LEN]="\0";
-	sprintf(path, "%s/%s.csv", job->mined_path, TABLE_NAME_URL);
-
-	FILE *fp = fopen(path, "a");
-	if (!fp)
-	{
-		printf("Cannot create file %s\n", path);
-		exit(EXIT_FAILURE);
-	}
-	fprintf(fp, "%s,%s,%s\n", job->urlid, job->metadata, *job->download_url ? job->download_url : job->url);
-	fclose(fp);
+	sink_printf(job->out_url, "%s,%s,%s\n", job->urlid, job->metadata, *job->download_url ? job->download_url : job->url);
 
 	/* Obtain purl id and purl@version id */
 	get_purl_id(job);
@@ -94,30 +88,18 @@ void url_add(struct minr_job *job)
 	/* Load license from metadata */
 	extract_csv(job->license, job->metadata, 5, MAX_ARG_LEN);
 	if (*job->license)
-	{
-		sprintf(path, "%s/%s.csv", job->mined_path, TABLE_NAME_LICENSE);
-		FILE *fp = fopen(path, "a");
-		if (!fp)
-		{
-			printf("Cannot create file %s\n", path);
-			exit(EXIT_FAILURE);
-		}
-		fprintf(fp, "%s,0,%s\n", job->versionid, job->license);
-		fprintf(fp, "%s,0,%s\n", job->purlid, job->license);
-		fclose(fp);
-	}
+		sink_printf(job->out_license, "%s,0,%s\n%s,0,%s\n", job->versionid, job->license, job->purlid, job->license);
 }
 
 /**
- * @brief Download a URL for a job
- * 
+ * @brief Prepare a job for mining components: reserve the mz caches, open the
+ * mined/file sectors and resolve the table sinks. These are kept across the
+ * components of a batch
+ *
  * @param job pointer to minr job
  */
-void url_download(struct minr_job *job)
+void url_mine_begin(struct minr_job *job)
 {
-	bool downloaded = false;
-	char * aux_root_dir = NULL;
-	
 	/* Reserve memory for snippet fingerprinting */
 	if (!job->exclude_mz)
 	{
@@ -132,6 +114,64 @@ void url_download(struct minr_job *job)
 		}
 	}
 
+	/* Open all file handlers in mined/files (256 files) */
+	job->out_file = open_file(job->mined_path, TABLE_NAME_FILE);
+	if (job->mine_all)
+		job->out_file_extra = open_file(job->mined_extra_path, TABLE_NAME_FILE);
+
+	/* Table files are created with their first line */
+	job->out_url = sink_table(job->mined_path, TABLE_NAME_URL);
+	job->out_license = sink_table(job->mined_path, TABLE_NAME_LICENSE);
+	job->out_copyright = sink_table(job->mined_path, TABLE_NAME_COPYRIGHT);
+	job->out_quality = sink_table(job->mined_path, TABLE_NAME_QUALITY);
+	job->out_crypto = sink_table(job->mined_path, TABLE_NAME_CRYPTOGRAPHY);
+	job->out_attribution = sink_table(job->mined_path, TABLE_NAME_ATTRIBUTION);
+}
+
+/**
+ * @brief Open the pivot file of the component (one per first urlid byte)
+ *
+ * @param mined_path mined/ directory
+ * @param urlid component id
+ * @return pivot file sink, or NULL
+ */
+static struct sink *url_open_pivot(char *mined_path, char *urlid)
+{
+	struct sink *out = NULL;
+	char pivot_path[MAX_PATH_LEN];
+	sprintf(pivot_path, "%s/%s/", mined_path, TABLE_NAME_PIVOT);
+	if (create_dir(pivot_path) && *urlid)
+	{
+		strncat(pivot_path, urlid, 2);
+		strcat(pivot_path, ".csv");
+		out = sink_open(pivot_path);
+		if (!out)
+			minr_log("Error opening %s\n", pivot_path);
+	}
+	else
+	{
+		minr_log("Error creating %s\n", pivot_path);
+	}
+	return out;
+}
+
+/**
+ * @brief First stage of a component: clear the ids of a previous component, then create
+ * a temporary directory and download job->url into it (or take job->url as a local folder)
+ *
+ * @param c component
+ */
+void url_fetch(struct url_component *c)
+{
+	static uint32_t sequence = 0;
+	struct minr_job *job = c->job;
+
+	/* Clear the ids of a previous component */
+	*job->urlid = 0;
+	*job->purlid = 0;
+	*job->versionid = 0;
+	*job->license = 0;
+
 	/* Mine a local folder instead of a URL */
 	if (is_dir(job->url))
 	{
@@ -143,69 +183,90 @@ void url_download(struct minr_job *job)
 		MD5((uint8_t *)job->metadata, strlen(job->metadata), urlid);
 		ldb_bin_to_hex(urlid, MD5_LEN, job->urlid);
 
-		downloaded = true;
+		c->downloaded = true;
 	}
 	/* Create temporary component directory */
 	else
 	{
 		struct timeval  tv;
 		gettimeofday(&tv, NULL);
-		sprintf(job->tmp_dir,"%s/minr-%d-%lu", tmp_path, getpid(), tv.tv_sec);
+		sprintf(job->tmp_dir,"%s/minr-%d-%lu-%u", tmp_path, getpid(), tv.tv_sec, __sync_fetch_and_add(&sequence, 1));
 		mkdir(job->tmp_dir, 0755);
 		/*keep a copy of this root dir to erase later*/
-		aux_root_dir = strdup(job->tmp_dir);
+		c->root_dir = strdup(job->tmp_dir);
 		/* urlid will contain the hex md5 of the entire component */
-		downloaded = download(job);
+		c->archive = download_fetch(job);
+		c->downloaded = (c->archive != NULL);
 	}
+}
 
-	/* Open all file handlers in mined/files (256 files) */
-	job->out_file = open_file(job->mined_path, TABLE_NAME_FILE);
-	/*Pivot table will have only one file*/
-	char pivot_path[MAX_PATH_LEN];
-	sprintf(pivot_path, "%s/%s/", job->mined_path, TABLE_NAME_PIVOT);
-	if (create_dir(pivot_path) && *job->urlid)
+/**
+ * @brief Second stage of a component: calculate the urlid and expand the downloaded file.
+ * Supported archives are only listed, to be mined in memory by url_process
+ *
+ * @param c component
+ */
+void url_expand(struct url_component *c)
+{
+	struct minr_job *job = c->job;
+	if (!c->archive)
+		return;
+
+	/* Scancode reads license files from disk */
+	if (!job->scancode_mode)
+		c->extract = extract_open(c->archive);
+
+	if (c->extract)
 	{
-		strncat(pivot_path, job->urlid, 2);
-		strcat(pivot_path, ".csv");
-		job->out_pivot = fopen(pivot_path, "a");
-		if (!job->out_pivot)
-			minr_log("Error opening %s\n", pivot_path);
+		/* The top directory (if any) is entered by extract_mine */
+		ldb_bin_to_hex(c->extract->md5, MD5_LEN, job->urlid);
+		free(c->archive);
 	}
 	else
 	{
-		minr_log("Error creating %s\n", pivot_path);
+		load_urlid(job, c->archive);
+		download_expand(job, c->archive);
 	}
-	
+	c->archive = NULL;
+}
+
+/**
+ * @brief Last stage of a component: mine the expanded files and remove the temporary directory
+ *
+ * @param c component
+ */
+void url_process(struct url_component *c)
+{
+	struct minr_job *job = c->job;
+
+	/*Pivot table will have only one file*/
+	job->out_pivot = url_open_pivot(job->mined_path, job->urlid);
 	if (job->mine_all)
-	{
-		job->out_file_extra = open_file(job->mined_extra_path, TABLE_NAME_FILE);
-		/*Pivot table will have only one file*/
-		char pivot_path[MAX_PATH_LEN];
-		sprintf(pivot_path, "%s/%s/", job->mined_extra_path, TABLE_NAME_PIVOT);
-		if (create_dir(pivot_path))
-		{
-			strncat(pivot_path, job->urlid, 2);
-			strcat(pivot_path, ".csv");
-			job->out_pivot_extra= fopen(pivot_path, "a");
-			if (!job->out_pivot_extra)
-				minr_log("Error opening %s\n", pivot_path);
-		}
-		else
-		{
-			minr_log("Error creating %s\n", pivot_path);
-		}
-	}
+		job->out_pivot_extra = url_open_pivot(job->mined_extra_path, job->urlid);
 
 	/* Process downloaded/expanded directory */
-	if (is_dir(job->tmp_dir) && downloaded)
+	if ((c->extract || is_dir(job->tmp_dir)) && c->downloaded)
 	{
 		/* Add info to urls.csv */
 		url_add(job);
 		
-		/* Find for license declaration into specific files in the roor dir (no recursive) */
-		mine_license_exec(job);
+		/* Mine the archive in memory (license files included). A tar stream found broken
+		   before anything was mined is expanded with the external tools instead */
+		if (c->extract && !extract_mine(job, c->extract))
+		{
+			char *archive = strdup(c->extract->path);
+			extract_close(c->extract);
+			c->extract = NULL;
+			download_expand(job, archive);
+		}
+
+		if (!c->extract)
+		{
+			/* Find for license declaration into specific files in the roor dir (no recursive) */
+			mine_license_exec(job);
 
-		recurse(job, job->tmp_dir);
+			mine_tree(job, job->tmp_dir);
+		}
 	}
 
 	else
@@ -213,36 +274,49 @@ void url_download(struct minr_job *job)
 		printf("Capture failed: %s\n",job->tmp_dir);
 	}
 
+	extract_close(c->extract);
+	c->extract = NULL;
+
 	/* Delete temp directory which store source package via url downloading*/	
-	if (aux_root_dir != NULL && aux_root_dir[0] == '\0')
-	{
-		// aux_root_dir is NULL string
-	}
-	else if (aux_root_dir == NULL)
-	{
-		// aux_root_dir is NULL pointer
-	}
-	else
-	{
-		rm_dir(aux_root_dir);
-	}
+	if (c->root_dir && *c->root_dir)
+		rm_dir(c->root_dir);
 
-	free(aux_root_dir);
-	/* Close files */
-	for (int i=0; i < 256; i++)
-	{
-		fclose(job->out_file[i]);
-		if (job->mine_all)
-		{
-			fclose(job->out_file_extra[i]);
-		}
-	}
-	
-	if (job->out_pivot)
-		fclose(job->out_pivot);
+	free(c->root_dir);
+	c->root_dir = NULL;
 
-	if (job->mine_all)
-		fclose(job->out_pivot_extra);
+	job->out_pivot = NULL;
+	job->out_pivot_extra = NULL;
+
+	/* The output of the component is complete on disk */
+	sink_flush_all();
+}
+
+/**
+ * @brief Download (or take a local folder) and mine the component of the job
+ * (job->metadata and job->url). Requires url_mine_begin
+ *
+ * @param job pointer to minr job
+ */
+void url_mine(struct minr_job *job)
+{
+	struct url_component c;
+	memset(&c, 0, sizeof(c));
+	c.job = job;
+
+	url_fetch(&c);
+	url_expand(&c);
+	url_process(&c);
+}
+
+/**
+ * @brief Close the mined/file sectors and flush the mz caches opened by url_mine_begin
+ *
+ * @param job pointer to minr job
+ */
+void url_mine_end(struct minr_job *job)
+{
+	/* Write out and close the csv files */
+	sink_close_all();
 
 	if (!job->exclude_mz)
 	{
@@ -259,5 +333,101 @@ void url_download(struct minr_job *job)
 	
 	if (job->mine_all)
 		free(job->out_file_extra);
+}
+
+/**
+ * @brief Download a URL for a job
+ * 
+ * @param job pointer to minr job
+ */
+void url_download(struct minr_job *job)
+{
+	url_mine_begin(job);
+	url_mine(job);
+	url_mine_end(job);
+}
+
+/**
+ * @brief Parse a manifest line: vendor,component,version,release_date,license,purl,url
+ *
+ * @param line manifest line (modified)
+ * @param[out] metadata the six metadata values
+ * @param[out] url URL or local folder
+ * @return false if the line is malformed
+ */
+bool url_manifest_parse(char *line, char *metadata, char *url)
+{
+	/* Remove trailing LF/CR */
+	size_t lineln = strlen(line);
+	while (lineln && (line[lineln - 1] == '\n' || line[lineln - 1] == '\r'))
+		line[--lineln] = 0;
+
+	/* The URL follows the six metadata values */
+	char *u = line;
+	for (int i = 0; i < 6 && u; i++)
+	{
+		u = strchr(u, ',');
+		if (u)
+			u++;
+	}
+
+	if (!u || !*u || u - line > MAX_ARG_LEN || strlen(u) >= MAX_ARG_LEN)
+	{
+		printf("Wrong manifest line: %s\n", line);
+		return false;
+	}
+
+	u[-1] = 0;
+	strcpy(metadata, line);
+	strcpy(url, u);
+	return true;
+}
+
+/**
+ * @brief Mine the components listed in a manifest (--batch) in a single run. Each line holds
+ * vendor,component,version,release_date,license,purl,url (a URL or a local folder).
+ * Licenses, crypto definitions, mz caches and open sectors are reused across components;
+ * cached mz records are written out as each archive cache fills up, and at the end
+ *
+ * @param job pointer to minr job
+ * @param manifest path to the manifest
+ * @return number of components that could not be parsed
+ */
+int url_batch(struct minr_job *job, char *manifest)
+{
+	FILE *fp = fopen(manifest, "r");
+	if (!fp)
+	{
+		printf("Cannot open manifest %s\n", manifest);
+		exit(EXIT_FAILURE);
+	}
+
+	int errors = 0;
+	uint64_t count = 0;
+	char *line = NULL;
+	size_t len = 0;
+
+	url_mine_begin(job);
 
+	while (getline(&line, &len, fp) != -1)
+	{
+		if (!*line || *line == '\n' || *line == '\r')
+			continue;
+
+		if (!url_manifest_parse(line, job->metadata, job->url))
+		{
+			errors++;
+			continue;
+		}
+
+		url_mine(job);
+		count++;
+	}
+
+	url_mine_end(job);
+
+	printf("%lu components mined from %s\n", count, manifest);
+	free(line);
+	fclose(fp);
+	return errors;
 }
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/url_pipeline.c
+ *
+ * Pipelined mining of the components of a manifest
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file url_pipeline.c
+  * @date 18 Oct 2026
+  * @brief Components of a --batch manifest go through three stages connected by bounded
+  * queues: fetchers download them, extractors expand them and miners mine them, each stage
+  * with its own worker threads, so downloads, decompression and mining overlap. Every
+  * component has its own job copy and temporary directory. Fetchers stop taking new
+  * components while tmp_path is short of space, until a miner releases one
+  */
+
+#include <sys/statvfs.h>
+
+#include "minr.h"
+#include "mz_codec.h"
+#include "url_pipeline.h"
+#include "arena.h"
+
+/* Components in flight, to apply backpressure on tmp_path */
+struct url_pipeline
+{
+	int in_flight;
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+};
+
+/* Workers of a stage, taking components from one queue into the next */
+struct url_stage
+{
+	struct url_pipeline *pipeline;
+	struct url_queue *in;
+	struct url_queue *out;      // NULL for the last stage
+	void (*run)(struct url_pipeline *pipeline, struct url_item *item);
+};
+
+static void url_queue_init(struct url_queue *queue, int producers)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->producers = producers;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+}
+
+static void url_queue_destroy(struct url_queue *queue)
+{
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->lock);
+}
+
+/**
+ * @brief Queue a component, waiting while the queue is full
+ *
+ * @param queue stage queue
+ * @param item component
+ */
+static void url_queue_push(struct url_queue *queue, struct url_item *item)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == URL_QUEUE_SIZE)
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+
+	queue->items[(queue->head + queue->count) % URL_QUEUE_SIZE] = item;
+	queue->count++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Take the next component, waiting while the queue is empty
+ *
+ * @param queue stage queue
+ * @return component, or NULL when the queue is empty and all its producers are done
+ */
+static struct url_item *url_queue_pop(struct url_queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->count && queue->producers)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+
+	struct url_item *item = NULL;
+	if (queue->count)
+	{
+		item = queue->items[queue->head];
+		queue->head = (queue->head + 1) % URL_QUEUE_SIZE;
+		queue->count--;
+		pthread_cond_signal(&queue->not_full);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return item;
+}
+
+/* A producer is done with the queue */
+static void url_queue_close(struct url_queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->producers--;
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Return true if tmp_path has at least URL_PIPELINE_MIN_FREE % of free space
+ */
+static bool url_tmp_available(void)
+{
+	struct statvfs stat;
+	if (statvfs(tmp_path, &stat) != 0 || !stat.f_blocks)
+		return true;
+	return stat.f_bavail * 100 / stat.f_blocks >= URL_PIPELINE_MIN_FREE;
+}
+
+/* Fetcher: wait for space in tmp_path, then download */
+static void url_stage_fetch(struct url_pipeline *pipeline, struct url_item *item)
+{
+	/* A single component is always let through, so the pipeline cannot stall */
+	pthread_mutex_lock(&pipeline->lock);
+	while (pipeline->in_flight && !url_tmp_available())
+		pthread_cond_wait(&pipeline->released, &pipeline->lock);
+	pipeline->in_flight++;
+	pthread_mutex_unlock(&pipeline->lock);
+
+	url_fetch(&item->component);
+}
+
+/* Extractor */
+static void url_stage_expand(struct url_pipeline *pipeline, struct url_item *item)
+{
+	url_expand(&item->component);
+}
+
+/* Miner: mine and remove the temporary directory, releasing its space */
+static void url_stage_mine(struct url_pipeline *pipeline, struct url_item *item)
+{
+	url_process(&item->component);
+	free(item);
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->in_flight--;
+	pthread_cond_broadcast(&pipeline->released);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * @brief Stage worker thread
+ *
+ * @param ptr pointer to the stage
+ * @return NULL
+ */
+static void *url_stage_worker(void *ptr)
+{
+	struct url_stage *stage = ptr;
+	struct url_item *item;
+
+	while ((item = url_queue_pop(stage->in)))
+	{
+		stage->run(stage->pipeline, item);
+		if (stage->out)
+			url_queue_push(stage->out, item);
+	}
+
+	if (stage->out)
+		url_queue_close(stage->out);
+
+	mz_codec_thread_free();
+	load_thread_free();
+	arena_thread_free();
+	return NULL;
+}
+
+/**
+ * @brief Mine the components listed in a manifest (see url_batch) with job->fetchers,
+ * job->extractors and job->miners worker threads
+ *
+ * @param job pointer to minr job
+ * @param manifest path to the manifest
+ * @return number of components that could not be parsed
+ */
+int url_pipeline(struct minr_job *job, char *manifest)
+{
+	FILE *fp = fopen(manifest, "r");
+	if (!fp)
+	{
+		printf("Cannot open manifest %s\n", manifest);
+		exit(EXIT_FAILURE);
+	}
+
+	struct url_pipeline pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.released, NULL);
+
+	/* Queues are fed by the manifest reader, the fetchers and the extractors */
+	struct url_queue queues[3];
+	url_queue_init(&queues[0], 1);
+	url_queue_init(&queues[1], job->fetchers);
+	url_queue_init(&queues[2], job->extractors);
+
+	struct url_stage stages[3] =
+	{
+		{&pipeline, &queues[0], &queues[1], url_stage_fetch},
+		{&pipeline, &queues[1], &queues[2], url_stage_expand},
+		{&pipeline, &queues[2], NULL, url_stage_mine}
+	};
+	int workers[3] = {job->fetchers, job->extractors, job->miners};
+	int thread_count = workers[0] + workers[1] + workers[2];
+	pthread_t *tids = calloc(thread_count, sizeof(pthread_t));
+
+	url_mine_begin(job);
+
+	int t = 0;
+	for (int s = 0; s < 3; s++)
+		for (int w = 0; w < workers[s]; w++)
+			pthread_create(&tids[t++], NULL, url_stage_worker, &stages[s]);
+
+	int errors = 0;
+	uint64_t count = 0;
+	char *line = NULL;
+	size_t len = 0;
+
+	while (getline(&line, &len, fp) != -1)
+	{
+		if (!*line || *line == '\n' || *line == '\r')
+			continue;
+
+		struct url_item *item = malloc(sizeof(struct url_item));
+		item->job = *job;
+		memset(&item->component, 0, sizeof(item->component));
+		item->component.job = &item->job;
+
+		if (!url_manifest_parse(line, item->job.metadata, item->job.url))
+		{
+			free(item);
+			errors++;
+			continue;
+		}
+
+		url_queue_push(&queues[0], item);
+		count++;
+	}
+	url_queue_close(&queues[0]);
+
+	for (t = 0; t < thread_count; t++)
+		pthread_join(tids[t], NULL);
+
+	url_mine_end(job);
+
+	printf("%lu components mined from %s\n", count, manifest);
+	for (int q = 0; q < 3; q++)
+		url_queue_destroy(&queues[q]);
+	pthread_cond_destroy(&pipeline.released);
+	pthread_mutex_destroy(&pipeline.lock);
+	free(tids);
+	free(line);
+	fclose(fp);
+	return errors;
+}
@@ -39,6 +39,9 @@
 #include "wfp.h"
 #include "file.h"
 #include "mz.h"
+#include "mz_walk.h"
+#include "mz_codec.h"
+#include "arena.h"
 
 int *out_snippet;
 
@@ -88,20 +91,18 @@ void extract_wfp(uint8_t *md5, char *src, uint32_t length, bool check_mz)
 	
 	uint32_t mem_alloc =  src_ln > MAX_FILE_SIZE ? src_ln : MAX_FILE_SIZE;
 
-	uint8_t *buffer = malloc(WFP_BUFFER_SIZE * 256);
-	uint32_t *hashes = malloc(mem_alloc);
-	uint32_t *lines = malloc(mem_alloc);
+	/* Buffers come from the arena, reset for every record */
+	uint8_t *buffer = arena_alloc(WFP_BUFFER_SIZE * 256);
+	uint32_t *hashes = arena_alloc(mem_alloc);
+	uint32_t *lines = arena_alloc(mem_alloc);
+	uint8_t *grams = arena_alloc(WINNOWING_GRAMS_SIZE(mem_alloc));
+	uint32_t *windows = arena_alloc(WINNOWING_WINDOWS_SIZE(mem_alloc));
 
-	if (!buffer || !hashes || !lines)
-	{
-		free(buffer);
-		free(hashes);
-		free(lines);
+	if (!buffer || !hashes || !lines || !grams || !windows)
 		return;
-	}
 
 	/* Capture hashes (Winnowing) */
-	uint32_t size = winnowing(src, hashes, lines, mem_alloc);
+	uint32_t size = winnowing_buffers(src, hashes, lines, mem_alloc, grams, windows);
 
 	uint8_t n = 0;
 	uint16_t line = 0;
@@ -137,10 +138,6 @@ void extract_wfp(uint8_t *md5, char *src, uint32_t length, bool check_mz)
 	for (int i = 0; i < 256; i++)
 		if (buffer_ln[i]) if (!write(out_snippet[i], buffer + (WFP_BUFFER_SIZE * i), buffer_ln[i]))
 				printf("Warning: error writing snippet sector\n");
-	
-	free (buffer);
-	free (hashes);
-	free (lines);
 }
 
 /**
@@ -151,24 +148,28 @@ void extract_wfp(uint8_t *md5, char *src, uint32_t length, bool check_mz)
  */
 bool mz_wfp_extract_handler(struct mz_job *job)
 {
+	arena_reset();
+
 	/* Fill MD5 with item id */
 	memcpy(job->ptr + 2, job->id, MZ_MD5);
 
 	/* Decompress */
-	MZ_DEFLATE(job);
+	mz_job_inflate(job);
 	job->data[job->data_ln] = 0;
 	extract_wfp(job->ptr, job->data, job->data_ln, true);
-	free(job->data);
 
 	return true;
 }
 
 /**
- * @brief Extracts wfps from the given mz file path 
+ * @brief Extracts wfps from an mz sector already loaded in memory
  * 
- * @param path path to mz file
+ * @param path sector path, used for reporting
+ * @param mz_id sector number (first two MD5 bytes)
+ * @param mz sector contents
+ * @param mz_ln sector length
  */
-void mz_wfp_extract(char *path)
+void mz_wfp_extract_sector(char *path, uint16_t mz_id, uint8_t *mz, uint64_t mz_ln)
 {
 	uint8_t mzid[MD5_LEN] = "\0";
 	uint8_t mzkey[MD5_LEN] = "\0";
@@ -178,8 +179,8 @@ void mz_wfp_extract(char *path)
 	memset(&job, 0, sizeof(job));
 	strcpy(job.path, path);
 	memset(job.mz_id, 0, 2);
-	job.mz = NULL;
-	job.mz_ln = 0;
+	job.mz = mz;
+	job.mz_ln = mz_ln;
 	job.id = mzid;
 	job.ln = 0;
 	job.data = NULL;        // Uncompressed data
@@ -190,14 +191,31 @@ void mz_wfp_extract(char *path)
 	job.key = NULL;
 	job.ptr = mzkey;
 
-	/* Extract first two MD5 bytes from the file name */
-	memcpy(job.md5, basename(job.path), 4);
-	ldb_hex_to_bin(job.md5, 4, job.ptr);
-
-	/* Read source mz file into memory */
-	job.mz = file_read(job.path, &job.mz_ln);
+	/* The first two MD5 bytes are the sector number */
+	job.ptr[0] = mz_id >> 8;
+	job.ptr[1] = mz_id & 0xff;
 
 	/* Launch wfp extraction */
 	mz_parse(&job, mz_wfp_extract_handler);
-	free(job.mz);
+}
+
+/**
+ * @brief Extracts wfps from the given mz file path 
+ * 
+ * @param path path to mz file
+ */
+void mz_wfp_extract(char *path)
+{
+	uint8_t mz_id[2] = "\0";
+	uint64_t mz_ln = 0;
+	char name[MAX_PATH_LEN] = "\0";
+	strcpy(name, path);
+
+	/* Extract first two MD5 bytes from the file name */
+	ldb_hex_to_bin(basename(name), 4, mz_id);
+
+	/* Read source mz file into memory */
+	uint8_t *mz = mz_map(path, &mz_ln);
+	mz_wfp_extract_sector(path, mz_id[0] << 8 | mz_id[1], mz, mz_ln);
+	mz_unmap(mz, mz_ln);
 }